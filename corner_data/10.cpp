@@ -0,0 +1,80 @@
+#include "src.hpp"
+#include <iostream>
+#include <string>
+#include <utility>
+
+// A value that counts how many exist and how often one is copied.
+struct Tracked {
+    static int alive, copies;
+    int value;
+    Tracked(int v = 0) : value(v) { ++alive; }
+    Tracked(const Tracked &other) : value(other.value) { ++alive; ++copies; }
+    ~Tracked() { --alive; }
+};
+int Tracked::alive = 0, Tracked::copies = 0;
+
+signed main() {
+    {
+        sjtu::map <int, Tracked> from, to;
+        for (int i = 0 ; i < 1000 ; ++i) from[i].value = i * 2;
+        int copiesBefore = Tracked::copies;
+
+        // By key and by iterator; a missing key gives an empty handle.
+        auto nh = from.extract(10);
+        const Tracked *where = &nh.mapped();
+        auto none = from.extract(5000);
+        std::cout << nh.empty() << ' ' << bool(nh) << ' ' << nh.key() << ' ' << nh.mapped().value << ' '
+                  << none.empty() << ' ' << from.size() << ' ' << from.count(10) << '\n';
+        auto res = to.insert(std::move(nh));
+        std::cout << res.inserted << ' ' << res.position->first << ' ' << res.node.empty() << ' ' << nh.empty()
+                  << ' ' << (&res.position->second == where) << ' ' << to.size() << '\n';
+
+        // A key already present hands the node back.
+        auto again = from.extract(from.find(11));
+        again.key() = 10;
+        auto clash = to.insert(std::move(again));
+        std::cout << clash.inserted << ' ' << clash.position->second.value << ' ' << clash.node.empty() << ' '
+                  << clash.node.mapped().value << '\n';
+
+        // Keys may change while out of a map.
+        clash.node.key() = -1;
+        bool renamed = to.insert(std::move(clash.node)).inserted;
+        bool empty = to.insert(std::move(none)).inserted;
+        std::cout << renamed << ' ' << to.begin()->first << ' ' << to.begin()->second.value << ' ' << empty << '\n';
+
+        // Move half of the elements over, from both ends.
+        int moved = 0;
+        while (from.size() > 500) {
+            auto first = from.extract(from.begin());
+            auto last = from.extract(--from.end());
+            moved += to.insert(std::move(first)).inserted + to.insert(std::move(last)).inserted;
+        }
+        long long sum = 0;
+        for (auto it = to.begin() ; it != to.end() ; ++it) sum += it->second.value;
+        std::cout << moved << ' ' << from.size() << ' ' << to.size() << ' ' << sum << ' ' << from.begin()->first
+                  << ' ' << (--to.end())->first << ' ' << Tracked::copies - copiesBefore << '\n';
+
+        // Handles outlive the map they came from, and free what they hold.
+        auto kept = from.extract(600);
+        auto dropped = from.extract(601);
+        int aliveBefore = Tracked::alive;
+        { auto gone = std::move(dropped); }
+        std::cout << aliveBefore - Tracked::alive << ' ' << dropped.empty() << '\n';
+        from.clear();
+        {
+            sjtu::map <int, Tracked> last;
+            last.insert(std::move(kept));
+            std::cout << last.size() << ' ' << last.at(600).value << ' ' << kept.empty() << '\n';
+        }
+    }
+    std::cout << Tracked::alive << '\n';
+
+    // Node handles of string keys swap and move like values.
+    sjtu::map <std::string, int> a, b;
+    a["one"] = 1;
+    a["two"] = 2;
+    auto x = a.extract("one"), y = a.extract("two");
+    x.swap(y);
+    std::cout << x.key() << ' ' << y.key() << ' ' << b.insert(std::move(y)).position->first << ' '
+              << b.insert(std::move(x)).inserted << ' ' << b.size() << ' ' << a.empty() << '\n';
+}
@@ -0,0 +1,34 @@
+#include "src.hpp"
+#include <iostream>
+#include <string>
+
+struct counted {
+    static int built;
+    int x;
+    counted(int x) : x(x) { ++built; }
+    counted(const counted &other) : x(other.x) { ++built; }
+};
+int counted::built = 0;
+
+signed main() {
+    sjtu::map <int, counted> mp;
+    // try_emplace builds the value once, and not at all if the key is taken.
+    mp.try_emplace(1, 10);
+    mp.try_emplace(1, 20);
+    mp.emplace(2, 30);
+    std::cout << counted::built << ' ' << mp.at(1).x << '\n';
+
+    // A hint right at the insert position must still give a correct map.
+    sjtu::map <int, std::string> ms;
+    for (int i = 0 ; i < 1000 ; ++i) ms.insert(ms.end(), {i, "a"});
+    for (int i = 2000 ; i > 1000 ; --i) ms.emplace_hint(ms.find(2000), i, "b");
+    // A useless hint is only a hint.
+    ms.insert(ms.begin(), {1500, "c"});
+    ms.insert(ms.begin(), {3000, "d"});
+    int last = -1, bad = 0;
+    for (auto it = ms.begin() ; it != ms.end() ; ++it) {
+        if (it->first <= last) ++bad;
+        last = it->first;
+    }
+    std::cout << ms.size() << ' ' << bad << ' ' << ms[1500] << ms[3000] << '\n';
+}
@@ -0,0 +1,24 @@
+#include "src.hpp"
+#include <iostream>
+
+signed main() {
+    sjtu::map <int, int> mp;
+    for (int i = 0 ; i < 100000 ; i += 2) mp.insert({i, i});
+
+    // Bounds land on the neighbouring key when the probe is missing.
+    std::cout << mp.lower_bound(41)->first << ' ' << mp.upper_bound(42)->first << ' '
+              << (mp.lower_bound(100000) == mp.end()) << '\n';
+    auto range = mp.equal_range(43);
+    std::cout << (range.first == range.second) << ' ' << range.first->first << '\n';
+
+    // Iterators outside an erased range stay valid.
+    auto keep = mp.find(10);
+    auto after = mp.erase(mp.lower_bound(20), mp.lower_bound(90000));
+    std::cout << mp.size() << ' ' << after->first << ' ' << keep->first << ' '
+              << (--mp.lower_bound(90000))->first << '\n';
+    mp.erase(mp.begin(), mp.find(10));
+    mp.erase(mp.find(99998), mp.end());
+    int sum = 0;
+    for (auto it = mp.begin() ; it != mp.end() ; ++it) sum += it->first > 10 && it->first < 90000;
+    std::cout << mp.size() << ' ' << sum << ' ' << mp.begin()->first << '\n';
+}
@@ -0,0 +1,41 @@
+#include "src.hpp"
+#include <iostream>
+#include <vector>
+#include <utility>
+
+sjtu::map <int, int> build(int n) {
+    sjtu::map <int, int> mp;
+    for (int i = 0 ; i < n ; ++i) mp[i] = i * i;
+    return mp;
+}
+
+signed main() {
+    // Moving hands the elements over; iterators follow them.
+    sjtu::map <int, int> a = build(1000);
+    auto it = a.find(30);
+    sjtu::map <int, int> b(std::move(a));
+    std::cout << b.size() << ' ' << it->second << ' ' << (it == b.find(30)) << '\n';
+    b.erase(it);
+    std::cout << b.size() << ' ' << b.count(30) << '\n';
+
+    // The moved-from map is still usable.
+    a[7] = 49;
+    std::cout << a.size() << ' ' << a.begin()->second << '\n';
+
+    // swap exchanges the contents, iterators stay with their elements.
+    auto ia = a.begin(), ib = b.find(999);
+    a.swap(b);
+    std::cout << a.size() << ' ' << b.size() << ' ' << (ia == b.begin()) << ' ' << (++ib == a.end()) << '\n';
+    using std::swap;
+    swap(a, b);
+    std::cout << a.size() << ' ' << b.size() << '\n';
+
+    a = std::move(b);
+    std::cout << a.size() << ' ' << (--a.end())->first << '\n';
+
+    std::vector <sjtu::map <int, int> > maps;
+    for (int i = 1 ; i <= 50 ; ++i) maps.push_back(build(i));
+    long long total = 0;
+    for (auto &mp : maps) total += mp.size() + (--mp.end())->second;
+    std::cout << total << '\n';
+}
@@ -0,0 +1,25 @@
+#include "src.hpp"
+#include <iostream>
+#include <vector>
+
+signed main() {
+    sjtu::map <int, int> src;
+    for (int i = 0 ; i < 100000 ; ++i) src[i * 3] = i;
+
+    // A sorted range, e.g. another map.
+    sjtu::map <int, int> copy(src.begin(), src.find(150000));
+    std::cout << copy.size() << ' ' << copy.begin()->first << ' ' << (--copy.end())->first << ' '
+              << copy.at(99999) << '\n';
+
+    // Equal keys keep the first one; an out-of-order tail is still inserted.
+    std::vector <sjtu::map <int, int>::value_type> items;
+    for (int i = 0 ; i < 1000 ; ++i) items.emplace_back(i / 2, i);
+    for (int i = 0 ; i < 1000 ; ++i) items.emplace_back(1000 - i, -i);
+    sjtu::map <int, int> mixed(items.begin(), items.end());
+    long long sum = 0;
+    for (auto it = mixed.begin() ; it != mixed.end() ; ++it) sum += it->second;
+    std::cout << mixed.size() << ' ' << mixed[499] << ' ' << mixed[500] << ' ' << mixed[1000] << ' ' << sum << '\n';
+
+    sjtu::map <int, int> none(items.end(), items.end());
+    std::cout << none.size() << ' ' << (none.begin() == none.end()) << '\n';
+}
@@ -0,0 +1,32 @@
+#include "src.hpp"
+#include <iostream>
+
+signed main() {
+    // Key-disjoint maps.
+    sjtu::map <int, int> low, high;
+    for (int i = 0 ; i < 50000 ; ++i) low[i] = i;
+    for (int i = 50000 ; i < 120000 ; ++i) high[i] = -i;
+    const int *addr = &high.find(60000)->second;
+    low.merge(high);
+    std::cout << low.size() << ' ' << high.size() << ' ' << (--low.end())->first << ' '
+              << (addr == &low.find(60000)->second) << '\n';
+
+    // Interleaved keys: equal keys stay behind in the source.
+    sjtu::map <int, int> evens, mixed;
+    for (int i = 0 ; i < 30000 ; i += 2) evens[i] = 1;
+    for (int i = 0 ; i < 30000 ; i += 3) mixed[i] = 2;
+    evens.merge(mixed);
+    long long sum = 0;
+    for (auto it = evens.begin() ; it != evens.end() ; ++it) sum += it->second;
+    std::cout << evens.size() << ' ' << mixed.size() << ' ' << sum << ' ' << mixed.begin()->first << ' '
+              << (--mixed.end())->first << ' ' << evens[9] << ' ' << evens[12] << '\n';
+
+    // Leftovers and merged maps keep working.
+    for (int i = 1 ; i < 30000 ; i += 6) mixed.erase(mixed.find(i - 1));
+    mixed[7] = 7;
+    evens.merge(mixed);
+    std::cout << evens.size() << ' ' << mixed.size() << ' ' << evens[7] << '\n';
+    evens.clear();
+    low.clear();
+    std::cout << evens.size() + low.size() + high.size() << '\n';
+}
@@ -0,0 +1,74 @@
+#include "src.hpp"
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+// A key that counts how often one is built.
+struct Name {
+    static int made;
+    std::string text;
+    Name(const char *s) : text(s) { ++made; }
+    Name(const Name &other) : text(other.text) { ++made; }
+};
+int Name::made = 0;
+
+struct NameLess {
+    using is_transparent = void;
+    bool operator()(const Name &a, const Name &b) const { return a.text < b.text; }
+    bool operator()(const Name &a, const char *b) const { return std::strcmp(a.text.c_str(), b) < 0; }
+    bool operator()(const char *a, const Name &b) const { return std::strcmp(a, b.text.c_str()) < 0; }
+};
+
+// Orders ids by their first digit only, so equal_range spans several keys.
+struct Decade {
+    int value;
+};
+struct ByDecade {
+    using is_transparent = void;
+    bool operator()(int a, int b) const { return a < b; }
+    bool operator()(int a, Decade b) const { return a / 10 < b.value; }
+    bool operator()(Decade a, int b) const { return a.value < b / 10; }
+};
+
+signed main() {
+    // std::less<> takes string literals and string_views as they are.
+    sjtu::map <std::string, int, std::less<>> words;
+    const char *list[] = {"pear", "apple", "fig", "plum", "kiwi", "lime"};
+    for (int i = 0 ; i < 6 ; ++i) words[list[i]] = i;
+    std::string_view view = "plumage";
+    std::cout << words.count("fig") << ' ' << words.count("grape") << ' ' << words.find("kiwi")->second << ' '
+              << (words.find("grape") == words.end()) << ' ' << words.count(view.substr(0, 4)) << ' '
+              << words.lower_bound("g")->first << ' ' << words.upper_bound("lime")->first << ' '
+              << (words.upper_bound(view) == words.end()) << '\n';
+    const auto &cwords = words;
+    auto range = cwords.equal_range("pear");
+    std::cout << range.first->first << ' ' << range.second->first << ' '
+              << (cwords.equal_range("peach").first == cwords.equal_range("peach").second) << '\n';
+
+    // No key is built for a lookup through a transparent comparator.
+    sjtu::map <Name, int, NameLess> names;
+    for (int i = 0 ; i < 6 ; ++i) names.insert({Name(list[i]), i});
+    int before = Name::made;
+    int hits = 0;
+    for (int round = 0 ; round < 1000 ; ++round)
+        for (int i = 0 ; i < 6 ; ++i) hits += names.count(list[i]) + (names.find(list[i]) != names.end());
+    hits += names.count("grape");
+    std::cout << hits << ' ' << Name::made - before << ' ' << names.lower_bound("b")->first.text << ' '
+              << names.upper_bound("pear")->first.text << '\n';
+
+    // Lookups by a coarser key than the map's own.
+    sjtu::map <int, int, ByDecade> ids;
+    for (int i = 0 ; i < 100 ; i += 3) ids[i] = i * i;
+    auto decade = ids.equal_range(Decade{4});
+    int inDecade = 0;
+    for (auto it = decade.first ; it != decade.second ; ++it) ++inDecade;
+    std::cout << inDecade << ' ' << decade.first->first << ' ' << decade.second->first << ' '
+              << ids.lower_bound(Decade{7})->first << ' ' << ids.upper_bound(Decade{7})->first << ' '
+              << (ids.find(Decade{12}) == ids.end()) << ' ' << ids.count(Decade{12}) << ' ' << ids.count(Decade{4})
+              << ' ' << ids.find(Decade{6})->first / 10 << '\n';
+
+    // Without is_transparent the key type is built as before.
+    sjtu::map <std::string, int> plain(words.begin(), words.end());
+    std::cout << plain.count("fig") << ' ' << plain.find("plum")->second << ' ' << plain.size() << '\n';
+}
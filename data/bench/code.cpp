@@ -0,0 +1,230 @@
+// Timing driver for the map engines in src/, built like the other programs
+// under data/ (with optimisation, since it measures speed):
+//     g++ -std=c++14 -O2 -Isrc -Idata data/bench/code.cpp -o bench
+//     ./bench [scale] [engine]
+// scale multiplies the element counts (default 1, which inserts 1M ints);
+// engine, if given, runs only the engines whose name contains it.
+// The workloads are the ones data/one to data/five check for correctness:
+// an operator[] insert loop, repeated full iteration, an erase-heavy mix,
+// copy construction and lookups, each on keys in random order. Every run
+// happens in a child process of its own so that its peak RSS is its own,
+// and prints one JSON object per line:
+//     {"engine":"sjtu::map","key":"int","value":"int","workload":"insert","n":1000000,
+//      "ops":1000000,"ns_per_op":...,"comparisons_per_op":...,"peak_rss_kb":...}
+// comparisons_per_op counts calls of the comparator, which every engine
+// gets wrapped in counting_less; peak_rss_kb includes the input vectors,
+// which are the same for every engine. Bint and Matrix are the classes of the
+// other tests; Matrix is only used as a value, having no order.
+#include "map.hpp"
+#include "compact_heap.hpp"
+#include "btree_map.hpp"
+#include "flat_map.hpp"
+#include "persistent_map.hpp"
+#include "class-bint.hpp"
+#include "class-matrix.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+unsigned long long comparisons = 0;
+
+struct counting_less {
+    template<class K>
+    bool operator()(const K &a, const K &b) const {
+        ++comparisons;
+        return a < b;
+    }
+};
+
+// keeps the optimiser from dropping loops whose results are not used
+const void *volatile sink;
+
+struct ranked : sjtu::map_policy { static const bool order_statistics = true; };
+struct red_black : sjtu::map_policy { typedef sjtu::red_black_balance balance; };
+struct compact : sjtu::map_policy { static const bool compact_nodes = true; };
+struct unchecked : sjtu::map_policy { typedef sjtu::unchecked_iterators iterator_checks; };
+struct generations : sjtu::map_policy { typedef sjtu::generation_checked_iterators iterator_checks; };
+
+// the engines; bulk ones are only filled by a sorted batch insert, since
+// one-by-one inserts and erases cost them O(n) each: they report
+// bulk_insert instead of insert and skip erase_mix
+template<class M>
+struct engine {
+    static const bool bulk = false;
+};
+
+template<class K, class V>
+struct engine<sjtu::flat_map<K, V, counting_less> > {
+    static const bool bulk = true;
+};
+
+template<class K>
+K makeKey(size_t i);
+
+template<>
+int makeKey<int>(size_t i) { return static_cast<int>(i); }
+
+template<>
+std::string makeKey<std::string>(size_t i) { return "key-" + std::to_string(i); }
+
+template<>
+Util::Bint makeKey<Util::Bint>(size_t i) { return Util::Bint(static_cast<long long>(i) * 1000003); }
+
+template<class V>
+V makeValue(size_t i) { return makeKey<V>(i); }
+
+template<>
+Diamond::Matrix<int> makeValue<Diamond::Matrix<int> >(size_t i) { return Diamond::Matrix<int>(2, 2, static_cast<int>(i)); }
+
+template<class K, class V>
+struct data_set {
+    std::vector<K> keys;   // in random order
+    std::vector<V> values;
+    std::vector<sjtu::pair<K, V> > sorted;
+
+    explicit data_set(size_t n) {
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i < n; ++i) order[i] = i;
+        std::shuffle(order.begin(), order.end(), std::mt19937(20240601));
+        keys.reserve(n);
+        values.reserve(n);
+        for (size_t i : order) {
+            keys.push_back(makeKey<K>(i));
+            values.push_back(makeValue<V>(i));
+        }
+        std::vector<size_t> byKey(n);
+        for (size_t i = 0; i < n; ++i) byKey[i] = i;
+        std::sort(byKey.begin(), byKey.end(), [this](size_t a, size_t b) { return keys[a] < keys[b]; });
+        sorted.reserve(n);
+        for (size_t i : byKey) sorted.push_back(sjtu::pair<K, V>(keys[i], values[i]));
+    }
+};
+
+template<class M, class D>
+void fill(M &m, const D &d, std::false_type) {
+    for (size_t i = 0; i < d.keys.size(); ++i) m[d.keys[i]] = d.values[i];
+}
+
+template<class M, class D>
+void fill(M &m, const D &d, std::true_type) { m.insert(d.sorted.begin(), d.sorted.end()); }
+
+template<class M, class D>
+void fill(M &m, const D &d) { fill(m, d, std::integral_constant<bool, engine<M>::bulk>()); }
+
+// runs one workload on a map built from d and returns how many operations it did
+template<class M, class D>
+size_t workload(const char *name, M &m, const D &d) {
+    size_t n = d.keys.size();
+    if (std::strcmp(name, "insert") == 0) {
+        fill(m, d);
+        return n;
+    }
+    if (std::strcmp(name, "iterate") == 0) {
+        const int passes = 8;
+        for (int p = 0; p < passes; ++p) {
+            for (auto it = m.begin(); it != m.end(); ++it) sink = &it->second;
+        }
+        return n * passes;
+    }
+    if (std::strcmp(name, "erase_mix") == 0) {
+        // erase every key, putting every other one straight back
+        for (size_t i = 0; i < n; ++i) {
+            m.erase(m.find(d.keys[i]));
+            if (i & 1) m[d.keys[i]] = d.values[i];
+        }
+        return n + n / 2;
+    }
+    if (std::strcmp(name, "copy") == 0) {
+        const int copies = 4;
+        for (int c = 0; c < copies; ++c) {
+            M copy(m);
+            sink = &copy;
+        }
+        return n * copies;
+    }
+    // lookup
+    for (size_t i = 0; i < n; ++i) sink = &m.find(d.keys[n - 1 - i])->second;
+    return n;
+}
+
+const char *const workloads[] = {"insert", "iterate", "erase_mix", "copy", "lookup"};
+
+template<class M, class K, class V>
+void run(const char *engineName, const char *keyName, const char *valueName, size_t n, const char *filter) {
+    if (filter && std::strstr(engineName, filter) == nullptr) return;
+    for (const char *name : workloads) {
+        if (engine<M>::bulk && std::strcmp(name, "erase_mix") == 0) continue;
+        std::fflush(stdout);
+        pid_t child = fork();
+        if (child < 0) {
+            std::perror("fork");
+            std::exit(1);
+        }
+        if (child > 0) {
+            int status = 0;
+            waitpid(child, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                std::fprintf(stderr, "%s %s/%s %s failed\n", engineName, keyName, valueName, name);
+            continue;
+        }
+        {
+            data_set<K, V> d(n);
+            M m;
+            if (std::strcmp(name, "insert") != 0) fill(m, d);
+            comparisons = 0;
+            auto start = std::chrono::steady_clock::now();
+            size_t ops = workload(name, m, d);
+            auto stop = std::chrono::steady_clock::now();
+            double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+            const char *label = engine<M>::bulk && std::strcmp(name, "insert") == 0 ? "bulk_insert" : name;
+            rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            std::printf("{\"engine\":\"%s\",\"key\":\"%s\",\"value\":\"%s\",\"workload\":\"%s\",\"n\":%zu,\"ops\":%zu,"
+                        "\"ns_per_op\":%.2f,\"comparisons_per_op\":%.2f,\"peak_rss_kb\":%ld}\n",
+                        engineName, keyName, valueName, label, n, ops, ns / ops, double(comparisons) / ops,
+                        static_cast<long>(usage.ru_maxrss));
+            std::fflush(stdout);
+        }
+        _exit(0);
+    }
+}
+
+template<class K, class V>
+void runAll(const char *keyName, const char *valueName, size_t n, const char *filter) {
+    run<std::map<K, V, counting_less>, K, V>("std::map", keyName, valueName, n, filter);
+    run<sjtu::map<K, V, counting_less>, K, V>("sjtu::map", keyName, valueName, n, filter);
+    run<sjtu::map<K, V, counting_less, red_black>, K, V>("sjtu::map<red_black>", keyName, valueName, n, filter);
+    run<sjtu::map<K, V, counting_less, ranked>, K, V>("sjtu::map<order_statistics>", keyName, valueName, n, filter);
+    run<sjtu::map<K, V, counting_less, compact>, K, V>("sjtu::map<compact_nodes>", keyName, valueName, n, filter);
+    run<sjtu::map<K, V, counting_less, unchecked>, K, V>("sjtu::map<unchecked_iterators>", keyName, valueName, n, filter);
+    run<sjtu::map<K, V, counting_less, generations>, K, V>("sjtu::map<generation_checked_iterators>", keyName, valueName, n,
+                                                            filter);
+    run<sjtu::btree_map<K, V, counting_less>, K, V>("sjtu::btree_map", keyName, valueName, n, filter);
+    run<sjtu::flat_map<K, V, counting_less>, K, V>("sjtu::flat_map", keyName, valueName, n, filter);
+    run<sjtu::persistent_map<K, V, counting_less>, K, V>("sjtu::persistent_map", keyName, valueName, n, filter);
+}
+
+}
+
+int main(int argc, char **argv) {
+    double scale = argc > 1 ? std::atof(argv[1]) : 1.0;
+    const char *filter = argc > 2 ? argv[2] : nullptr;
+    auto count = [scale](size_t n) { return n * scale < 1 ? size_t(1) : static_cast<size_t>(n * scale); };
+    runAll<int, int>("int", "int", count(1000000), filter);
+    runAll<std::string, std::string>("string", "string", count(200000), filter);
+    // every Bint holds a few kilobytes, so fewer of them
+    runAll<Util::Bint, Util::Bint>("Bint", "Bint", count(5000), filter);
+    runAll<int, Diamond::Matrix<int> >("int", "Matrix", count(200000), filter);
+    return 0;
+}
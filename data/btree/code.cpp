@@ -0,0 +1,151 @@
+// btree_map against std::map, with nodes small enough that every insert
+// and erase runs into splits, borrows and merges, for each key type the
+// vector search handles, for std::greater, and for a key it does not handle.
+// Each line is a key type's final size and the number of checks that
+// disagreed, which must be 0. Build with -mavx2 or -msse4.2 as well to run
+// the vector searches; without them they fall back to scalar code.
+#include "btree_map.hpp"
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+
+namespace {
+
+// at least four keys to a node, whatever these sizes
+struct tiny : sjtu::btree_policy {
+    static const size_t node_bytes = 64;
+};
+
+struct small : sjtu::btree_policy {
+    static const size_t node_bytes = 160;
+};
+
+template<class Key>
+Key keyOf(long x) {
+    return static_cast<Key>(x);
+}
+
+template<>
+std::string keyOf<std::string>(long x) {
+    return std::to_string(x);
+}
+
+template<class Map, class Ref>
+long differences(const Map &map, const Ref &ref) {
+    long bad = map.size() == ref.size() ? 0 : 1;
+    typename Ref::const_iterator r = ref.begin();
+    for (typename Map::const_iterator it = map.cbegin(); it != map.cend(); ++it, ++r)
+        if (r == ref.end() || it->first != r->first || it->second != r->second) ++bad;
+    typename Ref::const_reverse_iterator b = ref.rbegin();
+    for (typename Map::const_iterator it = map.cend(); it != map.cbegin(); ++b) {
+        --it;
+        if (b == ref.rend() || it->first != b->first) ++bad;
+    }
+    return bad;
+}
+
+template<class Key, class Compare, class Policy>
+void run(std::mt19937 &rng, long lo, long hi) {
+    typedef sjtu::btree_map<Key, long, Compare, Policy> Map;
+    typedef std::map<Key, long, Compare> Ref;
+    Map map;
+    Ref ref;
+    long bad = 0;
+    long span = hi - lo;
+    for (int round = 0; round < 4; ++round) {
+        // grow with every kind of insert, then shrink back to a few keys
+        for (int i = 0; i < 6000; ++i) {
+            Key k = keyOf<Key>(lo + static_cast<long>(rng() % span));
+            switch (i % 4) {
+            case 0: {
+                bool inserted = map.insert(typename Map::value_type(k, i)).second;
+                if (inserted != ref.insert(std::make_pair(k, static_cast<long>(i))).second) ++bad;
+                break;
+            }
+            case 1:
+                map[k] += i;
+                ref[k] += i;
+                break;
+            case 2:
+                if (map.emplace(k, i).second != ref.emplace(k, i).second) ++bad;
+                break;
+            default:
+                if (map.try_emplace(k, -i).second != ref.emplace(k, -i).second) ++bad;
+            }
+        }
+        bad += differences(map, ref);
+        for (int i = 0; i < 9000 && ref.size() > 5; ++i) {
+            Key k = keyOf<Key>(lo + static_cast<long>(rng() % span));
+            typename Map::iterator it = map.lower_bound(k);
+            typename Ref::iterator r = ref.lower_bound(k);
+            if ((it == map.end()) != (r == ref.end())) {
+                ++bad;
+            } else if (r != ref.end()) {
+                if (it->first != r->first) ++bad;
+                map.erase(it);
+                ref.erase(r);
+            }
+        }
+        bad += differences(map, ref);
+    }
+
+    // a full tree again, for lookups of present and absent keys
+    for (int i = 0; i < 6000; ++i) {
+        Key k = keyOf<Key>(lo + static_cast<long>(rng() % span));
+        map[k] = i;
+        ref[k] = i;
+    }
+    for (int i = 0; i < 20000; ++i) {
+        Key k = keyOf<Key>(lo - 2 + static_cast<long>(rng() % (span + 4)));
+        if (map.count(k) != ref.count(k)) ++bad;
+        const long *p = map.find_ptr(k);
+        if ((p == nullptr) != (ref.find(k) == ref.end()) || (p && *p != ref.at(k))) ++bad;
+        typename Ref::const_iterator lb = ref.lower_bound(k), ub = ref.upper_bound(k);
+        const Map &cmap = map;
+        if ((cmap.lower_bound(k) == cmap.cend()) != (lb == ref.end())) ++bad;
+        else if (lb != ref.end() && cmap.lower_bound(k)->first != lb->first) ++bad;
+        if ((cmap.upper_bound(k) == cmap.cend()) != (ub == ref.end())) ++bad;
+        else if (ub != ref.end() && cmap.upper_bound(k)->first != ub->first) ++bad;
+    }
+
+    // an iterator keeps its element while others come and go around it
+    typename Map::iterator kept = map.find(ref.begin()->first);
+    for (int i = 0; i < 3000; ++i) {
+        Key k = keyOf<Key>(lo + static_cast<long>(rng() % span));
+        if (k == kept->first) continue;
+        if (i % 2) {
+            map[k] = i;
+            ref[k] = i;
+        } else if (ref.erase(k)) {
+            map.erase(map.find(k));
+        }
+    }
+    if (kept->first != ref.begin()->first) ++bad;
+    ++kept;
+    if (kept == map.end() || kept->first != (++ref.begin())->first) ++bad;
+
+    Map copy(map);
+    map.clear();
+    bad += differences(copy, ref);
+    map = copy;
+    bad += differences(map, ref);
+    std::cout << map.size() << ' ' << bad << '\n';
+}
+
+}
+
+int main() {
+    std::mt19937 rng(14);
+    run<int, std::less<int>, tiny>(rng, -3000, 3000);
+    run<unsigned, std::less<unsigned>, tiny>(rng, 0, 7000);
+    run<long long, std::less<long long>, tiny>(rng, -4000, 4000);
+    run<unsigned long long, std::less<unsigned long long>, small>(rng, 0, 7000);
+    run<float, std::less<float>, tiny>(rng, -3000, 3000);
+    run<double, std::less<double>, small>(rng, -3000, 3000);
+    run<int, std::greater<int>, tiny>(rng, -3000, 3000);
+    run<double, std::greater<double>, tiny>(rng, -3000, 3000);
+    run<std::string, std::less<std::string>, small>(rng, 0, 7000);
+    return 0;
+}
@@ -0,0 +1,115 @@
+// maps with map_policy::compact_nodes, for AVL and red-black balancing and
+// with order statistics, built from sorted, unsorted and duplicate-laden
+// ranges (the range constructor and assign()) and then put through inserts,
+// erases and copies against std::map. Each line is a policy's final size
+// and the number of checks that disagreed, which must be 0.
+#include "map.hpp"
+#include "compact_heap.hpp"
+#include <iostream>
+#include <list>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct compact : sjtu::map_policy {
+    static const bool compact_nodes = true;
+};
+
+struct compact_red_black : sjtu::map_policy {
+    typedef sjtu::red_black_balance balance;
+    static const bool compact_nodes = true;
+};
+
+struct compact_counted : sjtu::map_policy {
+    static const bool compact_nodes = true;
+    static const bool order_statistics = true;
+};
+
+typedef std::map<int, int> Ref;
+typedef sjtu::pair<int, int> Item;
+
+template<class Map>
+long differences(const Map &map, const Ref &ref) {
+    long bad = map.size() == ref.size() ? 0 : 1;
+    Ref::const_iterator r = ref.begin();
+    for (typename Map::const_iterator it = map.cbegin(); it != map.cend(); ++it, ++r)
+        if (r == ref.end() || it->first != r->first || it->second != r->second) ++bad;
+    Ref::const_reverse_iterator b = ref.rbegin();
+    for (typename Map::const_iterator it = map.cend(); it != map.cbegin(); ++b) {
+        --it;
+        if (b == ref.rend() || it->first != b->first) ++bad;
+    }
+    return bad;
+}
+
+// what a range build keeps: the first of equal keys
+Ref expected(const std::vector<Item> &items) {
+    Ref ref;
+    for (size_t i = 0; i < items.size(); ++i) ref.insert(std::make_pair(items[i].first, items[i].second));
+    return ref;
+}
+
+template<class Policy>
+void run(std::mt19937 &rng) {
+    typedef sjtu::map<int, int, std::less<int>, Policy> Map;
+    long bad = 0;
+
+    // sorted, sorted with runs of equal keys, sorted then unsorted
+    for (int shape = 0; shape < 3; ++shape) {
+        for (size_t n = 0; n < 300; n += 1 + n / 4) {
+            std::vector<Item> items;
+            for (size_t i = 0; i < n; ++i) {
+                int k = static_cast<int>(shape == 1 ? i / 3 : i) * 2;
+                if (shape == 2 && i >= n / 2) k = static_cast<int>(rng() % (n * 2 + 1));
+                items.push_back(Item(k, static_cast<int>(i)));
+            }
+            Ref ref = expected(items);
+            Map built(items.begin(), items.end());
+            bad += differences(built, ref);
+            std::list<Item> linked(items.begin(), items.end());
+            Map assigned;
+            assigned[-1] = -1;
+            assigned.assign(linked.begin(), linked.end());
+            bad += differences(assigned, ref);
+            Map copied(built.cbegin(), built.cend());
+            bad += differences(copied, ref);
+        }
+    }
+
+    // a shuffled build, then random edits
+    std::vector<Item> items;
+    for (int i = 0; i < 4000; ++i) items.push_back(Item(static_cast<int>(rng() % 6000), i));
+    Ref ref = expected(items);
+    Map map(items.begin(), items.end());
+    bad += differences(map, ref);
+    for (int i = 0; i < 20000; ++i) {
+        int k = static_cast<int>(rng() % 8000);
+        if (rng() % 2) {
+            map[k] = i;
+            ref[k] = i;
+        } else if (ref.erase(k)) {
+            map.erase(map.find(k));
+        } else if (map.find(k) != map.end()) {
+            ++bad;
+        }
+    }
+    bad += differences(map, ref);
+    Map copy(map);
+    map.clear();
+    bad += differences(copy, ref);
+    map = copy;
+    bad += differences(map, ref);
+    std::cout << map.size() << ' ' << bad << '\n';
+}
+
+}
+
+int main() {
+    std::mt19937 rng(17);
+    run<compact>(rng);
+    run<compact_red_black>(rng);
+    run<compact_counted>(rng);
+    return 0;
+}
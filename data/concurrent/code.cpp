@@ -0,0 +1,101 @@
+// concurrent_map and its striped_shared_mutex under threads that read and
+// write at the same time; build with -pthread. Every line of the output is
+// a count that only comes out as in answer.txt if no reader ever saw a
+// shard (or the counters below) in the middle of a write.
+#include "concurrent_map.hpp"
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int writers = 2;
+const int readers = 4;
+const int keysPerWriter = 4000;
+const int rounds = 6;
+
+// writers bump both counters under lock(), readers compare them under lock_shared()
+void lockTest() {
+    sjtu::detail::striped_shared_mutex<> lock;
+    long a = 0, b = 0;
+    std::atomic<long> torn(0), reads(0);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; ++w) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 20000; ++i) {
+                lock.lock();
+                ++a;
+                ++b;
+                lock.unlock();
+            }
+        });
+    }
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&] {
+            while (!done.load()) {
+                size_t stripe = lock.lock_shared();
+                if (a != b) ++torn;
+                ++reads;
+                lock.unlock_shared(stripe);
+            }
+        });
+    }
+    for (int w = 0; w < writers; ++w) threads[w].join();
+    done.store(true);
+    for (size_t i = writers; i < threads.size(); ++i) threads[i].join();
+    std::cout << a << ' ' << b << ' ' << torn.load() << '\n';
+}
+
+// Every writer owns a range of keys and keeps the value of key k at 3 * k
+// while it inserts, erases and sweeps them; readers look keys up all along.
+void mapTest() {
+    sjtu::concurrent_map<int, long> m(8);
+    std::atomic<long> wrong(0), found(0);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int w = 0; w < writers; ++w) {
+        threads.emplace_back([&m, w] {
+            int base = w * keysPerWriter;
+            for (int r = 0; r < rounds; ++r) {
+                for (int k = base; k < base + keysPerWriter; ++k) m.insert_or_assign(k, 3L * k);
+                for (int k = base + r % 2; k < base + keysPerWriter; k += 2) m.erase(k);
+                for (int k = base; k < base + keysPerWriter; ++k) m.update(k, [](long &v) { v += 0; });
+                m.erase_if([base](sjtu::pair<const int, long> &e) {
+                    return e.first >= base && e.first < base + keysPerWriter && e.first % 5 == 0;
+                });
+            }
+            for (int k = base; k < base + keysPerWriter; k += 3) m.insert(sjtu::pair<const int, long>(k, 3L * k));
+        });
+    }
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r] {
+            unsigned x = 12345u + r;
+            while (!done.load()) {
+                x = x * 1103515245u + 12345u;
+                int k = static_cast<int>(x >> 8) % (writers * keysPerWriter);
+                long v = 0;
+                if (m.find(k, v)) {
+                    ++found;
+                    if (v != 3L * k) ++wrong;
+                }
+                m.visit(k, [&](const long &seen) { if (seen != 3L * k) ++wrong; });
+            }
+        });
+    }
+    for (int w = 0; w < writers; ++w) threads[w].join();
+    done.store(true);
+    for (size_t i = writers; i < threads.size(); ++i) threads[i].join();
+    long sum = 0;
+    m.for_each([&sum](const sjtu::pair<const int, long> &e) { sum += e.second; });
+    std::cout << m.size() << ' ' << sum << ' ' << wrong.load() << '\n';
+}
+
+}
+
+int main() {
+    lockTest();
+    mapTest();
+    return 0;
+}
@@ -0,0 +1,132 @@
+// flat_map against std::map: batch inserts with duplicate keys, within a
+// batch and against the table, single inserts and erases, conversion from
+// and to sjtu::map, and a batch insert that throws. Each line is a size and
+// then the number of checks that disagreed, which must be 0.
+#include "flat_map.hpp"
+#include <iostream>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace {
+
+typedef sjtu::flat_map<int, long> Flat;
+typedef std::map<int, long> Ref;
+
+long differences(const Flat &flat, const Ref &ref) {
+    long bad = flat.size() == ref.size() ? 0 : 1;
+    Ref::const_iterator r = ref.begin();
+    for (Flat::const_iterator it = flat.cbegin(); it != flat.cend(); ++it, ++r)
+        if (r == ref.end() || it->first != r->first || it->second != r->second) ++bad;
+    return bad;
+}
+
+// copies throw once the countdown runs out; moves never do
+struct Fragile {
+    static int copiesLeft;
+    long v;
+    explicit Fragile(long x) : v(x) {}
+    Fragile(const Fragile &other) : v(other.v) {
+        if (copiesLeft-- == 0) throw std::bad_alloc();
+    }
+    Fragile(Fragile &&other) noexcept : v(other.v) {}
+    Fragile &operator=(const Fragile &) = default;
+};
+
+int Fragile::copiesLeft = -1;
+
+}
+
+int main() {
+    std::mt19937 rng(16);
+    Flat flat;
+    Ref ref;
+    long bad = 0;
+
+    // batches with keys repeated inside them and already in the table;
+    // of equal new keys the first one wins, like std::map::insert
+    for (int batch = 0; batch < 60; ++batch) {
+        std::vector<sjtu::pair<const int, long> > items;
+        size_t n = rng() % 300;
+        for (size_t i = 0; i < n; ++i) items.push_back(sjtu::pair<const int, long>(static_cast<int>(rng() % 5000), static_cast<long>(rng())));
+        flat.insert(items.begin(), items.end());
+        for (size_t i = 0; i < items.size(); ++i) ref.insert(std::make_pair(items[i].first, items[i].second));
+        bad += differences(flat, ref);
+    }
+    std::cout << flat.size() << ' ' << bad << '\n';
+
+    // single inserts, operator[] and erases in between
+    bad = 0;
+    for (int i = 0; i < 3000; ++i) {
+        int k = static_cast<int>(rng() % 6000);
+        switch (rng() % 3) {
+        case 0: {
+            bool inserted = flat.insert(sjtu::pair<const int, long>(k, i)).second;
+            if (inserted != ref.insert(std::make_pair(k, static_cast<long>(i))).second) ++bad;
+            break;
+        }
+        case 1:
+            flat[k] += i;
+            ref[k] += i;
+            break;
+        default:
+            if (flat.count(k) != ref.count(k)) ++bad;
+            if (ref.erase(k)) flat.erase(flat.find(k));
+        }
+    }
+    bad += differences(flat, ref);
+    for (int k = -2; k < 6002; ++k) {
+        Ref::const_iterator lb = ref.lower_bound(k), ub = ref.upper_bound(k);
+        if ((lb == ref.end()) != (flat.lower_bound(k) == flat.end())) ++bad;
+        else if (lb != ref.end() && flat.lower_bound(k)->first != lb->first) ++bad;
+        if ((ub == ref.end()) != (flat.upper_bound(k) == flat.end())) ++bad;
+        else if (ub != ref.end() && flat.upper_bound(k)->first != ub->first) ++bad;
+        if (flat.get_or(k, -1) != (ref.count(k) ? ref.at(k) : -1)) ++bad;
+    }
+    std::cout << flat.size() << ' ' << bad << '\n';
+
+    // an unsorted range straight into the constructor
+    std::vector<sjtu::pair<const int, long> > items;
+    for (int i = 0; i < 2000; ++i) items.push_back(sjtu::pair<const int, long>(static_cast<int>(rng() % 1000), i));
+    Flat built(items.begin(), items.end());
+    Ref builtRef;
+    for (size_t i = 0; i < items.size(); ++i) builtRef.insert(std::make_pair(items[i].first, items[i].second));
+    std::cout << built.size() << ' ' << differences(built, builtRef) << '\n';
+
+    // to sjtu::map through its range constructor, and back
+    sjtu::map<int, long> tree(flat.cbegin(), flat.cend());
+    bad = tree.size() == ref.size() ? 0 : 1;
+    for (Ref::const_iterator it = ref.begin(); it != ref.end(); ++it)
+        if (tree.count(it->first) == 0 || tree.at(it->first) != it->second) ++bad;
+    tree[-7] = 7;
+    ref[-7] = 7;
+    Flat back(tree);
+    bad += differences(back, ref);
+    std::cout << back.size() << ' ' << bad << '\n';
+
+    // a batch whose copying throws leaves the table as it was
+    sjtu::flat_map<int, Fragile> fragile;
+    std::vector<sjtu::pair<const int, Fragile> > some;
+    for (int i = 0; i < 100; ++i) some.push_back(sjtu::pair<const int, Fragile>(i * 2, Fragile(i)));
+    fragile.insert(some.begin(), some.end());
+    long thrown = 0;
+    bad = 0;
+    for (int fail = 0; fail < 40; fail += 3) {
+        std::vector<sjtu::pair<const int, Fragile> > more;
+        for (int i = 0; i < 50; ++i) more.push_back(sjtu::pair<const int, Fragile>(i * 3 + 1, Fragile(-i)));
+        Fragile::copiesLeft = fail;
+        try {
+            fragile.insert(more.begin(), more.end());
+        } catch (std::bad_alloc &) {
+            ++thrown;
+        }
+        Fragile::copiesLeft = -1;
+        if (fragile.size() != 100) ++bad;
+        int i = 0;
+        for (sjtu::flat_map<int, Fragile>::const_iterator it = fragile.cbegin(); it != fragile.cend(); ++it, ++i)
+            if (it->first != i * 2 || it->second.v != i) ++bad;
+    }
+    std::cout << thrown << ' ' << bad << '\n';
+    return 0;
+}
@@ -0,0 +1,144 @@
+// parallel.hpp against std::map and the std set algorithms: fork_join on
+// its own and nested, then parallel_union, _intersection, _difference,
+// _copy and _for_each on maps of several policies with a grain small enough
+// to fork deep into the trees; build with -pthread. Each line is a size or
+// total and then the number of checks that disagreed, which must be 0.
+#include "parallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+const size_t grain = 4;
+
+struct red_black : sjtu::map_policy {
+    typedef sjtu::red_black_balance balance;
+};
+
+struct counted : sjtu::map_policy {
+    static const bool order_statistics = true;
+};
+
+typedef std::map<int, long> Ref;
+
+long fib(sjtu::thread_pool &pool, int n) {
+    if (n < 2) return n;
+    long a = 0, b = 0;
+    pool.fork_join([&] { a = fib(pool, n - 1); }, [&] { b = fib(pool, n - 2); });
+    return a + b;
+}
+
+template<class Map>
+long differences(const Map &map, const Ref &ref) {
+    long bad = map.size() == ref.size() ? 0 : 1;
+    Ref::const_iterator r = ref.begin();
+    for (typename Map::const_iterator it = map.cbegin(); it != map.cend(); ++it, ++r)
+        if (r == ref.end() || it->first != r->first || it->second != r->second) ++bad;
+    return bad;
+}
+
+template<class Map>
+void fill(std::mt19937 &rng, Map &map, Ref &ref, size_t n, int span) {
+    for (size_t i = 0; i < n; ++i) {
+        int k = static_cast<int>(rng() % span);
+        long v = static_cast<long>(rng() % 1000);
+        map[k] = v;
+        ref[k] = v;
+    }
+}
+
+// the std set algorithms keep the element of the first range on equal keys,
+// as the parallel ones keep that of a
+struct keyLess {
+    bool operator()(const std::pair<const int, long> &a, const std::pair<const int, long> &b) const {
+        return a.first < b.first;
+    }
+};
+
+template<class Policy>
+void run(std::mt19937 &rng, sjtu::thread_pool &pool) {
+    typedef sjtu::map<int, long, std::less<int>, Policy> Map;
+    long bad = 0, total = 0;
+    for (int round = 0; round < 12; ++round) {
+        size_t n = round % 4 == 0 ? rng() % 10 : rng() % 3000;
+        int span = static_cast<int>(rng() % 6000) + 10;
+        Map a, b;
+        Ref ra, rb;
+        fill(rng, a, ra, n, span);
+        fill(rng, b, rb, rng() % 3000, span);
+        for (int op = 0; op < 3; ++op) {
+            Ref want;
+            std::insert_iterator<Ref> out(want, want.end());
+            if (op == 0) std::set_union(ra.begin(), ra.end(), rb.begin(), rb.end(), out, keyLess());
+            if (op == 1) std::set_intersection(ra.begin(), ra.end(), rb.begin(), rb.end(), out, keyLess());
+            if (op == 2) std::set_difference(ra.begin(), ra.end(), rb.begin(), rb.end(), out, keyLess());
+            Map x = sjtu::parallel_copy(a, pool, grain);
+            Map y = sjtu::parallel_copy(b, pool, grain);
+            bad += differences(x, ra) + differences(y, rb);
+            Map got = op == 0   ? sjtu::parallel_union(std::move(x), std::move(y), pool, grain)
+                      : op == 1 ? sjtu::parallel_intersection(std::move(x), std::move(y), pool, grain)
+                                : sjtu::parallel_difference(std::move(x), std::move(y), pool, grain);
+            bad += differences(got, want);
+            // the result is an ordinary map that takes further changes
+            got[-1] = 1;
+            want[-1] = 1;
+            if (!want.empty()) {
+                got.erase(got.find(want.rbegin()->first));
+                want.erase(want.rbegin()->first);
+            }
+            bad += differences(got, want);
+            total += static_cast<long>(got.size());
+        }
+
+        std::atomic<long> sum(0), calls(0);
+        sjtu::parallel_for_each(a, [&](typename Map::value_type &v) {
+            v.second += 1;
+            ++calls;
+        }, pool, grain);
+        const Map &ca = a;
+        sjtu::parallel_for_each(ca, [&](const typename Map::value_type &v) { sum += v.second; }, pool, grain);
+        long want = 0;
+        for (Ref::iterator it = ra.begin(); it != ra.end(); ++it) want += ++it->second;
+        if (sum.load() != want || calls.load() != static_cast<long>(ra.size())) ++bad;
+        bad += differences(a, ra);
+    }
+    std::cout << total << ' ' << bad << '\n';
+}
+
+}
+
+int main() {
+    sjtu::thread_pool pool(4);
+
+    // nested forks, and an exception from one side once both are done
+    bool other = false, caught = false;
+    try {
+        pool.fork_join([&] { throw std::runtime_error("left"); }, [&] { other = true; });
+    } catch (std::runtime_error &) {
+        caught = true;
+    }
+    std::cout << pool.threads() << ' ' << fib(pool, 20) << ' ' << (caught && other) << '\n';
+
+    std::mt19937 rng(13);
+    run<sjtu::map_policy>(rng, pool);
+    run<red_black>(rng, pool);
+    run<counted>(rng, pool);
+
+    // a pool of one thread runs everything inline
+    sjtu::thread_pool alone(1);
+    sjtu::map<int, long> a, b;
+    Ref ra, rb;
+    fill(rng, a, ra, 500, 1000);
+    fill(rng, b, rb, 500, 1000);
+    Ref want;
+    std::set_union(ra.begin(), ra.end(), rb.begin(), rb.end(), std::inserter(want, want.end()), keyLess());
+    sjtu::map<int, long> got = sjtu::parallel_union(std::move(a), std::move(b), alone, grain);
+    std::cout << alone.threads() << ' ' << got.size() << ' ' << differences(got, want) << '\n';
+    return 0;
+}
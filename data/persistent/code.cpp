@@ -0,0 +1,127 @@
+// persistent_map against std::map: snapshots and copies are taken along
+// the way and must keep their contents while the map they came from (and
+// the copies themselves) go on changing through insert, operator[], at()
+// and erase. Each line is a size and then the number of checks that
+// disagreed, which must be 0.
+#include "persistent_map.hpp"
+#include <iostream>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace {
+
+typedef sjtu::persistent_map<int, long> Map;
+typedef std::map<int, long> Ref;
+
+template<class Tree>
+long differences(const Tree &tree, const Ref &ref) {
+    long bad = tree.size() == ref.size() ? 0 : 1;
+    Ref::const_iterator r = ref.begin();
+    for (Map::const_iterator it = tree.cbegin(); it != tree.cend(); ++it, ++r)
+        if (r == ref.end() || it->first != r->first || it->second != r->second) ++bad;
+    Ref::const_reverse_iterator b = ref.rbegin();
+    for (Map::const_iterator it = tree.cend(); it != tree.cbegin(); ++b) {
+        --it;
+        if (b == ref.rend() || it->first != b->first) ++bad;
+    }
+    return bad;
+}
+
+// whether it is at the element of want, with the same neighbours
+bool sameSpot(const Map &map, Map::const_iterator it, const Ref &ref, Ref::const_iterator want) {
+    if (it == map.cend() || it->first != want->first || &*map.find(want->first) != &*it) return false;
+    Ref::const_iterator next = want;
+    Map::const_iterator after = it, before = it;
+    if (++next == ref.end() ? ++after != map.cend() : (++after)->first != next->first) return false;
+    return want == ref.begin() ? before == map.cbegin() : (--before)->first == (--want)->first;
+}
+
+// one random change to both; returns the number of results that disagreed
+long change(std::mt19937 &rng, Map &map, Ref &ref, int i) {
+    int k = static_cast<int>(rng() % 3000);
+    long bad = 0;
+    switch (rng() % 4) {
+    case 0: {
+        sjtu::pair<Map::const_iterator, bool> got = map.insert(Map::value_type(k, i));
+        std::pair<Ref::iterator, bool> want = ref.insert(std::make_pair(k, static_cast<long>(i)));
+        if (got.second != want.second || !sameSpot(map, got.first, ref, want.first)) ++bad;
+        break;
+    }
+    case 1: {
+        long &value = map[k];
+        ref[k] += i;
+        value += i;
+        if (&value != &map.find(k)->second || map.at(k) != ref[k]) ++bad;
+        break;
+    }
+    case 2:
+        if (ref.count(k)) {
+            map.at(k) = -i;
+            ref.at(k) = -i;
+        }
+        break;
+    default:
+        if (ref.erase(k)) map.erase(map.find(k));
+    }
+    return bad;
+}
+
+}
+
+int main() {
+    std::mt19937 rng(19);
+    Map live;
+    Ref ref;
+    std::vector<std::pair<Map::snapshot_type, Ref> > snapshots;
+    std::vector<std::pair<Map, Ref> > copies;
+    long bad = 0;
+    for (int i = 0; i < 40000; ++i) {
+        bad += change(rng, live, ref, i);
+        if (i % 2000 == 0) {
+            snapshots.push_back(std::make_pair(live.snapshot(), ref));
+            copies.push_back(std::make_pair(live, ref));
+        }
+        // the copies change on their own, and must not reach into live
+        for (size_t c = 0; c < copies.size(); ++c)
+            if (rng() % 8 == 0) bad += change(rng, copies[c].first, copies[c].second, i);
+        if (i % 5000 == 0) {
+            for (size_t s = 0; s < snapshots.size(); ++s) bad += differences(snapshots[s].first, snapshots[s].second);
+            bad += differences(live, ref);
+        }
+    }
+    for (size_t s = 0; s < snapshots.size(); ++s) bad += differences(snapshots[s].first, snapshots[s].second);
+    for (size_t c = 0; c < copies.size(); ++c) bad += differences(copies[c].first, copies[c].second);
+    bad += differences(live, ref);
+    std::cout << live.size() << ' ' << snapshots.size() << ' ' << bad << '\n';
+
+    // lookups in a snapshot after the live map lost most of its keys
+    Map::snapshot_type frozen = live.snapshot();
+    Ref frozenRef = ref;
+    for (int k = 0; k < 3000; ++k)
+        if (k % 7 && ref.erase(k)) live.erase(live.find(k));
+    bad = differences(live, ref);
+    for (int k = -1; k < 3001; ++k) {
+        Ref::const_iterator want = frozenRef.find(k);
+        if (frozen.count(k) != frozenRef.count(k)) ++bad;
+        if (want != frozenRef.end() && frozen.at(k) != want->second) ++bad;
+        Ref::const_iterator lb = frozenRef.lower_bound(k), ub = frozenRef.upper_bound(k);
+        if ((frozen.lower_bound(k) == frozen.cend()) != (lb == frozenRef.end())) ++bad;
+        else if (lb != frozenRef.end() && frozen.lower_bound(k)->first != lb->first) ++bad;
+        if ((frozen.upper_bound(k) == frozen.cend()) != (ub == frozenRef.end())) ++bad;
+        else if (ub != frozenRef.end() && frozen.upper_bound(k)->first != ub->first) ++bad;
+    }
+    std::cout << frozen.size() << ' ' << live.size() << ' ' << bad << '\n';
+
+    // dropping snapshots and copies in any order leaves the rest intact
+    snapshots.erase(snapshots.begin() + 3, snapshots.begin() + 12);
+    copies.erase(copies.begin(), copies.begin() + 10);
+    live.clear();
+    ref.clear();
+    bad = differences(live, ref) + differences(frozen, frozenRef);
+    for (size_t s = 0; s < snapshots.size(); ++s) bad += differences(snapshots[s].first, snapshots[s].second);
+    for (size_t c = 0; c < copies.size(); ++c) bad += differences(copies[c].first, copies[c].second);
+    std::cout << snapshots.size() + copies.size() << ' ' << bad << '\n';
+    return 0;
+}
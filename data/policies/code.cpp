@@ -0,0 +1,551 @@
+// the parts of sjtu::map that std::map has no counterpart for, which the
+// corner tests cannot reach, checked against a std::map holding the same
+// elements. Each line is a size or total and then the number of checks that
+// disagreed, which must be 0.
+#include "map.hpp"
+#include "compact_heap.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+
+typedef std::map<int, long> Ref;
+
+struct counted : sjtu::map_policy {
+    static const bool order_statistics = true;
+};
+
+struct red_black : sjtu::map_policy {
+    typedef sjtu::red_black_balance balance;
+    static const bool statistics = true;
+};
+
+struct red_black_counted : sjtu::map_policy {
+    typedef sjtu::red_black_balance balance;
+    static const bool order_statistics = true;
+};
+
+struct avl_measured : sjtu::map_policy {
+    static const bool statistics = true;
+};
+
+struct unchecked : sjtu::map_policy {
+    typedef sjtu::unchecked_iterators iterator_checks;
+};
+
+struct generation_checked : sjtu::map_policy {
+    typedef sjtu::generation_checked_iterators iterator_checks;
+};
+
+template<class F>
+bool throwsInvalid(F f) {
+    try {
+        f();
+    } catch (sjtu::invalid_iterator &) {
+        return true;
+    }
+    return false;
+}
+
+template<class Map>
+long differences(const Map &map, const Ref &ref) {
+    long bad = map.size() == ref.size() ? 0 : 1;
+    Ref::const_iterator r = ref.begin();
+    for (typename Map::const_iterator it = map.cbegin(); it != map.cend(); ++it, ++r)
+        if (r == ref.end() || it->first != r->first || it->second != r->second) ++bad;
+    return bad;
+}
+
+// random inserts and erases by key on both
+template<class Map>
+void churn(std::mt19937 &rng, Map &map, Ref &ref, int steps, int span) {
+    for (int i = 0; i < steps; ++i) {
+        int k = static_cast<int>(rng() % span);
+        if (rng() % 3) {
+            map[k] = i;
+            ref[k] = i;
+        } else {
+            map.erase(k);
+            ref.erase(k);
+        }
+    }
+}
+
+// nth(k), rank(key) and distance(first, last) against positions in ref
+template<class Map>
+long orderDifferences(std::mt19937 &rng, const Map &map, const Ref &ref) {
+    std::vector<int> keys;
+    for (Ref::const_iterator it = ref.begin(); it != ref.end(); ++it) keys.push_back(it->first);
+    long bad = 0;
+    for (size_t k = 0; k < keys.size(); ++k)
+        if (map.nth(k)->first != keys[k]) ++bad;
+    try {
+        map.nth(keys.size());
+        ++bad;
+    } catch (sjtu::index_out_of_bound &) {
+    }
+    for (int i = 0; i < 500; ++i) {
+        int key = keys.empty() ? 0 : keys[rng() % keys.size()] + static_cast<int>(rng() % 3) - 1;
+        if (map.rank(key) != static_cast<size_t>(std::distance(ref.begin(), ref.lower_bound(key)))) ++bad;
+        size_t a = rng() % (keys.size() + 1), b = rng() % (keys.size() + 1);
+        typename Map::const_iterator first = a == keys.size() ? map.cend() : map.find(keys[a]);
+        typename Map::const_iterator last = b == keys.size() ? map.cend() : map.find(keys[b]);
+        if (map.distance(first, last) != static_cast<long>(b) - static_cast<long>(a)) ++bad;
+    }
+    return bad;
+}
+
+// order statistics under inserts and erases, and after split, join, merge
+// and copies, which have to keep the subtree sizes right
+template<class Policy>
+void orderStatistics(std::mt19937 &rng) {
+    typedef sjtu::map<int, long, std::less<int>, Policy> Map;
+    Map map;
+    Ref ref;
+    long bad = 0;
+    for (int round = 0; round < 6; ++round) {
+        churn(rng, map, ref, 3000, 4000);
+        bad += differences(map, ref) + orderDifferences(rng, map, ref);
+        int at = static_cast<int>(rng() % 4000);
+        Map upper = map.split(at);
+        Ref refUpper(ref.lower_bound(at), ref.end());
+        ref.erase(ref.lower_bound(at), ref.end());
+        bad += differences(map, ref) + differences(upper, refUpper);
+        bad += orderDifferences(rng, map, ref) + orderDifferences(rng, upper, refUpper);
+        if (round % 2) {
+            // keys that overlap map's, so merge leaves some behind
+            churn(rng, upper, refUpper, 500, 4000);
+            map.merge(upper);
+            for (Ref::iterator it = refUpper.begin(); it != refUpper.end();) {
+                if (ref.insert(*it).second) it = refUpper.erase(it);
+                else ++it;
+            }
+            bad += differences(upper, refUpper) + orderDifferences(rng, upper, refUpper);
+        } else {
+            map.join(std::move(upper));
+            ref.insert(refUpper.begin(), refUpper.end());
+        }
+        bad += differences(map, ref) + orderDifferences(rng, map, ref);
+        Map copy(map);
+        bad += orderDifferences(rng, copy, ref);
+    }
+    std::cout << map.size() << ' ' << bad << '\n';
+}
+
+
+// the deepest lookup a tree of n nodes may take under each balancing scheme
+double heightBound(size_t n, sjtu::avl_balance) { return 1.4405 * std::log2(n + 2.0); }
+double heightBound(size_t n, sjtu::red_black_balance) { return 2 * std::log2(n + 1.0); }
+
+// ascending, descending and random inserts, then erases from one end and at
+// random: the contents must match, and finding every key must stay within
+// the height the balancing scheme promises
+template<class Policy>
+void balance(std::mt19937 &rng) {
+    typedef sjtu::map<int, long, std::less<int>, Policy> Map;
+    long bad = 0, total = 0;
+    for (int shape = 0; shape < 3; ++shape) {
+        Map map;
+        Ref ref;
+        for (int i = 0; i < 20000; ++i) {
+            int k = shape == 0 ? i : shape == 1 ? -i : static_cast<int>(rng() % 100000);
+            map[k] = i;
+            ref[k] = i;
+        }
+        for (int i = 0; i < 12000; ++i) {
+            int k = i % 2 ? ref.begin()->first : static_cast<int>(rng() % 100000);
+            map.erase(k);
+            ref.erase(k);
+        }
+        bad += differences(map, ref);
+        map.reset_stats();
+        for (Ref::const_iterator it = ref.begin(); it != ref.end(); ++it)
+            if (map.find(it->first) == map.end()) ++bad;
+        if (map.stats().max_lookup_depth > heightBound(map.size(), typename Policy::balance())) ++bad;
+        total += static_cast<long>(map.size());
+    }
+    std::cout << total << ' ' << bad << '\n';
+}
+
+
+// used correctly, iterators of every check level walk, find and erase alike
+template<class Policy>
+long iteratorWalk(std::mt19937 &rng) {
+    typedef sjtu::map<int, long, std::less<int>, Policy> Map;
+    Map map;
+    Ref ref;
+    churn(rng, map, ref, 6000, 5000);
+    long bad = differences(map, ref);
+    Ref::const_reverse_iterator b = ref.rbegin();
+    for (typename Map::iterator it = map.end(); it != map.begin(); ++b) {
+        --it;
+        if (it->first != b->first) ++bad;
+    }
+    for (int i = 0; i < 3000; ++i) {
+        int k = static_cast<int>(rng() % 5000);
+        typename Map::iterator it = map.find(k);
+        if ((it == map.end()) != (ref.count(k) == 0)) ++bad;
+        else if (it != map.end() && i % 2) {
+            typename Map::iterator next = it;
+            ++next;
+            map.erase(it);
+            Ref::iterator refNext = ref.erase(ref.find(k));
+            if ((next == map.end()) != (refNext == ref.end()) || (refNext != ref.end() && next->first != refNext->first))
+                ++bad;
+        }
+    }
+    return bad + differences(map, ref);
+}
+
+// what checked and generation-checked iterators refuse, and that the latter
+// also refuse an erased element, even once its slot is in use again
+template<class Policy>
+long misuse(bool generations) {
+    typedef sjtu::map<int, long, std::less<int>, Policy> Map;
+    Map map, other;
+    for (int i = 0; i < 100; ++i) map[i] = i;
+    other[1] = 1;
+    long bad = 0;
+    bad += !throwsInvalid([&] { ++map.end(); });
+    bad += !throwsInvalid([&] { --map.begin(); });
+    bad += !throwsInvalid([&] { *map.end(); });
+    bad += !throwsInvalid([&] { map.erase(map.end()); });
+    bad += !throwsInvalid([&] { map.erase(other.begin()); });
+    bad += !throwsInvalid([&] { ++typename Map::iterator(); });
+    typename Map::iterator gone = map.find(40), kept = map.find(41);
+    map.erase(map.find(40));
+    map[1000] = 1000;
+    bad += throwsInvalid([&] { *kept; });
+    bad += throwsInvalid([&] { ++kept; });
+    if (!generations) return bad; // using gone would be undefined
+    bad += !throwsInvalid([&] { *gone; });
+    bad += !throwsInvalid([&] { map.erase(gone); });
+    typename Map::iterator before = map.find(7);
+    map.clear();
+    map[7] = 7;
+    bad += !throwsInvalid([&] { *before; });
+    bad += map.size() != 1;
+    return bad;
+}
+
+// all three levels of iterator checks
+void iteratorChecks(std::mt19937 &rng) {
+    long bad = iteratorWalk<unchecked>(rng) + iteratorWalk<counted>(rng) + iteratorWalk<generation_checked>(rng);
+    bad += misuse<sjtu::map_policy>(false) + misuse<generation_checked>(true);
+    std::cout << 3 << ' ' << bad << '\n';
+}
+
+
+// find_many and count_many on unsorted and sorted batches of present,
+// absent and repeated keys, of every size up to a few groups
+void batchLookups(std::mt19937 &rng) {
+    typedef sjtu::map<int, long> Map;
+    Map map;
+    Ref ref;
+    churn(rng, map, ref, 8000, 10000);
+    const Map &cmap = map;
+    long bad = 0, found = 0;
+    for (size_t n = 0; n < 200; n += 1 + n / 8) {
+        std::vector<int> keys;
+        for (size_t i = 0; i < n; ++i) keys.push_back(static_cast<int>(rng() % 10004) - 2);
+        for (int sorted = 0; sorted < 2; ++sorted) {
+            if (sorted) std::sort(keys.begin(), keys.end());
+            std::vector<Map::iterator> its(n + 1);
+            std::vector<Map::const_iterator> cits;
+            if (map.find_many(keys.begin(), keys.end(), its.begin()) != its.begin() + n) ++bad;
+            cmap.find_many(keys.begin(), keys.end(), std::back_inserter(cits));
+            if (cits.size() != n) ++bad;
+            size_t present = 0;
+            for (size_t i = 0; i < n && i < cits.size(); ++i) {
+                Ref::const_iterator want = ref.find(keys[i]);
+                present += want != ref.end();
+                if (want == ref.end()) {
+                    bad += its[i] != map.end();
+                    bad += cits[i] != cmap.cend();
+                } else {
+                    bad += its[i] == map.end() || its[i]->first != keys[i] || its[i]->second != want->second;
+                    bad += cits[i] == cmap.cend() || cits[i]->first != keys[i];
+                }
+            }
+            if (cmap.count_many(keys.begin(), keys.end()) != present) ++bad;
+            found += static_cast<long>(present);
+        }
+    }
+    std::cout << found << ' ' << bad << '\n';
+}
+
+
+template<size_t Slots>
+struct inline_slots : sjtu::map_policy {
+    static const size_t inline_nodes = Slots;
+};
+
+// maps that fit into their inline block, fill it exactly or outgrow it,
+// then get moved, swapped, copied, split and merged with each other, which
+// has to keep nodes of a block alive for as long as any map uses them
+template<class Policy>
+long inlineRound(std::mt19937 &rng, size_t fill) {
+    typedef sjtu::map<int, long, std::less<int>, Policy> Map;
+    long bad = 0;
+    Map a, b;
+    Ref ra, rb;
+    for (size_t i = 0; i < fill; ++i) {
+        int k = static_cast<int>(rng() % (fill * 4 + 1));
+        a[k] = static_cast<long>(i);
+        ra[k] = static_cast<long>(i);
+        b[k + 1] = -static_cast<long>(i);
+        rb[k + 1] = -static_cast<long>(i);
+    }
+    bad += differences(a, ra) + differences(b, rb);
+    {
+        Map moved(std::move(a));
+        bad += differences(moved, ra) + differences(a, Ref());
+        a[5] = 5;
+        moved.swap(b);
+        bad += differences(moved, rb) + differences(b, ra);
+        Map copy(b);
+        b = moved;
+        bad += differences(copy, ra) + differences(b, rb);
+        // moved and copy end here, and whatever a and b hold must outlive them
+    }
+    bad += differences(b, rb);
+    Ref ra2;
+    ra2[5] = 5;
+    bad += differences(a, ra2);
+    int at = static_cast<int>(rng() % (fill * 4 + 1));
+    Map upper = b.split(at);
+    Ref refUpper(rb.lower_bound(at), rb.end());
+    rb.erase(rb.lower_bound(at), rb.end());
+    bad += differences(b, rb) + differences(upper, refUpper);
+    a.merge(upper);
+    for (Ref::iterator it = refUpper.begin(); it != refUpper.end();) {
+        if (ra2.insert(*it).second) it = refUpper.erase(it);
+        else ++it;
+    }
+    bad += differences(a, ra2) + differences(upper, refUpper);
+    b.clear();
+    rb.clear();
+    churn(rng, b, rb, static_cast<int>(fill * 3), static_cast<int>(fill * 2 + 1));
+    churn(rng, a, ra2, static_cast<int>(fill * 3), static_cast<int>(fill * 2 + 1));
+    bad += differences(a, ra2) + differences(b, rb);
+    return bad;
+}
+
+void inlineNodes(std::mt19937 &rng) {
+    long bad = 0;
+    for (size_t fill = 0; fill < 40; ++fill) {
+        bad += inlineRound<inline_slots<1> >(rng, fill);
+        bad += inlineRound<inline_slots<8> >(rng, fill);
+        bad += inlineRound<inline_slots<16> >(rng, fill);
+    }
+    std::cout << 40 << ' ' << bad << '\n';
+}
+
+
+// erase_if with predicates that take nothing, everything, every other key
+// or whole runs, one throwing part-way; the survivors must match std::map,
+// keep their iterators and stay balanced enough for order statistics
+template<class Policy>
+long eraseIfRounds(std::mt19937 &rng) {
+    typedef sjtu::map<int, long, std::less<int>, Policy> Map;
+    long bad = 0;
+    for (int round = 0; round < 24; ++round) {
+        Map map;
+        Ref ref;
+        churn(rng, map, ref, static_cast<int>(rng() % 3000), 4000);
+        int kind = round % 6;
+        int lo = static_cast<int>(rng() % 4000), hi = lo + static_cast<int>(rng() % 1500);
+        auto doomed = [&](int k) {
+            return kind == 1 || (kind == 2 && k % 2 == 0) || (kind == 3 && lo <= k && k < hi) ||
+                   (kind >= 4 && k % 3 != 0);
+        };
+        typename Map::iterator keep = map.end();
+        for (typename Map::iterator it = map.begin(); it != map.end(); ++it)
+            if (!doomed(it->first)) keep = it;
+        size_t limit = kind == 5 ? rng() % (ref.size() + 1) : ref.size() + 1, asked = 0;
+        size_t erased = 0, want = 0;
+        try {
+            erased = map.erase_if([&](const typename Map::value_type &v) {
+                if (asked++ == limit) throw std::runtime_error("stop");
+                return doomed(v.first);
+            });
+            if (kind == 5 && limit < ref.size()) ++bad;
+        } catch (std::runtime_error &) {
+            erased = ref.size() - map.size();
+        }
+        // what ref loses: the doomed among the elements pred was asked about
+        size_t seen = 0, judged = std::min(limit, ref.size());
+        for (Ref::iterator it = ref.begin(); seen < judged; ++seen) {
+            if (doomed(it->first)) {
+                it = ref.erase(it);
+                ++want;
+            } else {
+                ++it;
+            }
+        }
+        bad += erased != want;
+        bad += differences(map, ref);
+        if (keep != map.end() && (ref.count(keep->first) == 0 || map.find(keep->first) != keep)) ++bad;
+        churn(rng, map, ref, 500, 4000);
+        bad += differences(map, ref);
+    }
+    return bad;
+}
+
+void eraseIf(std::mt19937 &rng) {
+    long bad = eraseIfRounds<sjtu::map_policy>(rng) + eraseIfRounds<red_black>(rng);
+    bad += eraseIfRounds<counted>(rng) + eraseIfRounds<red_black_counted>(rng);
+    sjtu::map<int, long, std::less<int>, counted> map;
+    Ref ref;
+    churn(rng, map, ref, 5000, 8000);
+    map.erase_if([](const sjtu::pair<const int, long> &v) { return v.first % 5 != 0; });
+    for (Ref::iterator it = ref.begin(); it != ref.end();) {
+        if (it->first % 5 != 0) it = ref.erase(it);
+        else ++it;
+    }
+    bad += orderDifferences(rng, map, ref);
+    std::cout << map.size() << ' ' << bad << '\n';
+}
+
+
+// a coarser key than the map's own, for the transparent overloads
+struct Decade {
+    int value;
+};
+
+struct ByDecade {
+    typedef void is_transparent;
+    bool operator()(int a, int b) const { return a < b; }
+    bool operator()(int a, Decade b) const { return a / 10 < b.value; }
+    bool operator()(Decade a, int b) const { return a.value < b / 10; }
+};
+
+// erase(key) by a transparent key equivalent to none, one or many
+// elements, which std::map only offers from C++23 on
+void transparentErase(std::mt19937 &rng) {
+    sjtu::map<int, long, ByDecade, counted> map;
+    Ref ref;
+    long bad = 0;
+    for (int i = 0; i < 3000; ++i) {
+        int k = static_cast<int>(rng() % 5000);
+        map[k] = i;
+        ref[k] = i;
+    }
+    for (int i = 0; i < 400; ++i) {
+        int d = static_cast<int>(rng() % 520);
+        size_t want = 0;
+        for (Ref::iterator it = ref.lower_bound(d * 10); it != ref.end() && it->first / 10 == d;) {
+            it = ref.erase(it);
+            ++want;
+        }
+        if (map.count(Decade{d}) != want || map.erase(Decade{d}) != want || map.count(Decade{d}) != 0) ++bad;
+    }
+    Ref::const_iterator r = ref.begin();
+    for (sjtu::map<int, long, ByDecade, counted>::const_iterator it = map.cbegin(); it != map.cend(); ++it, ++r)
+        if (r == ref.end() || it->first != r->first) ++bad;
+    bad += map.size() != ref.size() || (map.empty() ? 0 : map.nth(map.size() - 1)->first != ref.rbegin()->first);
+    std::cout << map.size() << ' ' << bad << '\n';
+}
+
+// red-black, order statistics, compact nodes and an inline block at once
+struct everything : sjtu::map_policy {
+    typedef sjtu::red_black_balance balance;
+    static const bool order_statistics = true;
+    static const bool compact_nodes = true;
+    static const size_t inline_nodes = 8;
+};
+
+// extract and insert(node_type &&) between maps of one policy, mixed with
+// split, merge and erase_if: the nodes keep their elements and addresses
+// whichever maps they pass through
+template<class Policy>
+long nodeHandles(std::mt19937 &rng) {
+    typedef sjtu::map<int, long, std::less<int>, Policy> Map;
+    Map a, b;
+    Ref ra, rb;
+    long bad = 0;
+    for (int round = 0; round < 20; ++round) {
+        churn(rng, a, ra, 800, 3000);
+        churn(rng, b, rb, 300, 3000);
+        for (int i = 0; i < 400; ++i) {
+            int k = static_cast<int>(rng() % 3000);
+            if (a.empty()) break;
+            typename Map::node_type nh = i % 2 ? a.extract(k) : a.extract(a.find(k) == a.end() ? a.begin() : a.find(k));
+            if (nh.empty()) {
+                bad += i % 2 == 0 || ra.count(k) != 0;
+                continue;
+            }
+            int key = nh.key();
+            const long *where = &nh.mapped();
+            long value = nh.mapped();
+            if (ra.erase(key) != 1 || ra.count(key)) ++bad;
+            if (i % 5 == 0) nh.key() = key = key + 3000;
+            typename Map::insert_return_type res = b.insert(std::move(nh));
+            bool fresh = rb.insert(std::make_pair(key, value)).second;
+            if (res.inserted != fresh || res.position->first != key) ++bad;
+            if (fresh && (&res.position->second != where || !res.node.empty())) ++bad;
+            if (!fresh && (res.node.empty() || res.node.mapped() != value)) ++bad;
+        }
+        bad += differences(a, ra) + differences(b, rb);
+        bad += orderDifferences(rng, a, ra) + orderDifferences(rng, b, rb);
+        int at = static_cast<int>(rng() % 6000);
+        Map upper = b.split(at);
+        Ref refUpper(rb.lower_bound(at), rb.end());
+        rb.erase(rb.lower_bound(at), rb.end());
+        a.merge(upper);
+        for (Ref::iterator it = refUpper.begin(); it != refUpper.end();) {
+            if (ra.insert(*it).second) it = refUpper.erase(it);
+            else ++it;
+        }
+        int mod = 2 + round % 5;
+        b.erase_if([mod](const typename Map::value_type &v) { return v.first % mod == 0; });
+        for (Ref::iterator it = rb.begin(); it != rb.end();) {
+            if (it->first % mod == 0) it = rb.erase(it);
+            else ++it;
+        }
+        bad += differences(a, ra) + differences(b, rb) + differences(upper, refUpper);
+        bad += orderDifferences(rng, a, ra) + orderDifferences(rng, b, rb);
+        // a handle outliving the map its node came from
+        typename Map::node_type last;
+        {
+            Map doomed(upper);
+            if (!doomed.empty()) last = doomed.extract(doomed.begin());
+        }
+        if (!last.empty()) {
+            int key = last.key();
+            if (a.insert(std::move(last)).inserted != ra.insert(std::make_pair(key, refUpper.begin()->second)).second)
+                ++bad;
+        }
+        bad += differences(a, ra);
+    }
+    return bad;
+}
+
+void extractInsert(std::mt19937 &rng) {
+    long bad = nodeHandles<counted>(rng) + nodeHandles<red_black_counted>(rng) + nodeHandles<everything>(rng);
+    std::cout << 3 << ' ' << bad << '\n';
+}
+
+}
+
+int main() {
+    std::mt19937 rng(2024);
+    orderStatistics<counted>(rng);
+    orderStatistics<red_black_counted>(rng);
+    balance<avl_measured>(rng);
+    balance<red_black>(rng);
+    iteratorChecks(rng);
+    batchLookups(rng);
+    inlineNodes(rng);
+    eraseIf(rng);
+    transparentErase(rng);
+    extractInsert(rng);
+    return 0;
+}
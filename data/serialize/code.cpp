@@ -0,0 +1,173 @@
+// save(), load() and mapped_map on files with raw and custom records, on
+// an empty map, and on files they must refuse: cut short, saved from other
+// types, or saved in another key order. Lines ending in 0 count the checks
+// that disagreed with std::map; the last lines say which files were refused.
+#include "serialize.hpp"
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace sjtu {
+
+// a length, then the characters
+template<>
+struct serializer<std::string> {
+    static const bool raw = false;
+    static void write(std::FILE *file, const std::string &s) {
+        std::uint32_t n = static_cast<std::uint32_t>(s.size());
+        write_bytes(file, &n, sizeof(n));
+        write_bytes(file, s.data(), n);
+    }
+    static std::string read(std::FILE *file) {
+        std::uint32_t n;
+        read_bytes(file, &n, sizeof(n));
+        std::string s(n, '\0');
+        read_bytes(file, &s[0], n);
+        return s;
+    }
+};
+
+}
+
+namespace {
+
+const char *const path = "serialize_test.bin";
+
+// keeps the first bytes of the file at path
+void truncate(size_t bytes) {
+    std::vector<char> data(bytes);
+    std::FILE *in = std::fopen(path, "rb");
+    size_t got = std::fread(data.data(), 1, bytes, in);
+    std::fclose(in);
+    std::FILE *out = std::fopen(path, "wb");
+    std::fwrite(data.data(), 1, got, out);
+    std::fclose(out);
+}
+
+template<class F>
+bool refused(F f) {
+    try {
+        f();
+    } catch (sjtu::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+}
+
+int main() {
+    std::mt19937 rng(26);
+    sjtu::map<int, long> map;
+    std::map<int, long> ref;
+    for (int i = 0; i < 5000; ++i) {
+        int k = static_cast<int>(rng() % 20000);
+        long v = static_cast<long>(rng());
+        map[k] = v;
+        ref[k] = v;
+    }
+
+    // raw records: load them back and map them
+    sjtu::save(map, path);
+    sjtu::map<int, long> loaded;
+    loaded[-1] = 1;
+    sjtu::load(loaded, path);
+    long bad = 0;
+    if (loaded.size() != ref.size()) ++bad;
+    std::map<int, long>::const_iterator r = ref.begin();
+    for (sjtu::map<int, long>::const_iterator it = loaded.cbegin(); it != loaded.cend(); ++it, ++r)
+        if (r == ref.end() || it->first != r->first || it->second != r->second) ++bad;
+    {
+        sjtu::mapped_map<int, long> mapped(path);
+        if (mapped.size() != ref.size()) ++bad;
+        for (int k = -5; k < 20005; ++k) {
+            std::map<int, long>::const_iterator want = ref.find(k);
+            const long *got = mapped.find_ptr(k);
+            if ((want == ref.end()) != (got == nullptr) || (got && *got != want->second)) ++bad;
+            if (mapped.count(k) != ref.count(k)) ++bad;
+            std::map<int, long>::const_iterator lb = ref.lower_bound(k);
+            if ((lb == ref.end()) != (mapped.lower_bound(k) == mapped.cend())) ++bad;
+            else if (lb != ref.end() && mapped.lower_bound(k)->first != lb->first) ++bad;
+            std::map<int, long>::const_iterator ub = ref.upper_bound(k);
+            if ((ub == ref.end()) != (mapped.upper_bound(k) == mapped.cend())) ++bad;
+            else if (ub != ref.end() && mapped.upper_bound(k)->first != ub->first) ++bad;
+        }
+        try {
+            mapped.at(20001);
+            ++bad;
+        } catch (sjtu::index_out_of_bound &) {
+        }
+    }
+    std::cout << loaded.size() << ' ' << bad << '\n';
+
+    // custom records
+    sjtu::map<std::string, std::string> words;
+    std::map<std::string, std::string> wordsRef;
+    for (int i = 0; i < 500; ++i) {
+        std::string k = std::to_string(rng() % 100000), v(rng() % 40, static_cast<char>('a' + i % 26));
+        words[k] = v;
+        wordsRef[k] = v;
+    }
+    sjtu::save(words, path);
+    sjtu::map<std::string, std::string> wordsLoaded;
+    sjtu::load(wordsLoaded, path);
+    bad = wordsLoaded.size() == wordsRef.size() ? 0 : 1;
+    for (std::map<std::string, std::string>::const_iterator it = wordsRef.begin(); it != wordsRef.end(); ++it)
+        if (wordsLoaded.count(it->first) == 0 || wordsLoaded.at(it->first) != it->second) ++bad;
+    std::cout << wordsLoaded.size() << ' ' << bad << '\n';
+
+    // an empty map
+    sjtu::save(sjtu::map<int, long>(), path);
+    sjtu::map<int, long> none;
+    none[1] = 1;
+    sjtu::load(none, path);
+    {
+        sjtu::mapped_map<int, long> mapped(path);
+        std::cout << none.size() << ' ' << mapped.size() << ' '
+                  << (mapped.empty() && mapped.cbegin() == mapped.cend() && mapped.find(1) == mapped.cend()) << '\n';
+    }
+
+    // a file cut short is refused, and load leaves the map as it was
+    sjtu::save(map, path);
+    truncate(64 + sizeof(sjtu::pair<const int, long>) * 100 + 3);
+    std::cout << "truncated " << refused([&] { sjtu::load(loaded, path); }) << ' '
+              << (loaded.size() == ref.size()) << ' '
+              << refused([&] { sjtu::mapped_map<int, long> mapped(path); }) << '\n';
+    truncate(30);
+    std::cout << "header cut " << refused([&] { sjtu::load(loaded, path); }) << ' '
+              << refused([&] { sjtu::mapped_map<int, long> mapped(path); }) << '\n';
+
+    // other key or value types
+    sjtu::save(map, path);
+    std::cout << "wrong type " << refused([&] {
+        sjtu::map<int, int> other;
+        sjtu::load(other, path);
+    }) << ' ' << refused([&] { sjtu::mapped_map<long, long> mapped(path); }) << ' '
+              << refused([&] { sjtu::mapped_map<int, int> mapped(path); }) << ' '
+              << refused([&] {
+        sjtu::map<std::string, std::string> other;
+        sjtu::load(other, path);
+    }) << '\n';
+
+    // a file in descending order maps only with the ordering it was saved with
+    sjtu::map<int, long, std::greater<int> > down;
+    for (std::map<int, long>::const_iterator it = ref.begin(); it != ref.end(); ++it) down[it->first] = it->second;
+    sjtu::save(down, path);
+    bool ascending = refused([&] { sjtu::mapped_map<int, long> mapped(path); });
+    long found = 0;
+    {
+        sjtu::mapped_map<int, long, std::greater<int> > mapped(path);
+        for (std::map<int, long>::const_iterator it = ref.begin(); it != ref.end(); ++it)
+            if (mapped.find_ptr(it->first) && *mapped.find_ptr(it->first) == it->second) ++found;
+    }
+    sjtu::load(loaded, path);
+    std::cout << "wrong order " << ascending << ' ' << (found == static_cast<long>(ref.size())) << ' '
+              << (loaded.size() == ref.size() && loaded.cbegin()->first == ref.begin()->first) << '\n';
+
+    std::remove(path);
+    return 0;
+}
@@ -0,0 +1,112 @@
+// for_each and for_each_range against the same walks over a std::map, with
+// bounds in order, equal and reversed, and with fn stopping the walk early.
+// Each line is the number of elements visited and then the number of walks
+// that disagreed with std::map, which must be 0.
+#include "map.hpp"
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace {
+
+const int keys = 3000;
+const int walks = 2000;
+
+typedef sjtu::map<int, long> Map;
+typedef std::map<int, long> Ref;
+
+std::vector<int> rangeOf(const Ref &ref, int lo, int hi) {
+    std::vector<int> out;
+    if (!(lo < hi)) return out;
+    for (Ref::const_iterator it = ref.lower_bound(lo); it != ref.end() && it->first < hi; ++it)
+        out.push_back(it->first);
+    return out;
+}
+
+}
+
+int main() {
+    std::mt19937 rng(27);
+    Map map;
+    Ref ref;
+    for (int i = 0; i < keys; ++i) {
+        int k = static_cast<int>(rng() % (keys * 4));
+        map[k] = k;
+        ref[k] = k;
+    }
+
+    // the whole map, through the mutable and the const overload
+    std::vector<int> seen;
+    map.for_each([&](Map::value_type &v) { seen.push_back(v.first); v.second *= 2; });
+    long visited = 0, bad = 0;
+    std::vector<int> all = rangeOf(ref, -1, keys * 4);
+    if (seen != all) ++bad;
+    seen.clear();
+    const Map &cmap = map;
+    cmap.for_each([&](const Map::value_type &v) {
+        if (v.second != 2L * v.first) ++bad;
+        seen.push_back(v.first);
+    });
+    if (seen != all) ++bad;
+    visited += static_cast<long>(all.size());
+    std::cout << visited << ' ' << bad << '\n';
+
+    // random bounds: about a third reversed, a few equal
+    visited = bad = 0;
+    for (int w = 0; w < walks; ++w) {
+        int lo = static_cast<int>(rng() % (keys * 4 + 20)) - 10;
+        int hi = w % 16 == 0 ? lo : static_cast<int>(rng() % (keys * 4 + 20)) - 10;
+        if (w % 3 == 0 && lo < hi) std::swap(lo, hi);
+        seen.clear();
+        bool whole = cmap.for_each_range(lo, hi, [&](const Map::value_type &v) {
+            seen.push_back(v.first);
+        });
+        std::vector<int> want = rangeOf(ref, lo, hi);
+        if (!whole || seen != want) ++bad;
+        visited += static_cast<long>(seen.size());
+    }
+    std::cout << visited << ' ' << bad << '\n';
+
+    // equal and reversed bounds on keys that are in the map visit nothing
+    visited = bad = 0;
+    for (Ref::const_iterator it = ref.begin(); it != ref.end(); ++it) {
+        Ref::const_iterator next = it;
+        if (++next == ref.end()) break;
+        int calls = 0;
+        auto count = [&](Map::value_type &) { ++calls; };
+        if (!map.for_each_range(it->first, it->first, count)) ++bad;
+        if (!map.for_each_range(next->first, it->first, count)) ++bad;
+        if (calls != 0) ++bad;
+        if (!map.for_each_range(it->first, next->first, count) || calls != 1) ++bad;
+        visited += calls;
+    }
+    std::cout << visited << ' ' << bad << '\n';
+
+    // fn returning false stops the walk after that element
+    visited = bad = 0;
+    for (int w = 0; w < walks; ++w) {
+        int lo = static_cast<int>(rng() % (keys * 4));
+        int hi = lo + static_cast<int>(rng() % 400);
+        size_t limit = rng() % 8;
+        std::vector<int> want = rangeOf(ref, lo, hi);
+        seen.clear();
+        bool whole = cmap.for_each_range(lo, hi, [&](const Map::value_type &v) {
+            seen.push_back(v.first);
+            return seen.size() <= limit;
+        });
+        bool stopped = want.size() > limit;
+        if (stopped) want.resize(limit + 1);
+        if (whole == stopped || seen != want) ++bad;
+        visited += static_cast<long>(seen.size());
+    }
+    std::cout << visited << ' ' << bad << '\n';
+
+    // the reverse iterators walk the same keys backwards
+    seen.clear();
+    for (Map::const_reverse_iterator it = cmap.crbegin(); it != cmap.crend(); ++it)
+        seen.push_back(it->first);
+    std::vector<int> back(all.rbegin(), all.rend());
+    std::cout << seen.size() << ' ' << (seen == back ? 0 : 1) << '\n';
+    return 0;
+}
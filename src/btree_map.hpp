@@ -0,0 +1,1181 @@
+/**
+* a B+-tree with the interface of sjtu::map
+*/
+#ifndef SJTU_BTREE_MAP_HPP
+#define SJTU_BTREE_MAP_HPP
+
+// only for std::less<T>
+#include <functional>
+#include <cstddef>
+// placement new for the key slots
+#include <new>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include "utility.hpp"
+#include "exceptions.hpp"
+#include "simd_search.hpp"
+
+namespace sjtu {
+
+/**
+ * compile-time options of sjtu::btree_map.
+ * node_bytes is the size every tree node aims for: as many keys and links
+ * as fit into it (but at least four) are stored per node. The default of
+ * four cache lines keeps a node search within a few adjacent lines; large
+ * keys call for a larger size, up to a page:
+ *     struct paged : sjtu::btree_policy { static const size_t node_bytes = 4096; };
+ */
+struct btree_policy {
+    static const size_t node_bytes = 256;
+};
+
+namespace detail {
+// how many keys with one link each fit into a node after its header
+constexpr size_t btree_slots(size_t bytes, size_t header, size_t item) {
+    return bytes < header + 4 * item ? 4 : (bytes - header) / item > 60000 ? 60000 : (bytes - header) / item;
+}
+
+// selects the element constructor that builds the key and the mapped value
+// apart, so try_emplace needs nothing of pair beyond its two members
+struct btree_key_and_args {};
+}
+
+/**
+ * a drop-in alternative to sjtu::map for large maps.
+ * The keys live sorted in the nodes of a B+-tree, many to a node, so a lookup
+ * touches one node per level of a tree only a few levels deep instead of one
+ * cache line per level of a binary tree. Inner nodes hold separator keys,
+ * leaves hold a copy of every key next to a link to its element; the
+ * elements themselves never move, and the leaves are chained for iteration.
+ * The interface, the exceptions thrown and the lifetime of iterators and
+ * references are those of sjtu::map. An iterator remembers the slot of its
+ * element together with a modification count of the map; after an insert or
+ * erase its next step looks the slot up again in O(log n).
+ * Key must be copy constructible, moving a Key must not throw, and Compare is
+ * a plain less-than predicate.
+ */
+template<
+   class Key,
+   class T,
+   class Compare = std::less<Key>,
+   class Policy = btree_policy
+   > class btree_map {
+  public:
+   typedef pair<const Key, T> value_type;
+
+   class const_iterator;
+   struct Node;
+   struct Leaf;
+   struct Inner;
+   struct ValueNode;
+   struct Header;
+   class iterator {
+      private:
+      // the element, its slot as of the given generation of the map, and the
+      // header of the map, which travels with the elements on move and swap;
+      // end() has no element
+      ValueNode *node = nullptr;
+      Leaf *leaf = nullptr;
+      int index = 0;
+      size_t generation = 0;
+      Header *owner = nullptr;
+      public:
+      friend class btree_map;
+      iterator() = default;
+
+      iterator(const iterator &other) = default;
+
+      // internal constructor
+      iterator(Leaf *l, int i, const btree_map *o)
+          : node(l ? l->values[i] : nullptr), leaf(l), index(i), generation(o->header()->generation),
+            owner(o->header()) {}
+
+      iterator operator++(int) {
+          iterator tmp = *this;
+          ++(*this);
+          return tmp;
+      }
+
+      iterator &operator++() {
+          if (owner == nullptr || !stepForward(*this)) throw invalid_iterator();
+          return *this;
+      }
+
+      iterator operator--(int) {
+          iterator tmp = *this;
+          --(*this);
+          return tmp;
+      }
+
+      iterator &operator--() {
+          if (owner == nullptr || !stepBackward(*this)) throw invalid_iterator();
+          return *this;
+      }
+
+      value_type &operator*() const {
+          if (node == nullptr) throw invalid_iterator();
+          return node->value;
+      }
+
+      value_type *operator->() const { return &(operator*()); }
+
+      bool operator==(const iterator &rhs) const { return owner == rhs.owner && node == rhs.node; }
+
+      bool operator==(const const_iterator &rhs) const { return owner == rhs.owner && node == rhs.node; }
+
+      bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+
+      bool operator!=(const const_iterator &rhs) const { return !(*this == rhs); }
+   };
+   class const_iterator {
+      private:
+      ValueNode *node = nullptr;
+      Leaf *leaf = nullptr;
+      int index = 0;
+      size_t generation = 0;
+      Header *owner = nullptr;
+      public:
+      friend class btree_map;
+      const_iterator() = default;
+
+      const_iterator(const const_iterator &other) = default;
+
+      const_iterator(const iterator &other)
+          : node(other.node), leaf(other.leaf), index(other.index), generation(other.generation), owner(other.owner) {}
+
+      // internal constructor
+      const_iterator(Leaf *l, int i, const btree_map *o)
+          : node(l ? l->values[i] : nullptr), leaf(l), index(i), generation(o->header()->generation),
+            owner(o->header()) {}
+
+      const value_type &operator*() const {
+          if (node == nullptr) throw invalid_iterator();
+          return node->value;
+      }
+
+      const value_type *operator->() const { return &(operator*()); }
+
+      const_iterator operator++(int) {
+          const_iterator tmp = *this;
+          ++(*this);
+          return tmp;
+      }
+
+      const_iterator &operator++() {
+          if (owner == nullptr || !stepForward(*this)) throw invalid_iterator();
+          return *this;
+      }
+
+      const_iterator operator--(int) {
+          const_iterator tmp = *this;
+          --(*this);
+          return tmp;
+      }
+
+      const_iterator &operator--() {
+          if (owner == nullptr || !stepBackward(*this)) throw invalid_iterator();
+          return *this;
+      }
+
+      bool operator==(const const_iterator &rhs) const { return owner == rhs.owner && node == rhs.node; }
+
+      bool operator==(const iterator &rhs) const { return owner == rhs.owner && node == rhs.node; }
+
+      bool operator!=(const const_iterator &rhs) const { return !(*this == rhs); }
+
+      bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+   };
+
+   btree_map() : root(nullptr), head(nullptr), nodeCount(0), cmp(Compare()) { header(); }
+
+   btree_map(const btree_map &other) : root(nullptr), head(nullptr), nodeCount(0), cmp(other.cmp) {
+       header();
+       try {
+           copyFrom(other);
+       } catch (...) {
+           delete head;
+           throw;
+       }
+   }
+
+   /**
+  * takes over the elements of other in constant time; iterators into other
+  * keep pointing at the same elements, which now belong to this map
+  * (end() of other is not carried over). other is left empty.
+    */
+   btree_map(btree_map &&other) noexcept(std::is_nothrow_move_constructible<Compare>::value)
+       : root(other.root), head(other.head), nodeCount(other.nodeCount), cmp(std::move(other.cmp)) {
+       if (head) head->map = this;
+       other.root = nullptr;
+       other.head = nullptr;
+       other.nodeCount = 0;
+   }
+
+   btree_map &operator=(const btree_map &other) {
+       if (this == &other) return *this;
+       clear();
+       cmp = other.cmp;
+       copyFrom(other);
+       return *this;
+   }
+
+   btree_map &operator=(btree_map &&other) noexcept(std::is_nothrow_move_constructible<Compare>::value &&
+                                                   std::is_nothrow_move_assignable<Compare>::value) {
+       if (this == &other) return *this;
+       clear();
+       swap(other);
+       return *this;
+   }
+
+   /**
+  * exchanges the contents of two maps in constant time; iterators stay
+  * with their elements
+    */
+   void swap(btree_map &other) noexcept(std::is_nothrow_move_constructible<Compare>::value &&
+                                        std::is_nothrow_move_assignable<Compare>::value) {
+       using std::swap;
+       swap(root, other.root);
+       swap(head, other.head);
+       swap(nodeCount, other.nodeCount);
+       swap(cmp, other.cmp);
+       if (head) head->map = this;
+       if (other.head) other.head->map = &other;
+   }
+
+   ~btree_map() {
+       destroyTree(root);
+       delete head;
+   }
+
+   /**
+  * access specified element with bounds checking
+  * throw index_out_of_bound if no element has key
+    */
+   T &at(const Key &key) {
+       Leaf *leaf;
+       int index;
+       if (!findPos(key, leaf, index)) throw index_out_of_bound();
+       return leaf->values[index]->value.second;
+   }
+
+   const T &at(const Key &key) const {
+       Leaf *leaf;
+       int index;
+       if (!findPos(key, leaf, index)) throw index_out_of_bound();
+       return leaf->values[index]->value.second;
+   }
+
+   /**
+  * lookups that never throw: a pointer to the value of key (nullptr if
+  *   absent), whether key is present (its value copied to out if so), and
+  *   the value of key or fallback
+    */
+   T *find_ptr(const Key &key) {
+       Leaf *leaf;
+       int index;
+       return findPos(key, leaf, index) ? &leaf->values[index]->value.second : nullptr;
+   }
+
+   const T *find_ptr(const Key &key) const {
+       Leaf *leaf;
+       int index;
+       return findPos(key, leaf, index) ? &leaf->values[index]->value.second : nullptr;
+   }
+
+   bool try_at(const Key &key, T &out) const {
+       const T *found = find_ptr(key);
+       if (found == nullptr) return false;
+       out = *found;
+       return true;
+   }
+
+   T get_or(const Key &key, const T &fallback) const {
+       const T *found = find_ptr(key);
+       return found ? *found : fallback;
+   }
+
+   /**
+  * access specified element, inserting a value-initialised one if key is absent
+    */
+   T &operator[](const Key &key) { return try_emplace(key).first->second; }
+
+   T &operator[](Key &&key) { return try_emplace(std::move(key)).first->second; }
+
+   /**
+  * behave like at() throw index_out_of_bound if such key does not exist.
+    */
+   const T &operator[](const Key &key) const { return at(key); }
+
+   iterator begin() { return iterator(header()->first, 0, this); }
+
+   const_iterator cbegin() const { return const_iterator(header()->first, 0, this); }
+
+   iterator end() { return iterator(nullptr, 0, this); }
+
+   const_iterator cend() const { return const_iterator(nullptr, 0, this); }
+
+   bool empty() const { return root == nullptr; }
+
+   size_t size() const { return nodeCount; }
+
+   void clear() {
+       destroyTree(root);
+       root = nullptr;
+       nodeCount = 0;
+       header()->first = header()->last = nullptr;
+       ++head->generation;
+   }
+
+   /**
+  * insert an element.
+  * return a pair, the first of the pair is
+  *   the iterator to the new element (or the element that prevented the insertion),
+  *   the second one is true if insert successfully, or false.
+    */
+   pair<iterator, bool> insert(const value_type &value) { return insertValue(value); }
+
+   pair<iterator, bool> insert(value_type &&value) { return insertValue(std::move(value)); }
+
+   /**
+  * construct an element in place from args, like insert(value_type(args...)).
+  * The element is built first so that its key can be compared; it is dropped
+  *   again if an equivalent key is already present.
+    */
+   template<class... Args>
+   pair<iterator, bool> emplace(Args &&...args) {
+       ValueNode *node = new ValueNode(std::forward<Args>(args)...);
+       Leaf *leaf;
+       int index;
+       try {
+           if (findPos(node->value.first, leaf, index)) {
+               delete node;
+               return pair<iterator, bool>(iterator(leaf, index, this), false);
+           }
+           placeAt(leaf, index, node);
+       } catch (...) {
+           delete node;
+           throw;
+       }
+       return pair<iterator, bool>(iterator(leaf, index, this), true);
+   }
+
+   /**
+  * if key is absent, insert value_type(key, T(args...)) built in place;
+  *   otherwise do nothing, and in particular leave args untouched.
+    */
+   template<class... Args>
+   pair<iterator, bool> try_emplace(const Key &key, Args &&...args) {
+       return tryEmplaceKey(key, std::forward<Args>(args)...);
+   }
+
+   template<class... Args>
+   pair<iterator, bool> try_emplace(Key &&key, Args &&...args) {
+       return tryEmplaceKey(std::move(key), std::forward<Args>(args)...);
+   }
+
+   /**
+  * erase the element at pos.
+  *
+  * throw if pos pointed to a bad element (pos == this->end() || pos points an element out of this)
+    */
+   void erase(iterator pos) {
+       if (pos.owner == nullptr || pos.owner != head || pos.node == nullptr) throw invalid_iterator();
+       settle(pos);
+       eraseAt(pos.leaf, pos.index);
+   }
+
+   /**
+  * Returns the number of elements with key
+  *   that compares equivalent to the specified argument,
+  *   which is either 1 or 0
+    */
+   size_t count(const Key &key) const {
+       Leaf *leaf;
+       int index;
+       return findPos(key, leaf, index) ? 1 : 0;
+   }
+
+   /**
+  * Iterator to an element with key equivalent to key.
+  *   If no such element is found, past-the-end (see end()) iterator is returned.
+    */
+   iterator find(const Key &key) {
+       Leaf *leaf;
+       int index;
+       if (!findPos(key, leaf, index)) return end();
+       return iterator(leaf, index, this);
+   }
+
+   const_iterator find(const Key &key) const {
+       Leaf *leaf;
+       int index;
+       if (!findPos(key, leaf, index)) return cend();
+       return const_iterator(leaf, index, this);
+   }
+
+   /**
+  * returns an iterator to the first element whose key is not less than key,
+  *   or end() if there is none.
+    */
+   iterator lower_bound(const Key &key) {
+       Leaf *leaf;
+       int index;
+       boundPos(key, false, leaf, index);
+       return iterator(leaf, index, this);
+   }
+
+   const_iterator lower_bound(const Key &key) const {
+       Leaf *leaf;
+       int index;
+       boundPos(key, false, leaf, index);
+       return const_iterator(leaf, index, this);
+   }
+
+   /**
+  * returns an iterator to the first element whose key is greater than key,
+  *   or end() if there is none.
+    */
+   iterator upper_bound(const Key &key) {
+       Leaf *leaf;
+       int index;
+       boundPos(key, true, leaf, index);
+       return iterator(leaf, index, this);
+   }
+
+   const_iterator upper_bound(const Key &key) const {
+       Leaf *leaf;
+       int index;
+       boundPos(key, true, leaf, index);
+       return const_iterator(leaf, index, this);
+   }
+  private:
+   // keys per leaf and per inner node; both kinds of node hold a key and a
+   // link per slot, inner nodes one link more
+   static const int Slots = (int) detail::btree_slots(Policy::node_bytes, 4 * sizeof(void *), sizeof(Key) + sizeof(void *));
+   // a leaf may drop to half full and an inner node to half of its keys
+   // before it is merged with, or refilled from, a sibling
+   static const int MinLeaf = Slots / 2;
+   static const int MinInner = (Slots - 1) / 2;
+
+   Node *root;
+   // end() owner; first and last are the outermost leaves (null while empty).
+   // Like the header of sjtu::map it lives on the heap, and only a moved-from
+   // map has none until header() hands out a fresh one.
+   mutable Header *head;
+   size_t nodeCount;
+   Compare cmp;
+
+   // a Key built outside the tree, on its way to becoming a separator
+   class KeyHolder {
+      private:
+      typename std::aligned_storage<sizeof(Key), alignof(Key)>::type storage;
+      bool live = false;
+      public:
+      KeyHolder() = default;
+      KeyHolder(const KeyHolder &) = delete;
+      ~KeyHolder() { reset(); }
+      template<class... Args>
+      void emplace(Args &&...args) {
+          reset();
+          ::new (&storage) Key(std::forward<Args>(args)...);
+          live = true;
+      }
+      Key &get() { return *reinterpret_cast<Key *>(&storage); }
+      void reset() {
+          if (live) get().~Key();
+          live = false;
+      }
+      // moves the key into raw storage, leaving the holder empty
+      void moveTo(void *dst) {
+          ::new (dst) Key(std::move(get()));
+          reset();
+      }
+   };
+
+   // helpers
+   Header *header() const {
+       if (head == nullptr) {
+           head = new Header;
+           head->map = this;
+       }
+       return head;
+   }
+   template<class N>
+   static Key &keyAt(N *n, int i) { return *reinterpret_cast<Key *>(&n->keys[i]); }
+   template<class N>
+   static void relocateKey(N *n, int i, Key &src) {
+       ::new (&n->keys[i]) Key(std::move(src));
+       src.~Key();
+   }
+   static void relocate(Leaf *to, int i, Leaf *from, int j) {
+       relocateKey(to, i, keyAt(from, j));
+       to->values[i] = from->values[j];
+   }
+   static void adopt(Inner *n, int i, Node *child) {
+       n->child[i] = child;
+       child->parent = n;
+       child->slot = (unsigned short) i;
+   }
+   template<class It>
+   static void settle(It &it);
+   template<class It>
+   static bool stepForward(It &it);
+   template<class It>
+   static bool stepBackward(It &it);
+   static Leaf *newLeaf();
+   static Inner *newInner();
+   // arithmetic keys under std::less or std::greater are searched with
+   // vector compares, see simd_search.hpp
+   typedef typename detail::simd_key_order<Key, Compare>::type KeyOrder;
+   template<class N>
+   int lowerIndex(N *n, const Key &key) const { return lowerIndex(n, key, KeyOrder()); }
+   template<class N>
+   int upperIndex(N *n, const Key &key) const { return upperIndex(n, key, KeyOrder()); }
+   template<class N>
+   int lowerIndex(N *n, const Key &key, detail::scalar_keys) const;
+   template<class N>
+   int upperIndex(N *n, const Key &key, detail::scalar_keys) const;
+   template<class N, class Order>
+   int lowerIndex(N *n, const Key &key, Order order) const {
+       return detail::simd_lower_bound(reinterpret_cast<const Key *>(n->keys), n->count, key, order);
+   }
+   template<class N, class Order>
+   int upperIndex(N *n, const Key &key, Order order) const {
+       return detail::simd_upper_bound(reinterpret_cast<const Key *>(n->keys), n->count, key, order);
+   }
+   Leaf *leafFor(const Key &key) const;
+   bool findPos(const Key &key, Leaf *&leaf, int &index) const;
+   void boundPos(const Key &key, bool upper, Leaf *&leaf, int &index) const;
+   template<class V>
+   pair<iterator, bool> insertValue(V &&value);
+   template<class K, class... Args>
+   pair<iterator, bool> tryEmplaceKey(K &&key, Args &&...args);
+   void placeAt(Leaf *&leaf, int &index, ValueNode *node);
+   static void putIn(Leaf *leaf, int index, ValueNode *node);
+   void linkAfter(Leaf *leaf, Leaf *right);
+   static Inner *reserveSpine(Node *n);
+   static void freeSpine(Inner *spares);
+   void insertSeparator(Node *left, KeyHolder &sep, Node *right, Inner *&spares);
+   static void insertKeyAt(Inner *n, int at, KeyHolder &key, Node *right);
+   static void removeSlot(Inner *n, int k);
+   void eraseAt(Leaf *leaf, int index);
+   void fixLeaf(Leaf *leaf);
+   void fixInner(Inner *n);
+   static void destroyTree(Node *n);
+   static Node *cloneNode(Node *n, Leaf *&tail);
+   void copyFrom(const btree_map &other);
+};
+
+// =================== Implementation details (private) ===================
+template<class Key, class T, class Compare, class Policy>
+struct btree_map<Key, T, Compare, Policy>::Node {
+    Inner *parent;
+    unsigned short count; // keys held
+    unsigned short slot;  // position in parent->child
+    bool leaf;
+};
+
+// keys[i] is a copy of the key of *values[i]; the keys come first so that
+// a search stays in the leading cache lines of the node
+template<class Key, class T, class Compare, class Policy>
+struct btree_map<Key, T, Compare, Policy>::Leaf : Node {
+    typename std::aligned_storage<sizeof(Key), alignof(Key)>::type keys[Slots];
+    ValueNode *values[Slots];
+    Leaf *prev;
+    Leaf *next;
+};
+
+// keys[i] separates child[i] (keys below it) from child[i + 1] (keys not below it)
+template<class Key, class T, class Compare, class Policy>
+struct btree_map<Key, T, Compare, Policy>::Inner : Node {
+    typename std::aligned_storage<sizeof(Key), alignof(Key)>::type keys[Slots];
+    Node *child[Slots + 1];
+};
+
+template<class Key, class T, class Compare, class Policy>
+struct btree_map<Key, T, Compare, Policy>::ValueNode {
+    union {
+        value_type value;
+    };
+    template<class... Args>
+    explicit ValueNode(Args &&...args) : value(std::forward<Args>(args)...) {}
+    // first from key and second from args, each in place in the storage of value
+    template<class K, class... Args>
+    ValueNode(detail::btree_key_and_args, K &&key, Args &&...args) {
+        ::new (const_cast<Key *>(std::addressof(value.first))) Key(std::forward<K>(key));
+        try {
+            ::new (std::addressof(value.second)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            value.first.~Key();
+            throw;
+        }
+    }
+    ValueNode(const ValueNode &) = delete;
+    ValueNode &operator=(const ValueNode &) = delete;
+    ~ValueNode() { value.~value_type(); }
+};
+
+// generation counts the inserts and erases, whose shifts make the slots
+// remembered by iterators stale; map finds them again
+template<class Key, class T, class Compare, class Policy>
+struct btree_map<Key, T, Compare, Policy>::Header {
+    Leaf *first = nullptr;
+    Leaf *last = nullptr;
+    size_t generation = 0;
+    const btree_map *map = nullptr;
+};
+
+// refreshes the slot of an iterator that has not seen the latest change
+template<class Key, class T, class Compare, class Policy>
+template<class It>
+void btree_map<Key, T, Compare, Policy>::settle(It &it) {
+    if (it.generation == it.owner->generation) return;
+    it.owner->map->findPos(it.node->value.first, it.leaf, it.index);
+    it.generation = it.owner->generation;
+}
+
+// iterator steps; false means the step is illegal (++end(), --begin(),
+// or --end() on an empty map)
+template<class Key, class T, class Compare, class Policy>
+template<class It>
+bool btree_map<Key, T, Compare, Policy>::stepForward(It &it) {
+    if (it.node == nullptr) return false;
+    settle(it);
+    if (++it.index == it.leaf->count) {
+        it.leaf = it.leaf->next;
+        it.index = 0;
+    }
+    it.node = it.leaf ? it.leaf->values[it.index] : nullptr;
+    return true;
+}
+
+template<class Key, class T, class Compare, class Policy>
+template<class It>
+bool btree_map<Key, T, Compare, Policy>::stepBackward(It &it) {
+    if (it.node == nullptr) {
+        if (it.owner->last == nullptr) return false;
+        it.leaf = it.owner->last;
+        it.index = it.leaf->count - 1;
+        it.generation = it.owner->generation;
+    } else {
+        settle(it);
+        if (it.index > 0) {
+            --it.index;
+        } else {
+            if (it.leaf->prev == nullptr) return false;
+            it.leaf = it.leaf->prev;
+            it.index = it.leaf->count - 1;
+        }
+    }
+    it.node = it.leaf->values[it.index];
+    return true;
+}
+
+template<class Key, class T, class Compare, class Policy>
+typename btree_map<Key, T, Compare, Policy>::Leaf *btree_map<Key, T, Compare, Policy>::newLeaf() {
+    Leaf *leaf = new Leaf;
+    leaf->parent = nullptr;
+    leaf->count = 0;
+    leaf->slot = 0;
+    leaf->leaf = true;
+    leaf->prev = leaf->next = nullptr;
+    return leaf;
+}
+
+template<class Key, class T, class Compare, class Policy>
+typename btree_map<Key, T, Compare, Policy>::Inner *btree_map<Key, T, Compare, Policy>::newInner() {
+    Inner *n = new Inner;
+    n->parent = nullptr;
+    n->count = 0;
+    n->slot = 0;
+    n->leaf = false;
+    return n;
+}
+
+// binary searches inside a node: the first key not below key, and the
+// first key above it (for an inner node, the child whose range holds key)
+template<class Key, class T, class Compare, class Policy>
+template<class N>
+int btree_map<Key, T, Compare, Policy>::lowerIndex(N *n, const Key &key, detail::scalar_keys) const {
+    int lo = 0, hi = n->count;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if (cmp(keyAt(n, mid), key)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+template<class Key, class T, class Compare, class Policy>
+template<class N>
+int btree_map<Key, T, Compare, Policy>::upperIndex(N *n, const Key &key, detail::scalar_keys) const {
+    int lo = 0, hi = n->count;
+    while (lo < hi) {
+        int mid = (lo + hi) >> 1;
+        if (cmp(key, keyAt(n, mid))) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+template<class Key, class T, class Compare, class Policy>
+typename btree_map<Key, T, Compare, Policy>::Leaf *btree_map<Key, T, Compare, Policy>::leafFor(const Key &key) const {
+    Node *cur = root;
+    if (cur == nullptr) return nullptr;
+    while (!cur->leaf) {
+        Inner *n = static_cast<Inner *>(cur);
+        cur = n->child[upperIndex(n, key)];
+    }
+    return static_cast<Leaf *>(cur);
+}
+
+// leaf and index become the slot of key, or the slot it would be inserted at
+template<class Key, class T, class Compare, class Policy>
+bool btree_map<Key, T, Compare, Policy>::findPos(const Key &key, Leaf *&leaf, int &index) const {
+    leaf = leafFor(key);
+    index = 0;
+    if (leaf == nullptr) return false;
+    index = lowerIndex(leaf, key);
+    return index < leaf->count && !cmp(key, keyAt(leaf, index));
+}
+
+// like findPos, but an index past the end of the leaf moves on to the next one
+template<class Key, class T, class Compare, class Policy>
+void btree_map<Key, T, Compare, Policy>::boundPos(const Key &key, bool upper, Leaf *&leaf, int &index) const {
+    leaf = leafFor(key);
+    index = 0;
+    if (leaf == nullptr) return;
+    index = upper ? upperIndex(leaf, key) : lowerIndex(leaf, key);
+    if (index == leaf->count) {
+        leaf = leaf->next;
+        index = 0;
+    }
+}
+
+template<class Key, class T, class Compare, class Policy>
+template<class V>
+pair<typename btree_map<Key, T, Compare, Policy>::iterator, bool>
+btree_map<Key, T, Compare, Policy>::insertValue(V &&value) {
+    Leaf *leaf;
+    int index;
+    if (findPos(value.first, leaf, index)) return pair<iterator, bool>(iterator(leaf, index, this), false);
+    ValueNode *node = new ValueNode(std::forward<V>(value));
+    try {
+        placeAt(leaf, index, node);
+    } catch (...) {
+        delete node;
+        throw;
+    }
+    return pair<iterator, bool>(iterator(leaf, index, this), true);
+}
+
+template<class Key, class T, class Compare, class Policy>
+template<class K, class... Args>
+pair<typename btree_map<Key, T, Compare, Policy>::iterator, bool>
+btree_map<Key, T, Compare, Policy>::tryEmplaceKey(K &&key, Args &&...args) {
+    Leaf *leaf;
+    int index;
+    if (findPos(key, leaf, index)) return pair<iterator, bool>(iterator(leaf, index, this), false);
+    ValueNode *node = new ValueNode(detail::btree_key_and_args(), std::forward<K>(key), std::forward<Args>(args)...);
+    try {
+        placeAt(leaf, index, node);
+    } catch (...) {
+        delete node;
+        throw;
+    }
+    return pair<iterator, bool>(iterator(leaf, index, this), true);
+}
+
+// links node in at the insertion point found by findPos, splitting the leaf
+// first if it is full; leaf and index follow the new element. Everything that
+// may throw (allocating nodes, copying keys) happens while the tree is still,
+// or again, in a valid state, and leaves node to the caller.
+template<class Key, class T, class Compare, class Policy>
+void btree_map<Key, T, Compare, Policy>::placeAt(Leaf *&leaf, int &index, ValueNode *node) {
+    if (leaf == nullptr) {
+        leaf = newLeaf();
+        try {
+            putIn(leaf, 0, node);
+        } catch (...) {
+            delete leaf;
+            throw;
+        }
+        root = leaf;
+        header()->first = head->last = leaf;
+        index = 0;
+    } else if (leaf->count < Slots) {
+        putIn(leaf, index, node);
+    } else {
+        Inner *spares = reserveSpine(leaf);
+        Leaf *right = nullptr;
+        KeyHolder sep;
+        // appending to the last leaf starts a new one, so ascending inserts
+        // fill their leaves completely
+        bool append = leaf->next == nullptr && index == leaf->count;
+        int mid = Slots / 2;
+        try {
+            right = newLeaf();
+            if (append) {
+                putIn(right, 0, node);
+                sep.emplace(keyAt(right, 0));
+            } else {
+                sep.emplace(keyAt(leaf, mid));
+            }
+        } catch (...) {
+            if (right && right->count) keyAt(right, 0).~Key();
+            delete right;
+            freeSpine(spares);
+            throw;
+        }
+        if (!append) {
+            for (int i = mid; i < leaf->count; ++i) relocate(right, i - mid, leaf, i);
+            right->count = (unsigned short) (leaf->count - mid);
+            leaf->count = (unsigned short) mid;
+        }
+        linkAfter(leaf, right);
+        insertSeparator(leaf, sep, right, spares);
+        ++head->generation; // the split alone has moved slots
+        if (append) {
+            leaf = right;
+            index = 0;
+        } else {
+            if (index > mid) {
+                leaf = right;
+                index -= mid;
+            }
+            putIn(leaf, index, node);
+        }
+    }
+    ++nodeCount;
+    ++head->generation;
+}
+
+// opens a gap at index and copies the key of node into it; the gap is closed
+// again if that throws
+template<class Key, class T, class Compare, class Policy>
+void btree_map<Key, T, Compare, Policy>::putIn(Leaf *leaf, int index, ValueNode *node) {
+    for (int i = leaf->count; i > index; --i) relocate(leaf, i, leaf, i - 1);
+    try {
+        ::new (&leaf->keys[index]) Key(node->value.first);
+    } catch (...) {
+        for (int i = index; i < leaf->count; ++i) relocate(leaf, i, leaf, i + 1);
+        throw;
+    }
+    leaf->values[index] = node;
+    ++leaf->count;
+}
+
+template<class Key, class T, class Compare, class Policy>
+void btree_map<Key, T, Compare, Policy>::linkAfter(Leaf *leaf, Leaf *right) {
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next) leaf->next->prev = right;
+    else header()->last = right;
+    leaf->next = right;
+}
+
+// allocates the inner nodes a split of n may need: one per full ancestor,
+// plus a new root if they are all full. They are chained through parent.
+template<class Key, class T, class Compare, class Policy>
+typename btree_map<Key, T, Compare, Policy>::Inner *btree_map<Key, T, Compare, Policy>::reserveSpine(Node *n) {
+    int needed = 0;
+    Inner *p = n->parent;
+    for (; p && p->count == Slots; p = p->parent) ++needed;
+    if (p == nullptr) ++needed;
+    Inner *spares = nullptr;
+    try {
+        while (needed--) {
+            Inner *s = newInner();
+            s->parent = spares;
+            spares = s;
+        }
+    } catch (...) {
+        freeSpine(spares);
+        throw;
+    }
+    return spares;
+}
+
+template<class Key, class T, class Compare, class Policy>
+void btree_map<Key, T, Compare, Policy>::freeSpine(Inner *spares) {
+    while (spares) {
+        Inner *next = spares->parent;
+        delete spares;
+        spares = next;
+    }
+}
+
+// hangs right into the tree next to left, with sep between them, splitting
+// full ancestors on the way up; nothing here throws, the nodes come from spares
+template<class Key, class T, class Compare, class Policy>
+void btree_map<Key, T, Compare, Policy>::insertSeparator(Node *left, KeyHolder &sep, Node *right, Inner *&spares) {
+    for (;;) {
+        Inner *p = left->parent;
+        if (p == nullptr) {
+            Inner *top = spares;
+            spares = spares->parent;
+            top->parent = nullptr;
+            sep.moveTo(&top->keys[0]);
+            top->count = 1;
+            adopt(top, 0, left);
+            adopt(top, 1, right);
+            root = top;
+            return;
+        }
+        int at = left->slot;
+        if (p->count < Slots) {
+            insertKeyAt(p, at, sep, right);
+            return;
+        }
+        Inner *q = spares;
+        spares = spares->parent;
+        q->parent = nullptr;
+        int mid = Slots / 2;
+        KeyHolder up;
+        up.emplace(std::move(keyAt(p, mid)));
+        keyAt(p, mid).~Key();
+        for (int i = mid + 1; i < p->count; ++i) relocateKey(q, i - mid - 1, keyAt(p, i));
+        for (int i = mid + 1; i <= p->count; ++i) adopt(q, i - mid - 1, p->child[i]);
+        q->count = (unsigned short) (p->count - mid - 1);
+        p->count = (unsigned short) mid;
+        if (at <= mid) insertKeyAt(p, at, sep, right);
+        else insertKeyAt(q, at - mid - 1, sep, right);
+        sep.emplace(std::move(up.get()));
+        left = p;
+        right = q;
+    }
+}
+
+// puts key at keys[at] and right at child[at + 1] of a node with room
+template<class Key, class T, class Compare, class Policy>
+void btree_map<Key, T, Compare, Policy>::insertKeyAt(Inner *n, int at, KeyHolder &key, Node *right) {
+    for (int i = n->count; i > at; --i) {
+        relocateKey(n, i, keyAt(n, i - 1));
+        adopt(n, i + 1, n->child[i]);
+    }
+    key.moveTo(&n->keys[at]);
+    adopt(n, at + 1, right);
+    ++n->count;
+}
+
+// closes the gap left by keys[k] (already destroyed or moved) and child[k + 1]
+template<class Key, class T, class Compare, class Policy>
+void btree_map<Key, T, Compare, Policy>::removeSlot(Inner *n, int k) {
+    for (int i = k; i + 1 < n->count; ++i) {
+        relocateKey(n, i, keyAt(n, i + 1));
+        adopt(n, i + 1, n->child[i + 2]);
+    }
+    --n->count;
+}
+
+template<class Key, class T, class Compare, class Policy>
+void btree_map<Key, T, Compare, Policy>::eraseAt(Leaf *leaf, int index) {
+    delete leaf->values[index];
+    keyAt(leaf, index).~Key();
+    for (int i = index + 1; i < leaf->count; ++i) relocate(leaf, i - 1, leaf, i);
+    --leaf->count;
+    --nodeCount;
+    ++head->generation;
+    if (leaf == root) {
+        if (leaf->count == 0) {
+            delete leaf;
+            root = nullptr;
+            head->first = head->last = nullptr;
+        }
+        return;
+    }
+    if (leaf->count < MinLeaf) fixLeaf(leaf);
+}
+
+// an underfull leaf is merged with a sibling when both fit into one node,
+// and otherwise takes keys over from it until both are about equally full
+template<class Key, class T, class Compare, class Policy>
+void btree_map<Key, T, Compare, Policy>::fixLeaf(Leaf *leaf) {
+    Inner *p = leaf->parent;
+    int k = leaf->slot > 0 ? leaf->slot - 1 : 0;
+    Leaf *left = static_cast<Leaf *>(p->child[k]);
+    Leaf *right = static_cast<Leaf *>(p->child[k + 1]);
+    if (left->count + right->count <= Slots) {
+        for (int i = 0; i < right->count; ++i) relocate(left, left->count + i, right, i);
+        left->count = (unsigned short) (left->count + right->count);
+        left->next = right->next;
+        if (right->next) right->next->prev = left;
+        else head->last = left;
+        delete right;
+        keyAt(p, k).~Key();
+        removeSlot(p, k);
+        fixInner(p);
+        return;
+    }
+    int total = left->count + right->count;
+    int keep = total / 2;
+    // the new separator is the key that ends up first in right. If copying it
+    // throws, the leaf simply stays underfull: the tree is valid either way.
+    KeyHolder sep;
+    try {
+        if (left->count > keep) sep.emplace(keyAt(left, keep));
+        else sep.emplace(keyAt(right, keep - left->count));
+    } catch (...) {
+        return;
+    }
+    if (left->count > keep) {
+        int moved = left->count - keep;
+        for (int i = right->count - 1; i >= 0; --i) relocate(right, i + moved, right, i);
+        for (int i = 0; i < moved; ++i) relocate(right, i, left, keep + i);
+    } else {
+        int moved = keep - left->count;
+        for (int i = 0; i < moved; ++i) relocate(left, left->count + i, right, i);
+        for (int i = moved; i < right->count; ++i) relocate(right, i - moved, right, i);
+    }
+    left->count = (unsigned short) keep;
+    right->count = (unsigned short) (total - keep);
+    keyAt(p, k).~Key();
+    sep.moveTo(&p->keys[k]);
+}
+
+// the same for inner nodes, where the parent's separator takes part: merging
+// pulls it down between the two, refilling rotates one key through it
+template<class Key, class T, class Compare, class Policy>
+void btree_map<Key, T, Compare, Policy>::fixInner(Inner *n) {
+    while (n != root) {
+        if (n->count >= MinInner) return;
+        Inner *p = n->parent;
+        int k = n->slot > 0 ? n->slot - 1 : 0;
+        Inner *left = static_cast<Inner *>(p->child[k]);
+        Inner *right = static_cast<Inner *>(p->child[k + 1]);
+        if (left->count + right->count < Slots) {
+            int base = left->count + 1;
+            relocateKey(left, left->count, keyAt(p, k));
+            for (int i = 0; i < right->count; ++i) relocateKey(left, base + i, keyAt(right, i));
+            for (int i = 0; i <= right->count; ++i) adopt(left, base + i, right->child[i]);
+            left->count = (unsigned short) (base + right->count);
+            delete right;
+            removeSlot(p, k);
+            n = p;
+            continue;
+        }
+        if (n == left) {
+            relocateKey(left, left->count, keyAt(p, k));
+            adopt(left, left->count + 1, right->child[0]);
+            ++left->count;
+            relocateKey(p, k, keyAt(right, 0));
+            for (int i = 1; i < right->count; ++i) relocateKey(right, i - 1, keyAt(right, i));
+            for (int i = 1; i <= right->count; ++i) adopt(right, i - 1, right->child[i]);
+            --right->count;
+        } else {
+            for (int i = right->count; i > 0; --i) relocateKey(right, i, keyAt(right, i - 1));
+            for (int i = right->count + 1; i > 0; --i) adopt(right, i, right->child[i - 1]);
+            relocateKey(right, 0, keyAt(p, k));
+            adopt(right, 0, left->child[left->count]);
+            ++right->count;
+            relocateKey(p, k, keyAt(left, left->count - 1));
+            --left->count;
+        }
+        return;
+    }
+    if (n->count == 0) {
+        root = n->child[0];
+        root->parent = nullptr;
+        root->slot = 0;
+        delete n;
+    }
+}
+
+template<class Key, class T, class Compare, class Policy>
+void btree_map<Key, T, Compare, Policy>::destroyTree(Node *n) {
+    if (n == nullptr) return;
+    if (n->leaf) {
+        Leaf *leaf = static_cast<Leaf *>(n);
+        for (int i = 0; i < leaf->count; ++i) {
+            delete leaf->values[i];
+            keyAt(leaf, i).~Key();
+        }
+        delete leaf;
+        return;
+    }
+    Inner *inner = static_cast<Inner *>(n);
+    for (int i = 0; i < inner->count; ++i) keyAt(inner, i).~Key();
+    for (int i = 0; i <= inner->count; ++i) destroyTree(inner->child[i]);
+    delete inner;
+}
+
+// copies n node by node, chaining the new leaves behind tail. A node is
+// complete up to its count at every point, so a throw can destroy the partial
+// copy the ordinary way.
+template<class Key, class T, class Compare, class Policy>
+typename btree_map<Key, T, Compare, Policy>::Node *btree_map<Key, T, Compare, Policy>::cloneNode(Node *n, Leaf *&tail) {
+    if (n->leaf) {
+        Leaf *from = static_cast<Leaf *>(n);
+        Leaf *leaf = newLeaf();
+        try {
+            while (leaf->count < from->count) {
+                int i = leaf->count;
+                ValueNode *node = new ValueNode(from->values[i]->value);
+                try {
+                    ::new (&leaf->keys[i]) Key(keyAt(from, i));
+                } catch (...) {
+                    delete node;
+                    throw;
+                }
+                leaf->values[i] = node;
+                ++leaf->count;
+            }
+        } catch (...) {
+            destroyTree(leaf);
+            throw;
+        }
+        leaf->prev = tail;
+        if (tail) tail->next = leaf;
+        tail = leaf;
+        return leaf;
+    }
+    Inner *from = static_cast<Inner *>(n);
+    Inner *inner = newInner();
+    try {
+        adopt(inner, 0, cloneNode(from->child[0], tail));
+    } catch (...) {
+        delete inner;
+        throw;
+    }
+    try {
+        while (inner->count < from->count) {
+            int i = inner->count;
+            ::new (&inner->keys[i]) Key(keyAt(from, i));
+            try {
+                adopt(inner, i + 1, cloneNode(from->child[i + 1], tail));
+            } catch (...) {
+                keyAt(inner, i).~Key();
+                throw;
+            }
+            ++inner->count;
+        }
+    } catch (...) {
+        destroyTree(inner);
+        throw;
+    }
+    return inner;
+}
+
+// expects this map to be empty
+template<class Key, class T, class Compare, class Policy>
+void btree_map<Key, T, Compare, Policy>::copyFrom(const btree_map &other) {
+    if (other.root == nullptr) return;
+    Leaf *tail = nullptr;
+    root = cloneNode(other.root, tail);
+    root->parent = nullptr;
+    Node *first = root;
+    while (!first->leaf) first = static_cast<Inner *>(first)->child[0];
+    header()->first = static_cast<Leaf *>(first);
+    head->last = tail;
+    nodeCount = other.nodeCount;
+}
+
+template<class Key, class T, class Compare, class Policy>
+void swap(btree_map<Key, T, Compare, Policy> &a, btree_map<Key, T, Compare, Policy> &b) noexcept(noexcept(a.swap(b))) {
+    a.swap(b);
+}
+
+}
+
+#endif
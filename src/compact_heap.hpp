@@ -0,0 +1,166 @@
+/**
+* process-wide slot heap behind the compact node mode of sjtu::map
+*/
+#ifndef SJTU_COMPACT_HEAP_HPP
+#define SJTU_COMPACT_HEAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+namespace sjtu {
+
+namespace detail {
+
+/**
+ * hands out slots of Slot bytes that can be named by a 32-bit index.
+ * Memory comes in chunks aligned to their size, and the first slot of every
+ * chunk records the chunk's number, so the index of a slot follows from its
+ * address alone; a directory of chunk addresses turns an index back into an
+ * address. Index 0 would be the header of chunk 0 and stands for null.
+ * Runs of slots are handed out in powers of two and recycled by size; the
+ * memory itself is kept for the life of the process. There is one heap per
+ * slot size, shared by every map using it and safe to use from any thread.
+ */
+template<size_t Slot>
+class compact_heap {
+  public:
+   static constexpr size_t floorPow2(size_t n) { return n < 2 ? n : 2 * floorPow2(n / 2); }
+
+   static const size_t chunk_bytes = size_t(1) << 18;
+   static const size_t chunk_slots = chunk_bytes / Slot;
+   // the longest run handed out, which still fits next to a chunk header
+   static const size_t max_run = floorPow2(chunk_slots - 1 < 4096 ? chunk_slots - 1 : 4096);
+   static const size_t max_chunks = (std::uint64_t(1) << 32) / chunk_slots;
+   static_assert(chunk_slots >= 64, "value_type too large for compact nodes");
+   static_assert(Slot >= sizeof(void *) && Slot % alignof(void *) == 0, "slot cannot hold a free-list link");
+
+   static compact_heap &instance() {
+       // never destroyed: maps in other static objects may outlive it
+       static compact_heap *heap = new compact_heap;
+       return *heap;
+   }
+
+   static void *decode(std::uint32_t index) { return directory[index / chunk_slots] + index % chunk_slots * Slot; }
+
+   static std::uint32_t encode(const void *p) {
+       const char *c = static_cast<const char *>(p);
+       const char *chunk =
+           reinterpret_cast<const char *>(reinterpret_cast<std::uintptr_t>(c) & ~std::uintptr_t(chunk_bytes - 1));
+       std::uint32_t number = *reinterpret_cast<const std::uint32_t *>(chunk);
+       return static_cast<std::uint32_t>(number * chunk_slots + static_cast<size_t>(c - chunk) / Slot);
+   }
+
+   // a run of at least slots slots (at most max_run); slots is set to its length
+   void *allocate(size_t &slots) {
+       size_t sizeClass = 0;
+       while ((size_t(1) << sizeClass) < slots && (size_t(1) << sizeClass) < max_run) ++sizeClass;
+       slots = size_t(1) << sizeClass;
+       std::lock_guard<std::mutex> guard(lock);
+       if (freeRuns[sizeClass]) {
+           FreeRun *run = freeRuns[sizeClass];
+           freeRuns[sizeClass] = run->next;
+           return run;
+       }
+       size_t bytes = slots * Slot;
+       if (static_cast<size_t>(bumpEnd - bumpCur) < bytes) {
+           recycleTail();
+           newChunk();
+       }
+       void *p = bumpCur;
+       bumpCur += bytes;
+       return p;
+   }
+
+   // a run obtained from allocate, together with the length it reported
+   void deallocate(void *p, size_t slots) {
+       size_t sizeClass = 0;
+       while ((size_t(1) << sizeClass) < slots) ++sizeClass;
+       std::lock_guard<std::mutex> guard(lock);
+       push(p, sizeClass);
+   }
+  private:
+   struct FreeRun { FreeRun *next; };
+   static const size_t chunks_per_block = 16;
+
+   static char **directory;
+   std::mutex lock;
+   FreeRun *freeRuns[32] = {};
+   char *bumpCur = nullptr;
+   char *bumpEnd = nullptr;
+   char *spareChunk = nullptr;
+   size_t spareChunks = 0;
+   size_t chunkCount = 0;
+
+   compact_heap() {
+       directory = static_cast<char **>(std::calloc(max_chunks, sizeof(char *)));
+       if (directory == nullptr) throw std::bad_alloc();
+   }
+
+   void push(void *p, size_t sizeClass) {
+       FreeRun *run = static_cast<FreeRun *>(p);
+       run->next = freeRuns[sizeClass];
+       freeRuns[sizeClass] = run;
+   }
+
+   // what is left of the current chunk goes to the free runs
+   void recycleTail() {
+       while (bumpCur != bumpEnd) {
+           size_t left = static_cast<size_t>(bumpEnd - bumpCur) / Slot;
+           size_t sizeClass = 0;
+           while ((size_t(2) << sizeClass) <= left && (size_t(2) << sizeClass) <= max_run) ++sizeClass;
+           push(bumpCur, sizeClass);
+           bumpCur += (size_t(1) << sizeClass) * Slot;
+       }
+   }
+
+   // chunks are cut out of larger blocks, which pay for aligning them
+   void newChunk() {
+       if (chunkCount == max_chunks) throw std::bad_alloc();
+       if (spareChunks == 0) {
+           char *block = static_cast<char *>(::operator new((chunks_per_block + 1) * chunk_bytes));
+           std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(block) + chunk_bytes - 1) & ~std::uintptr_t(chunk_bytes - 1);
+           spareChunk = reinterpret_cast<char *>(aligned);
+           spareChunks = chunks_per_block;
+       }
+       char *chunk = spareChunk;
+       spareChunk += chunk_bytes;
+       --spareChunks;
+       *reinterpret_cast<std::uint32_t *>(chunk) = static_cast<std::uint32_t>(chunkCount);
+       directory[chunkCount++] = chunk;
+       bumpCur = chunk + Slot; // the header slot
+       bumpEnd = chunk + chunk_slots * Slot;
+   }
+};
+
+template<size_t Slot>
+char **compact_heap<Slot>::directory = nullptr;
+
+/**
+ * a tree link stored as a compact_heap index, which reads and assigns like
+ * the Node pointer it stands for
+ */
+template<class Node, class Heap>
+class compact_link {
+  private:
+   std::uint32_t index;
+  public:
+   compact_link(Node *p = nullptr) : index(p ? Heap::encode(p) : 0) {}
+
+   compact_link &operator=(Node *p) {
+       index = p ? Heap::encode(p) : 0;
+       return *this;
+   }
+
+   operator Node *() const { return index ? static_cast<Node *>(Heap::decode(index)) : nullptr; }
+
+   Node *operator->() const { return *this; }
+};
+
+}
+
+}
+
+#endif
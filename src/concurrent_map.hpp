@@ -0,0 +1,331 @@
+/**
+* a thread-safe map made of independently locked sjtu::map shards
+*/
+#ifndef SJTU_CONCURRENT_MAP_HPP
+#define SJTU_CONCURRENT_MAP_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "utility.hpp"
+#include "exceptions.hpp"
+#include "map.hpp"
+
+namespace sjtu {
+
+namespace detail {
+
+/**
+ * a reader-writer lock whose readers do not share a cache line.
+ * Every reader thread counts itself in one of Stripes padded counters and
+ * then checks the writer flag; a writer raises the flag and waits for all
+ * counters to drain. Readers that meet a raised flag step back until the
+ * writer is done, so writers are not starved. Reads therefore scale with
+ * the number of threads, while a write costs a scan of the stripes.
+ */
+template<size_t Stripes = 16>
+class striped_shared_mutex {
+  public:
+   striped_shared_mutex() : writing(false) {
+       for (Stripe &s : stripes) s.readers.store(0, std::memory_order_relaxed);
+   }
+
+   striped_shared_mutex(const striped_shared_mutex &) = delete;
+   striped_shared_mutex &operator=(const striped_shared_mutex &) = delete;
+
+   // the stripe of the calling thread, to hand back to unlock_shared
+   size_t lock_shared() const {
+       size_t i = readerSlot() % Stripes;
+       for (;;) {
+           stripes[i].readers.fetch_add(1);
+           if (!writing.load()) return i;
+           stripes[i].readers.fetch_sub(1, std::memory_order_release);
+           while (writing.load(std::memory_order_acquire)) std::this_thread::yield();
+       }
+   }
+
+   void unlock_shared(size_t stripe) const { stripes[stripe].readers.fetch_sub(1, std::memory_order_release); }
+
+   // A reader stores its count and then loads the flag, a writer stores the
+   // flag and then loads the counts. All four are seq_cst, which puts them in
+   // one total order, so at least one side sees the other's store.
+   void lock() {
+       writers.lock();
+       writing.store(true);
+       for (const Stripe &s : stripes) {
+           while (s.readers.load() != 0) std::this_thread::yield();
+       }
+   }
+
+   void unlock() {
+       writing.store(false, std::memory_order_release);
+       writers.unlock();
+   }
+  private:
+   struct Stripe {
+       std::atomic<unsigned> readers;
+       char pad[64 - sizeof(std::atomic<unsigned>)];
+   };
+
+   static unsigned readerSlot() {
+       static std::atomic<unsigned> next(0);
+       thread_local unsigned slot = next.fetch_add(1, std::memory_order_relaxed);
+       return slot;
+   }
+
+   mutable Stripe stripes[Stripes];
+   std::atomic<bool> writing;
+   std::mutex writers;
+};
+
+}
+
+/**
+ * a map that any number of threads may use at once.
+ * The elements are spread over independent sjtu::map shards by the hash of
+ * their key, and every shard has its own striped_shared_mutex: lookups on
+ * one shard run side by side without writing a shared cache line, and
+ * writes to different shards do not wait for each other.
+ * Since an element may be erased as soon as its shard is unlocked, nothing
+ * hands out iterators or references; lookups copy the value out or run a
+ * function on it under the lock instead. Those functions must not call back
+ * into the same concurrent_map. Whole-map operations (size, for_each,
+ * to_map) visit the shards one at a time and so are not atomic, except
+ * to_map, which holds all shards while it copies.
+ */
+template<
+   class Key,
+   class T,
+   class Compare = std::less<Key>,
+   class Hash = std::hash<Key>,
+   class Policy = map_policy
+   > class concurrent_map {
+  public:
+   typedef pair<const Key, T> value_type;
+   typedef map<Key, T, Compare, Policy> shard_type;
+
+   /**
+  * shards is rounded up to a power of two; by default there are four per
+  * hardware thread
+    */
+   explicit concurrent_map(size_t shards = 4 * (std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1),
+                           const Hash &hash = Hash())
+       : shardCount(roundUp(shards)), shards(new Shard[shardCount]), hasher(hash) {}
+
+   concurrent_map(const concurrent_map &) = delete;
+   concurrent_map &operator=(const concurrent_map &) = delete;
+
+   size_t shard_count() const { return shardCount; }
+
+   /**
+  * copies the value of key to value and returns true, or returns false if
+  * there is no such key
+    */
+   bool find(const Key &key, T &value) const {
+       return visit(key, [&value](const T &found) { value = found; });
+   }
+
+   /**
+  * returns a copy of the value of key
+  * throw index_out_of_bound if no element has key
+    */
+   T at(const Key &key) const {
+       const Shard &s = shardOf(key);
+       ReadGuard guard(s.lock);
+       return s.map.at(key);
+   }
+
+   size_t count(const Key &key) const {
+       const Shard &s = shardOf(key);
+       ReadGuard guard(s.lock);
+       return s.map.count(key);
+   }
+
+   /**
+  * calls f(const T &) on the value of key under the shard's read lock and
+  * returns true, or returns false if there is no such key
+    */
+   template<class F>
+   bool visit(const Key &key, F &&f) const {
+       const Shard &s = shardOf(key);
+       ReadGuard guard(s.lock);
+       typename shard_type::const_iterator it = s.map.find(key);
+       if (it == s.map.cend()) return false;
+       f(it->second);
+       return true;
+   }
+
+   /**
+  * calls f(T &) on the value of key under the shard's write lock and
+  * returns true, or returns false if there is no such key
+    */
+   template<class F>
+   bool update(const Key &key, F &&f) {
+       Shard &s = shardOf(key);
+       WriteGuard guard(s.lock);
+       typename shard_type::iterator it = s.map.find(key);
+       if (it == s.map.end()) return false;
+       f(it->second);
+       return true;
+   }
+
+   /**
+  * inserts value unless its key is present; returns whether it did
+    */
+   bool insert(const value_type &value) {
+       Shard &s = shardOf(value.first);
+       WriteGuard guard(s.lock);
+       return s.map.insert(value).second;
+   }
+
+   bool insert(value_type &&value) {
+       Shard &s = shardOf(value.first);
+       WriteGuard guard(s.lock);
+       return s.map.insert(std::move(value)).second;
+   }
+
+   /**
+  * sets the value of key, inserting it if absent; returns whether it was inserted
+    */
+   template<class V>
+   bool insert_or_assign(const Key &key, V &&value) {
+       Shard &s = shardOf(key);
+       WriteGuard guard(s.lock);
+       pair<typename shard_type::iterator, bool> result = s.map.try_emplace(key, std::forward<V>(value));
+       if (!result.second) result.first->second = std::forward<V>(value);
+       return result.second;
+   }
+
+   /**
+  * removes the element of key; returns how many were removed (0 or 1)
+    */
+   size_t erase(const Key &key) {
+       Shard &s = shardOf(key);
+       WriteGuard guard(s.lock);
+       typename shard_type::iterator it = s.map.find(key);
+       if (it == s.map.end()) return 0;
+       s.map.erase(it);
+       return 1;
+   }
+
+   /**
+  * erases every element for which pred(element) is true, one shard at a time
+  *   (see map::erase_if); returns how many that were
+    */
+   template<class Predicate>
+   size_t erase_if(Predicate pred) {
+       size_t n = 0;
+       for (size_t i = 0; i < shardCount; ++i) {
+           WriteGuard guard(shards[i].lock);
+           n += shards[i].map.erase_if([&pred](value_type &v) { return pred(v); });
+       }
+       return n;
+   }
+
+   size_t size() const {
+       size_t n = 0;
+       for (size_t i = 0; i < shardCount; ++i) {
+           ReadGuard guard(shards[i].lock);
+           n += shards[i].map.size();
+       }
+       return n;
+   }
+
+   bool empty() const { return size() == 0; }
+
+   void clear() {
+       for (size_t i = 0; i < shardCount; ++i) {
+           WriteGuard guard(shards[i].lock);
+           shards[i].map.clear();
+       }
+   }
+
+   /**
+  * calls f(const value_type &) on every element, shard by shard under the
+  * shard's read lock; within a shard the elements come in key order
+    */
+   template<class F>
+   void for_each(F f) const {
+       for (size_t i = 0; i < shardCount; ++i) {
+           ReadGuard guard(shards[i].lock);
+           for (typename shard_type::const_iterator it = shards[i].map.cbegin(); it != shards[i].map.cend(); ++it) f(*it);
+       }
+   }
+
+   /**
+  * a consistent, ordered copy of all elements: every shard is read-locked
+  * for the whole copy, and the copies are merged into one map
+    */
+   shard_type to_map() const {
+       std::unique_ptr<size_t[]> held(new size_t[shardCount]);
+       for (size_t i = 0; i < shardCount; ++i) held[i] = shards[i].lock.lock_shared();
+       shard_type result;
+       try {
+           for (size_t i = 0; i < shardCount; ++i) {
+               shard_type part(shards[i].map);
+               result.merge(part);
+           }
+       } catch (...) {
+           for (size_t i = 0; i < shardCount; ++i) shards[i].lock.unlock_shared(held[i]);
+           throw;
+       }
+       for (size_t i = 0; i < shardCount; ++i) shards[i].lock.unlock_shared(held[i]);
+       return result;
+   }
+  private:
+   typedef detail::striped_shared_mutex<> Lock;
+
+   // const members of map only write after a split or a move (size()
+   // recounting, endNode() making a header), neither of which happens to a
+   // shard, so readers sharing a lock do not race (statistics counters are
+   // atomic)
+   struct Shard {
+       mutable Lock lock;
+       shard_type map;
+   };
+
+   class ReadGuard {
+      public:
+      explicit ReadGuard(const Lock &l) : lock(l), stripe(l.lock_shared()) {}
+      ReadGuard(const ReadGuard &) = delete;
+      ~ReadGuard() { lock.unlock_shared(stripe); }
+      private:
+      const Lock &lock;
+      size_t stripe;
+   };
+
+   class WriteGuard {
+      public:
+      explicit WriteGuard(Lock &l) : lock(l) { lock.lock(); }
+      WriteGuard(const WriteGuard &) = delete;
+      ~WriteGuard() { lock.unlock(); }
+      private:
+      Lock &lock;
+   };
+
+   size_t shardCount;
+   std::unique_ptr<Shard[]> shards;
+   Hash hasher;
+
+   static size_t roundUp(size_t n) {
+       size_t p = 1;
+       while (p < n) p <<= 1;
+       return p;
+   }
+
+   // Fibonacci hashing spreads weak hashes such as the identity on integers
+   size_t shardIndex(const Key &key) const {
+       return static_cast<size_t>((static_cast<unsigned long long>(hasher(key)) * 0x9E3779B97F4A7C15ull) >> 32) &
+              (shardCount - 1);
+   }
+   Shard &shardOf(const Key &key) { return shards[shardIndex(key)]; }
+   const Shard &shardOf(const Key &key) const { return shards[shardIndex(key)]; }
+};
+
+}
+
+#endif
@@ -7,33 +7,40 @@
 
 namespace sjtu {
 
+// Exceptions carry a pointer to a static message only, so throwing, copying
+// and catching one never allocates.
 class exception {
    protected:
-    const std::string variant = "";
-    std::string detail = "";
+    const char *variant = "exception";
    public:
-    exception() {}
-    exception(const exception &ec) : variant(ec.variant), detail(ec.detail) {}
-    virtual std::string what() {
-        return variant + " " + detail;
+    exception() noexcept {}
+    exception(const exception &ec) noexcept = default;
+    exception &operator=(const exception &ec) noexcept = default;
+    virtual ~exception() {}
+    virtual const char *what() const noexcept {
+        return variant;
     }
 };
 
 class index_out_of_bound : public exception {
-    /* __________________________ */
+   public:
+    index_out_of_bound() noexcept { variant = "index_out_of_bound"; }
 };
 
 class runtime_error : public exception {
-    /* __________________________ */
+   public:
+    runtime_error() noexcept { variant = "runtime_error"; }
 };
 
 class invalid_iterator : public exception {
-    /* __________________________ */
+   public:
+    invalid_iterator() noexcept { variant = "invalid_iterator"; }
 };
 
 class container_is_empty : public exception {
-    /* __________________________ */
+   public:
+    container_is_empty() noexcept { variant = "container_is_empty"; }
 };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,579 @@
+/**
+* a sorted-array map for tables that are built once and then mostly read
+*/
+#ifndef SJTU_FLAT_MAP_HPP
+#define SJTU_FLAT_MAP_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "utility.hpp"
+#include "exceptions.hpp"
+#include "map.hpp"
+
+namespace sjtu {
+
+/**
+ * keys and values in two separate arrays, both sorted by key.
+ * A lookup is a branch-free binary search over the key array alone, and
+ * iteration walks both arrays front to back; there is no per-element
+ * overhead. A batch insert(first, last) sorts the new elements and merges
+ * them in with one pass over the table, while a single insert or erase
+ * shifts everything behind its position, so build a table in batches.
+ * The lookup and iterator interface is that of sjtu::map, except that
+ *   - an element is not stored as a value_type, so dereferencing an
+ *     iterator yields a small proxy whose first and second refer into the
+ *     arrays (it converts to value_type);
+ *   - like positions in an array, iterators are invalidated by every insert
+ *     and erase, and follow neither moves nor swaps.
+ * Moving a Key or a T must not throw.
+ */
+template<
+   class Key,
+   class T,
+   class Compare = std::less<Key>
+   > class flat_map {
+  public:
+   typedef pair<const Key, T> value_type;
+
+   // what an iterator dereferences to: the key and value of one element
+   template<class V>
+   struct element_ref {
+       const Key &first;
+       V &second;
+       operator value_type() const { return value_type(first, second); }
+   };
+   // what operator-> returns, holding the proxy it points to
+   template<class V>
+   struct element_ptr {
+       element_ref<V> ref;
+       const element_ref<V> *operator->() const { return &ref; }
+   };
+
+   class const_iterator;
+   class iterator {
+      private:
+      size_t index = 0;
+      flat_map *owner = nullptr;
+      public:
+      friend class flat_map;
+      typedef std::bidirectional_iterator_tag iterator_category;
+      typedef typename flat_map::value_type value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef element_ptr<T> pointer;
+      typedef element_ref<T> reference;
+
+      iterator() = default;
+
+      iterator(const iterator &other) = default;
+
+      // internal constructor
+      iterator(size_t i, flat_map *o) : index(i), owner(o) {}
+
+      iterator operator++(int) {
+          iterator tmp = *this;
+          ++(*this);
+          return tmp;
+      }
+
+      iterator &operator++() {
+          if (owner == nullptr || index >= owner->length) throw invalid_iterator();
+          ++index;
+          return *this;
+      }
+
+      iterator operator--(int) {
+          iterator tmp = *this;
+          --(*this);
+          return tmp;
+      }
+
+      iterator &operator--() {
+          if (owner == nullptr || index == 0) throw invalid_iterator();
+          --index;
+          return *this;
+      }
+
+      reference operator*() const {
+          if (owner == nullptr || index >= owner->length) throw invalid_iterator();
+          return reference{owner->keys[index], owner->values[index]};
+      }
+
+      pointer operator->() const { return pointer{operator*()}; }
+
+      bool operator==(const iterator &rhs) const { return owner == rhs.owner && index == rhs.index; }
+
+      bool operator==(const const_iterator &rhs) const { return owner == rhs.owner && index == rhs.index; }
+
+      bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+
+      bool operator!=(const const_iterator &rhs) const { return !(*this == rhs); }
+   };
+   class const_iterator {
+      private:
+      size_t index = 0;
+      const flat_map *owner = nullptr;
+      public:
+      friend class flat_map;
+      typedef std::bidirectional_iterator_tag iterator_category;
+      typedef typename flat_map::value_type value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef element_ptr<const T> pointer;
+      typedef element_ref<const T> reference;
+
+      const_iterator() = default;
+
+      const_iterator(const const_iterator &other) = default;
+
+      const_iterator(const iterator &other) : index(other.index), owner(other.owner) {}
+
+      // internal constructor
+      const_iterator(size_t i, const flat_map *o) : index(i), owner(o) {}
+
+      reference operator*() const {
+          if (owner == nullptr || index >= owner->length) throw invalid_iterator();
+          return reference{owner->keys[index], owner->values[index]};
+      }
+
+      pointer operator->() const { return pointer{operator*()}; }
+
+      const_iterator operator++(int) {
+          const_iterator tmp = *this;
+          ++(*this);
+          return tmp;
+      }
+
+      const_iterator &operator++() {
+          if (owner == nullptr || index >= owner->length) throw invalid_iterator();
+          ++index;
+          return *this;
+      }
+
+      const_iterator operator--(int) {
+          const_iterator tmp = *this;
+          --(*this);
+          return tmp;
+      }
+
+      const_iterator &operator--() {
+          if (owner == nullptr || index == 0) throw invalid_iterator();
+          --index;
+          return *this;
+      }
+
+      bool operator==(const const_iterator &rhs) const { return owner == rhs.owner && index == rhs.index; }
+
+      bool operator==(const iterator &rhs) const { return owner == rhs.owner && index == rhs.index; }
+
+      bool operator!=(const const_iterator &rhs) const { return !(*this == rhs); }
+
+      bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+   };
+
+   flat_map() : keys(nullptr), values(nullptr), length(0), capacity(0), cmp(Compare()) {}
+
+   flat_map(const flat_map &other) : keys(nullptr), values(nullptr), length(0), capacity(0), cmp(other.cmp) {
+       copyFrom(other);
+   }
+
+   flat_map(flat_map &&other) noexcept(std::is_nothrow_move_constructible<Compare>::value)
+       : keys(other.keys), values(other.values), length(other.length), capacity(other.capacity),
+         cmp(std::move(other.cmp)) {
+       other.keys = nullptr;
+       other.values = nullptr;
+       other.length = other.capacity = 0;
+   }
+
+   /**
+  * builds the table from the elements of [first, last), which need not be
+  * sorted; of equal keys the first one wins
+    */
+   template<class InputIterator>
+   flat_map(InputIterator first, InputIterator last) : keys(nullptr), values(nullptr), length(0), capacity(0), cmp(Compare()) {
+       insert(first, last);
+   }
+
+   /**
+  * copies the elements of a map, which come sorted already, in O(n)
+    */
+   template<class Policy>
+   explicit flat_map(const map<Key, T, Compare, Policy> &source)
+       : keys(nullptr), values(nullptr), length(0), capacity(0), cmp(Compare()) {
+       reserve(source.size());
+       for (typename map<Key, T, Compare, Policy>::const_iterator it = source.cbegin(); it != source.cend(); ++it)
+           emplaceAt(length, it->first, it->second);
+   }
+
+   flat_map &operator=(const flat_map &other) {
+       if (this == &other) return *this;
+       flat_map copy(other);
+       swap(copy);
+       return *this;
+   }
+
+   flat_map &operator=(flat_map &&other) noexcept(std::is_nothrow_move_constructible<Compare>::value &&
+                                                 std::is_nothrow_move_assignable<Compare>::value) {
+       if (this == &other) return *this;
+       clear();
+       swap(other);
+       return *this;
+   }
+
+   void swap(flat_map &other) noexcept(std::is_nothrow_move_constructible<Compare>::value &&
+                                       std::is_nothrow_move_assignable<Compare>::value) {
+       using std::swap;
+       swap(keys, other.keys);
+       swap(values, other.values);
+       swap(length, other.length);
+       swap(capacity, other.capacity);
+       swap(cmp, other.cmp);
+   }
+
+   ~flat_map() {
+       destroyAll();
+       release();
+   }
+
+   /**
+  * access specified element with bounds checking
+  * throw index_out_of_bound if no element has key
+    */
+   T &at(const Key &key) {
+       size_t i = findIndex(key);
+       if (i == length) throw index_out_of_bound();
+       return values[i];
+   }
+
+   const T &at(const Key &key) const {
+       size_t i = findIndex(key);
+       if (i == length) throw index_out_of_bound();
+       return values[i];
+   }
+
+   /**
+  * lookups that never throw: a pointer to the value of key (nullptr if
+  *   absent), whether key is present (its value copied to out if so), and
+  *   the value of key or fallback
+    */
+   T *find_ptr(const Key &key) {
+       size_t i = findIndex(key);
+       return i == length ? nullptr : values + i;
+   }
+
+   const T *find_ptr(const Key &key) const {
+       size_t i = findIndex(key);
+       return i == length ? nullptr : values + i;
+   }
+
+   bool try_at(const Key &key, T &out) const {
+       const T *found = find_ptr(key);
+       if (found == nullptr) return false;
+       out = *found;
+       return true;
+   }
+
+   T get_or(const Key &key, const T &fallback) const {
+       const T *found = find_ptr(key);
+       return found ? *found : fallback;
+   }
+
+   /**
+  * access specified element, inserting a value-initialised one if key is absent
+    */
+   T &operator[](const Key &key) {
+       size_t i = lowerIndex(key);
+       if (i == length || cmp(key, keys[i])) emplaceAt(i, key);
+       return values[i];
+   }
+
+   /**
+  * behave like at() throw index_out_of_bound if such key does not exist.
+    */
+   const T &operator[](const Key &key) const { return at(key); }
+
+   iterator begin() { return iterator(0, this); }
+
+   const_iterator cbegin() const { return const_iterator(0, this); }
+
+   iterator end() { return iterator(length, this); }
+
+   const_iterator cend() const { return const_iterator(length, this); }
+
+   bool empty() const { return length == 0; }
+
+   size_t size() const { return length; }
+
+   /**
+  * makes room for n elements, so that inserts up to that size do not reallocate
+    */
+   void reserve(size_t n);
+
+   void clear() { destroyAll(); }
+
+   /**
+  * insert an element.
+  * return a pair, the first of the pair is
+  *   the iterator to the new element (or the element that prevented the insertion),
+  *   the second one is true if insert successfully, or false.
+    */
+   pair<iterator, bool> insert(const value_type &value) {
+       size_t i = lowerIndex(value.first);
+       if (i < length && !cmp(value.first, keys[i])) return pair<iterator, bool>(iterator(i, this), false);
+       emplaceAt(i, value.first, value.second);
+       return pair<iterator, bool>(iterator(i, this), true);
+   }
+
+   pair<iterator, bool> insert(value_type &&value) {
+       size_t i = lowerIndex(value.first);
+       if (i < length && !cmp(value.first, keys[i])) return pair<iterator, bool>(iterator(i, this), false);
+       emplaceAt(i, value.first, std::move(value.second));
+       return pair<iterator, bool>(iterator(i, this), true);
+   }
+
+   /**
+  * inserts the elements of [first, last) whose keys are not present yet (of
+  * equal new keys the first one wins) in O(m log m + n) for m new and n old
+  * elements. If building, ordering or placing them throws, the table is
+  * left unchanged, provided moving a Key or a T cannot throw, as required
+  * above; with moves that can throw, no guarantee is made.
+    */
+   template<class InputIterator>
+   void insert(InputIterator first, InputIterator last) {
+       flat_map staged;
+       staged.reserveFor(first, last, typename std::iterator_traits<InputIterator>::iterator_category());
+       for (; first != last; ++first) staged.appendElement(*first);
+       mergeIn(staged);
+   }
+
+   /**
+  * erase the element at pos.
+  *
+  * throw if pos pointed to a bad element (pos == this->end() || pos points an element out of this)
+    */
+   void erase(iterator pos) {
+       if (pos.owner != this || pos.index >= length) throw invalid_iterator();
+       keys[pos.index].~Key();
+       values[pos.index].~T();
+       for (size_t i = pos.index + 1; i < length; ++i) relocate(i - 1, i);
+       --length;
+   }
+
+   size_t count(const Key &key) const { return findIndex(key) == length ? 0 : 1; }
+
+   iterator find(const Key &key) { return iterator(findIndex(key), this); }
+
+   const_iterator find(const Key &key) const { return const_iterator(findIndex(key), this); }
+
+   /**
+  * returns an iterator to the first element whose key is not less than key,
+  *   or end() if there is none.
+    */
+   iterator lower_bound(const Key &key) { return iterator(lowerIndex(key), this); }
+
+   const_iterator lower_bound(const Key &key) const { return const_iterator(lowerIndex(key), this); }
+
+   /**
+  * returns an iterator to the first element whose key is greater than key,
+  *   or end() if there is none.
+    */
+   iterator upper_bound(const Key &key) { return iterator(upperIndex(key), this); }
+
+   const_iterator upper_bound(const Key &key) const { return const_iterator(upperIndex(key), this); }
+  private:
+   // raw storage for capacity elements, of which the first length are built
+   Key *keys;
+   T *values;
+   size_t length;
+   size_t capacity;
+   Compare cmp;
+
+   // helpers
+   size_t lowerIndex(const Key &key) const;
+   size_t upperIndex(const Key &key) const;
+   size_t findIndex(const Key &key) const {
+       size_t i = lowerIndex(key);
+       return i < length && !cmp(key, keys[i]) ? i : length;
+   }
+   void relocate(size_t to, size_t from) {
+       ::new (keys + to) Key(std::move(keys[from]));
+       keys[from].~Key();
+       ::new (values + to) T(std::move(values[from]));
+       values[from].~T();
+   }
+   template<class K, class... Args>
+   void emplaceAt(size_t pos, K &&key, Args &&...args);
+   template<class E>
+   void appendElement(E &&element) { emplaceAt(length, std::forward<E>(element).first, std::forward<E>(element).second); }
+   template<class InputIterator>
+   void reserveFor(InputIterator, InputIterator, std::input_iterator_tag) {}
+   template<class InputIterator>
+   void reserveFor(InputIterator first, InputIterator last, std::forward_iterator_tag) {
+       reserve(static_cast<size_t>(std::distance(first, last)));
+   }
+   void mergeIn(flat_map &staged);
+   void copyFrom(const flat_map &other);
+   void destroyAll();
+   void release();
+};
+
+// =================== Implementation details (private) ===================
+
+// branch-free binary search: the range halves every step whatever the
+// outcome of the comparison, which only picks the half by a conditional
+// move, so there is no branch to mispredict
+template<class Key, class T, class Compare>
+size_t flat_map<Key, T, Compare>::lowerIndex(const Key &key) const {
+    if (length == 0) return 0;
+    const Key *base = keys;
+    size_t len = length;
+    while (len > 1) {
+        size_t half = len >> 1;
+        base = cmp(base[half], key) ? base + half : base;
+        len -= half;
+    }
+    return static_cast<size_t>(base - keys) + (cmp(*base, key) ? 1 : 0);
+}
+
+template<class Key, class T, class Compare>
+size_t flat_map<Key, T, Compare>::upperIndex(const Key &key) const {
+    if (length == 0) return 0;
+    const Key *base = keys;
+    size_t len = length;
+    while (len > 1) {
+        size_t half = len >> 1;
+        base = cmp(key, base[half]) ? base : base + half;
+        len -= half;
+    }
+    return static_cast<size_t>(base - keys) + (cmp(key, *base) ? 0 : 1);
+}
+
+template<class Key, class T, class Compare>
+void flat_map<Key, T, Compare>::reserve(size_t n) {
+    if (n <= capacity) return;
+    Key *newKeys = static_cast<Key *>(::operator new(n * sizeof(Key)));
+    T *newValues;
+    try {
+        newValues = static_cast<T *>(::operator new(n * sizeof(T)));
+    } catch (...) {
+        ::operator delete(newKeys);
+        throw;
+    }
+    for (size_t i = 0; i < length; ++i) {
+        ::new (newKeys + i) Key(std::move(keys[i]));
+        keys[i].~Key();
+        ::new (newValues + i) T(std::move(values[i]));
+        values[i].~T();
+    }
+    release();
+    keys = newKeys;
+    values = newValues;
+    capacity = n;
+}
+
+// builds an element at pos, shifting the ones behind it; the gap is closed
+// again if building throws
+template<class Key, class T, class Compare>
+template<class K, class... Args>
+void flat_map<Key, T, Compare>::emplaceAt(size_t pos, K &&key, Args &&...args) {
+    if (length == capacity) reserve(capacity ? capacity * 2 : 8);
+    for (size_t i = length; i > pos; --i) relocate(i, i - 1);
+    try {
+        ::new (keys + pos) Key(std::forward<K>(key));
+        try {
+            ::new (values + pos) T(std::forward<Args>(args)...);
+        } catch (...) {
+            keys[pos].~Key();
+            throw;
+        }
+    } catch (...) {
+        for (size_t i = pos; i < length; ++i) relocate(i, i + 1);
+        throw;
+    }
+    ++length;
+}
+
+// merges the unsorted elements of staged into the table. The first pass
+// decides, with every comparison the merge needs, where each element of the
+// result comes from; the second fills the result from the back, so old
+// elements only ever move towards the end. Past the allocation in reserve()
+// only moves are left, which is why they must not throw: one that did would
+// leave the table half merged.
+template<class Key, class T, class Compare>
+void flat_map<Key, T, Compare>::mergeIn(flat_map &staged) {
+    size_t m = staged.length;
+    if (m == 0) return;
+    std::unique_ptr<size_t[]> order(new size_t[m]);
+    for (size_t j = 0; j < m; ++j) order[j] = j;
+    const Key *fresh = staged.keys;
+    std::stable_sort(order.get(), order.get() + m, [&](size_t a, size_t b) { return cmp(fresh[a], fresh[b]); });
+    const size_t old = static_cast<size_t>(-1);
+    std::unique_ptr<size_t[]> source(new size_t[length + m]);
+    size_t n = 0, i = 0, j = 0;
+    while (i < length || j < m) {
+        if (i < length && (j == m || !cmp(fresh[order[j]], keys[i]))) {
+            while (j < m && !cmp(keys[i], fresh[order[j]])) ++j; // already present
+            source[n++] = old;
+            ++i;
+        } else {
+            size_t pick = order[j++];
+            while (j < m && !cmp(fresh[pick], fresh[order[j]])) ++j; // later duplicates
+            source[n++] = pick;
+        }
+    }
+    reserve(n);
+    size_t left = length;
+    for (size_t k = n; k-- > 0;) {
+        if (source[k] == old) {
+            if (--left != k) relocate(k, left);
+        } else {
+            ::new (keys + k) Key(std::move(staged.keys[source[k]]));
+            ::new (values + k) T(std::move(staged.values[source[k]]));
+        }
+    }
+    length = n;
+}
+
+// expects this table to be empty
+template<class Key, class T, class Compare>
+void flat_map<Key, T, Compare>::copyFrom(const flat_map &other) {
+    reserve(other.length);
+    try {
+        for (size_t i = 0; i < other.length; ++i) emplaceAt(length, other.keys[i], other.values[i]);
+    } catch (...) {
+        destroyAll();
+        release();
+        throw;
+    }
+}
+
+template<class Key, class T, class Compare>
+void flat_map<Key, T, Compare>::destroyAll() {
+    for (size_t i = 0; i < length; ++i) {
+        keys[i].~Key();
+        values[i].~T();
+    }
+    length = 0;
+}
+
+template<class Key, class T, class Compare>
+void flat_map<Key, T, Compare>::release() {
+    ::operator delete(keys);
+    ::operator delete(values);
+    keys = nullptr;
+    values = nullptr;
+    capacity = 0;
+}
+
+template<class Key, class T, class Compare>
+void swap(flat_map<Key, T, Compare> &a, flat_map<Key, T, Compare> &b) noexcept(noexcept(a.swap(b))) {
+    a.swap(b);
+}
+
+}
+
+#endif
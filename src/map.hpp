@@ -6,17 +6,268 @@
 
 // only for std::less<T>
 #include <functional>
+#include <atomic>
 #include <cstddef>
+// placement new and trivial-destructor detection for the node pool
+#include <new>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
 #include "utility.hpp"
 #include "exceptions.hpp"
 
 namespace sjtu {
 
+namespace detail {
+// compact_heap.hpp, which only maps with map_policy::compact_nodes need
+template<size_t Slot>
+class compact_heap;
+template<class Node, class Heap>
+class compact_link;
+}
+
+/**
+ * marks a comparator as three-way.
+ * A three-way Compare returns a negative, zero or positive int for
+ * a < b, a == b and a > b (like strcmp), and announces itself with a nested
+ *     typedef void is_three_way;
+ * or by specialising this trait. The map then resolves every tree level with
+ * a single call and stops as soon as the key is hit.
+ */
+template<class Compare, class = void>
+struct is_three_way_compare : std::false_type {};
+
+template<class Compare>
+struct is_three_way_compare<Compare, typename std::conditional<true, void, typename Compare::is_three_way>::type>
+    : std::true_type {};
+
+/**
+ * has R as type if Compare is transparent, i.e. has a nested
+ *     typedef void is_transparent;
+ * like std::less<>. The lookups of such a map also take any K the
+ * comparator can compare with Key, so probing needs no Key temporary.
+ * K is only there to make the overloads depend on it.
+ */
+template<class Compare, class K, class R, class = void>
+struct transparent_lookup {};
+
+template<class Compare, class K, class R>
+struct transparent_lookup<Compare, K, R, typename std::conditional<true, void, typename Compare::is_transparent>::type> {
+    typedef R type;
+};
+
+/**
+ * balancing schemes for sjtu::map, selected through map_policy::balance.
+ * avl_balance keeps the tree strictly height balanced, which gives the
+ * shortest lookups; retracing stops as soon as a subtree height is unchanged.
+ * red_black_balance is looser but fixes an insert with at most two rotations
+ * and an erase with at most three, which suits write-heavy maps.
+ */
+struct avl_balance {};
+struct red_black_balance {};
+
+/**
+ * how far sjtu::map iterators check their use, selected through
+ * map_policy::iterator_checks.
+ * checked_iterators throw invalid_iterator when an iterator is stepped past
+ * either end, dereferenced at end() or used without a map.
+ * unchecked_iterators leave all of that out, so stepping and dereferencing
+ * are bare pointer walks and misuse is undefined.
+ * generation_checked_iterators check like checked_iterators and also keep a
+ * stamp in every node slot that changes whenever its element is erased, so
+ * an iterator to an erased element throws as well, even once the slot holds
+ * a new element. That costs a word per node and per iterator, and clear()
+ * then destroys the nodes one by one instead of dropping whole slabs.
+ */
+struct checked_iterators {};
+struct unchecked_iterators {};
+struct generation_checked_iterators {};
+
+/**
+ * compile-time options of sjtu::map.
+ * Derive from it and override the members you need, e.g.
+ *     struct ranked : sjtu::map_policy { static const bool order_statistics = true; };
+ *     sjtu::map<int, int, std::less<int>, ranked> m;
+ */
+struct map_policy {
+    typedef avl_balance balance;
+    // keep subtree sizes in the nodes for nth(), rank() and distance()
+    static const bool order_statistics = false;
+    // Link nodes by 32-bit indices and keep heights (and subtree sizes) in
+    // small fields, which for map<int, int> shrinks a node from 40 to 24
+    // bytes. Nodes then come from a process-wide heap per node size (see
+    // compact_heap.hpp) that holds up to 2^32 of them and keeps its memory
+    // for reuse; following a link costs a table lookup. Include
+    // compact_heap.hpp as well to use it.
+    static const bool compact_nodes = false;
+    typedef checked_iterators iterator_checks;
+    // count comparisons, rotations, allocations and lookup depths, see stats()
+    static const bool statistics = false;
+    // Give the map's header a block of its own with room for this many
+    // nodes, which are used up before the map allocates anything else; a map
+    // that never grows past them costs one allocation instead of three.
+    // That block is made, at its full size, even for a map kept empty.
+    static const size_t inline_nodes = 0;
+};
+
+/**
+ * what a map with map_policy::statistics has done since it was created or
+ * since reset_stats(); all zero when statistics are off.
+ * Lookups are calls of find(), count(), at() and the like; their depth is
+ * the number of nodes looked at on the way down.
+ */
+struct map_stats {
+    size_t comparisons = 0;
+    size_t rotations = 0;
+    size_t nodes_allocated = 0;
+    size_t nodes_freed = 0;
+    // nodes visited while restoring the balance after a change
+    size_t rebalance_steps = 0;
+    size_t lookups = 0;
+    size_t total_lookup_depth = 0;
+    size_t max_lookup_depth = 0;
+
+    double average_lookup_depth() const { return lookups ? double(total_lookup_depth) / lookups : 0.0; }
+};
+
+template<class Key, class T, class Compare>
+class flat_map; // flat_map.hpp
+
+namespace detail {
+template<class Map>
+struct parallel_ops; // parallel.hpp
+
+// selects the node constructor that builds the key and the mapped value
+// apart, so try_emplace needs nothing of pair beyond its two members
+struct key_and_args {};
+
+// per-node subtree size, empty unless order statistics are switched on
+template<bool Enabled, class Size>
+struct subtree_size {};
+
+template<class Size>
+struct subtree_size<true, Size> {
+    Size size = 1;
+};
+
+// the slot stamp an iterator saw, empty unless generation checks are on
+template<bool Enabled>
+struct iterator_stamp {};
+
+template<>
+struct iterator_stamp<true> {
+    size_t stamp = 0;
+};
+
+inline void prefetch(const void *p) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p);
+#else
+    (void) p;
+#endif
+}
+
+// calls f(v) and tells whether to go on: what f returned, or true if that was void
+template<class F, class V>
+auto keep_going(F &f, V &v, int) -> decltype(static_cast<bool>(f(v))) {
+    return static_cast<bool>(f(v));
+}
+
+template<class F, class V>
+bool keep_going(F &f, V &v, long) {
+    f(v);
+    return true;
+}
+
+template<class F, class V>
+bool keep_going(F &f, V &v) { return keep_going(f, v, 0); }
+
+// the block of Policy::inline_nodes slots a node pool draws from first,
+// which this holds on to unless there is none
+template<bool Enabled, class Block>
+struct inline_block_ref {
+    Block *block = nullptr;
+    Block *inlineBlock() const { return block; }
+    void setInlineBlock(Block *b) { block = b; }
+};
+
+template<class Block>
+struct inline_block_ref<false, Block> {
+    Block *inlineBlock() const { return nullptr; }
+    void setInlineBlock(Block *) {}
+};
+
+template<class Policy>
+struct generation_checks : std::is_same<typename Policy::iterator_checks, generation_checked_iterators> {};
+
+// The counters behind map::stats(), which do nothing unless statistics are
+// on. They are relaxed atomics: const lookups may run on many threads at
+// once (concurrent_map), and parallel.hpp works on one map from several.
+template<bool Enabled>
+struct map_counters {
+    void compared() const {}
+    void rotated() {}
+    void allocated(size_t) {}
+    void freed(size_t) {}
+    void rebalanced() {}
+    void looked_up(size_t) const {}
+    map_stats snapshot() const { return map_stats(); }
+    void reset() {}
+};
+
+template<>
+struct map_counters<true> {
+    mutable std::atomic<size_t> comparisons{0};
+    std::atomic<size_t> rotations{0};
+    std::atomic<size_t> nodes_allocated{0};
+    std::atomic<size_t> nodes_freed{0};
+    std::atomic<size_t> rebalance_steps{0};
+    mutable std::atomic<size_t> lookups{0};
+    mutable std::atomic<size_t> total_lookup_depth{0};
+    mutable std::atomic<size_t> max_lookup_depth{0};
+
+    void compared() const { comparisons.fetch_add(1, std::memory_order_relaxed); }
+    void rotated() { rotations.fetch_add(1, std::memory_order_relaxed); }
+    void allocated(size_t n) { nodes_allocated.fetch_add(n, std::memory_order_relaxed); }
+    void freed(size_t n) { nodes_freed.fetch_add(n, std::memory_order_relaxed); }
+    void rebalanced() { rebalance_steps.fetch_add(1, std::memory_order_relaxed); }
+    void looked_up(size_t depth) const {
+        lookups.fetch_add(1, std::memory_order_relaxed);
+        total_lookup_depth.fetch_add(depth, std::memory_order_relaxed);
+        size_t seen = max_lookup_depth.load(std::memory_order_relaxed);
+        while (seen < depth && !max_lookup_depth.compare_exchange_weak(seen, depth, std::memory_order_relaxed)) {}
+    }
+
+    map_stats snapshot() const {
+        map_stats s;
+        s.comparisons = comparisons.load(std::memory_order_relaxed);
+        s.rotations = rotations.load(std::memory_order_relaxed);
+        s.nodes_allocated = nodes_allocated.load(std::memory_order_relaxed);
+        s.nodes_freed = nodes_freed.load(std::memory_order_relaxed);
+        s.rebalance_steps = rebalance_steps.load(std::memory_order_relaxed);
+        s.lookups = lookups.load(std::memory_order_relaxed);
+        s.total_lookup_depth = total_lookup_depth.load(std::memory_order_relaxed);
+        s.max_lookup_depth = max_lookup_depth.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    void reset() {
+        for (std::atomic<size_t> *c : {&comparisons, &rotations, &nodes_allocated, &nodes_freed, &rebalance_steps,
+                                       &lookups, &total_lookup_depth, &max_lookup_depth})
+            c->store(0, std::memory_order_relaxed);
+    }
+};
+}
+
 template<
    class Key,
    class T,
-   class Compare = std::less <Key>
+   class Compare = std::less <Key>,
+   class Policy = map_policy
    > class map {
+   template<class Map>
+   friend struct detail::parallel_ops;
   public:
    /**
   * the internal type of data.
@@ -33,11 +284,21 @@ template<
     */
   class const_iterator;
   struct Node; // forward declaration of internal node
-  class iterator {
+  struct ValueNode;
+  struct NodeSlots;
+  class iterator : public detail::iterator_stamp<detail::generation_checks<Policy>::value> {
+      public:
+      typedef std::bidirectional_iterator_tag iterator_category;
+      typedef typename map::value_type value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef value_type *pointer;
+      typedef value_type &reference;
       private:
-      // Iterator holds a pointer to node and owning container for validity checks
+      // Iterator holds a pointer to node and the header sentinel of the owning
+      // container for validity checks; the header travels with the elements
+      // when the map is moved or swapped, so the iterator follows them
       Node *nodePtr = nullptr;
-      const map *owner = nullptr;
+      Node *owner = nullptr;
       public:
       friend class map;
       iterator() = default;
@@ -45,7 +306,7 @@ template<
       iterator(const iterator &other) = default;
 
       // internal constructor
-      iterator(struct Node *p, const map *o) : nodePtr(p), owner(o) {}
+      iterator(struct Node *p, const map *o) : nodePtr(p), owner(o->endNode()) { restamp(*this); }
 
       // iter++
       iterator operator++(int) {
@@ -56,12 +317,11 @@ template<
 
       // ++iter
       iterator &operator++() {
-          if (owner == nullptr) throw invalid_iterator();
-          if (nodePtr == nullptr) throw invalid_iterator();
-          nodePtr = owner->nextNode(nodePtr);
-          if (nodePtr == nullptr) {
-              // incrementing the last element should yield end(); allowed
-          }
+          checkStep(*this);
+          Node *next = stepForward(nodePtr, owner);
+          checkLanding(next);
+          nodePtr = next;
+          restamp(*this);
           return *this;
       }
 
@@ -74,23 +334,18 @@ template<
 
       // --iter
       iterator &operator--() {
-          if (owner == nullptr) throw invalid_iterator();
-          if (nodePtr == nullptr) {
-              // --end() should move to the last element if exists
-              nodePtr = owner->maxNode(owner->root);
-              if (nodePtr == nullptr) throw invalid_iterator();
-              return *this;
-          }
-          struct Node *prev = owner->prevNode(nodePtr);
-          if (prev == nullptr) throw invalid_iterator();
+          checkStep(*this);
+          Node *prev = stepBackward(nodePtr, owner);
+          checkLanding(prev);
           nodePtr = prev;
+          restamp(*this);
           return *this;
       }
 
       // dereference
       value_type &operator*() const {
-          if (nodePtr == nullptr) throw invalid_iterator();
-          return nodePtr->value;
+          checkTarget(*this);
+          return valueOf(nodePtr);
       }
 
       bool operator==(const iterator &rhs) const {
@@ -109,26 +364,34 @@ template<
           return &(operator*());
       }
    };
-   class const_iterator {
+   class const_iterator : public detail::iterator_stamp<detail::generation_checks<Policy>::value> {
        // it should has similar member method as iterator.
        //  and it should be able to construct from an iterator.
+      public:
+      typedef std::bidirectional_iterator_tag iterator_category;
+      typedef typename map::value_type value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef const value_type *pointer;
+      typedef const value_type &reference;
       private:
       Node *nodePtr = nullptr;
-      const map *owner = nullptr;
+      Node *owner = nullptr;
       public:
       friend class map;
       const_iterator() = default;
 
       const_iterator(const const_iterator &other) = default;
 
-      const_iterator(const iterator &other) : nodePtr(other.nodePtr), owner(other.owner) {}
+      const_iterator(const iterator &other)
+          : detail::iterator_stamp<detail::generation_checks<Policy>::value>(other), nodePtr(other.nodePtr),
+            owner(other.owner) {}
 
       // internal constructor
-      const_iterator(struct Node *p, const map *o) : nodePtr(p), owner(o) {}
+      const_iterator(struct Node *p, const map *o) : nodePtr(p), owner(o->endNode()) { restamp(*this); }
 
       const value_type &operator*() const {
-          if (nodePtr == nullptr) throw invalid_iterator();
-          return nodePtr->value;
+          checkTarget(*this);
+          return valueOf(nodePtr);
       }
 
       const value_type *operator->() const noexcept { return &(operator*()); }
@@ -140,9 +403,11 @@ template<
       }
 
       const_iterator &operator++() {
-          if (owner == nullptr) throw invalid_iterator();
-          if (nodePtr == nullptr) throw invalid_iterator();
-          nodePtr = owner->nextNode(nodePtr);
+          checkStep(*this);
+          Node *next = stepForward(nodePtr, owner);
+          checkLanding(next);
+          nodePtr = next;
+          restamp(*this);
           return *this;
       }
 
@@ -153,15 +418,11 @@ template<
       }
 
       const_iterator &operator--() {
-          if (owner == nullptr) throw invalid_iterator();
-          if (nodePtr == nullptr) {
-              nodePtr = owner->maxNode(owner->root);
-              if (nodePtr == nullptr) throw invalid_iterator();
-              return *this;
-          }
-          struct Node *prev = owner->prevNode(nodePtr);
-          if (prev == nullptr) throw invalid_iterator();
+          checkStep(*this);
+          Node *prev = stepBackward(nodePtr, owner);
+          checkLanding(prev);
           nodePtr = prev;
+          restamp(*this);
           return *this;
       }
 
@@ -178,14 +439,73 @@ template<
 
   // no out-of-class iterator cross-operators
 
+  typedef std::reverse_iterator<iterator> reverse_iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
    /**
   * TODO two constructors
     */
-  map() : root(nullptr), nodeCount(0), cmp(Compare()) {}
+  map() : root(nullptr), head(newHead()), nodeCount(0), cmp(Compare()), pool(head) {}
+
+  map(const map &other) : root(nullptr), head(newHead()), nodeCount(0), cmp(other.cmp), pool(head) {
+      try {
+          root = cloneTree(other.root, other.size(), pool);
+      } catch (...) {
+          deleteHead(head);
+          throw;
+      }
+      nodeCount = other.size();
+      counters.allocated(nodeCount);
+      refreshHeader();
+  }
+
+   /**
+  * takes over the elements of other in constant time; iterators into other
+  * keep pointing at the same elements, which now belong to this map
+  * (end() of other is not carried over). other is left empty.
+    */
+  map(map &&other) noexcept(std::is_nothrow_move_constructible<Compare>::value)
+      : root(other.root), head(other.head), nodeCount(other.nodeCount), cmp(std::move(other.cmp)),
+        pool(std::move(other.pool)) {
+      other.root = nullptr;
+      other.head = nullptr;
+      other.nodeCount = 0;
+      countStale = other.countStale;
+      other.countStale = false;
+  }
+
+   /**
+  * builds the map from the elements of [first, last).
+  * A range sorted by key (equal keys allowed, the first of them wins) is
+  *   turned into a balanced tree in O(n) without a single rotation; as soon
+  *   as the range turns out not to be sorted, the rest is inserted one by one.
+    */
+  template<class InputIterator>
+  map(InputIterator first, InputIterator last) : root(nullptr), head(newHead()), nodeCount(0), cmp(Compare()), pool(head) {
+      try {
+          buildFrom(first, last);
+      } catch (...) {
+          destroySubtree(root);
+          deleteHead(head);
+          throw;
+      }
+  }
+
+   /**
+  * copies the elements of a flat_map, which come sorted already, in O(n)
+    */
+  explicit map(const flat_map<Key, T, Compare> &table) : map(table.cbegin(), table.cend()) {}
 
-  map(const map &other) : root(nullptr), nodeCount(0), cmp(other.cmp) {
-      root = cloneSubtree(other.root, nullptr);
-      nodeCount = other.nodeCount;
+   /**
+  * replaces the contents with the elements of [first, last), see above.
+  * If building throws, the map is left unchanged.
+    */
+  template<class InputIterator>
+  void assign(InputIterator first, InputIterator last) {
+      map built;
+      built.cmp = cmp;
+      built.buildFrom(first, last);
+      swap(built);
   }
 
    /**
@@ -195,15 +515,43 @@ template<
       if (this == &other) return *this;
       clear();
       cmp = other.cmp;
-      root = cloneSubtree(other.root, nullptr);
-      nodeCount = other.nodeCount;
+      root = cloneTree(other.root, other.size(), pool);
+      nodeCount = other.size();
+      counters.allocated(nodeCount);
+      refreshHeader();
+      return *this;
+  }
+
+  map &operator=(map &&other) noexcept(std::is_nothrow_move_constructible<Compare>::value &&
+                                       std::is_nothrow_move_assignable<Compare>::value) {
+      if (this == &other) return *this;
+      clear();
+      swap(other);
       return *this;
   }
 
+   /**
+  * exchanges the contents of two maps in constant time; iterators stay
+  * with their elements
+    */
+  void swap(map &other) noexcept(std::is_nothrow_move_constructible<Compare>::value &&
+                                 std::is_nothrow_move_assignable<Compare>::value) {
+      using std::swap;
+      swap(root, other.root);
+      swap(head, other.head);
+      swap(nodeCount, other.nodeCount);
+      swap(countStale, other.countStale);
+      swap(cmp, other.cmp);
+      pool.swap(other.pool);
+  }
+
    /**
   * TODO Destructors
     */
-  ~map() { clear(); }
+  ~map() {
+      dropAll();
+      deleteHead(head);
+  }
 
    /**
   * TODO
@@ -214,13 +562,40 @@ template<
   T &at(const Key &key) {
       Node *n = findNode(key);
       if (n == nullptr) throw index_out_of_bound();
-      return n->value.second;
+      return valueOf(n).second;
   }
 
   const T &at(const Key &key) const {
       Node *n = findNode(key);
       if (n == nullptr) throw index_out_of_bound();
-      return n->value.second;
+      return valueOf(n).second;
+  }
+
+   /**
+  * lookups that never throw: a pointer to the value of key (nullptr if
+  *   absent), whether key is present (its value copied to out if so), and
+  *   the value of key or fallback
+    */
+  T *find_ptr(const Key &key) {
+      Node *n = findNode(key);
+      return n ? &valueOf(n).second : nullptr;
+  }
+
+  const T *find_ptr(const Key &key) const {
+      Node *n = findNode(key);
+      return n ? &valueOf(n).second : nullptr;
+  }
+
+  bool try_at(const Key &key, T &out) const {
+      const T *found = find_ptr(key);
+      if (found == nullptr) return false;
+      out = *found;
+      return true;
+  }
+
+  T get_or(const Key &key, const T &fallback) const {
+      const T *found = find_ptr(key);
+      return found ? *found : fallback;
   }
 
    /**
@@ -229,13 +604,9 @@ template<
   * Returns a reference to the value that is mapped to a key equivalent to key,
   *   performing an insertion if such key does not already exist.
     */
-  T &operator[](const Key &key) {
-      Node *n = findNode(key);
-      if (n) return n->value.second;
-      value_type v(key, T());
-      auto res = insert(v);
-      return (*res.first).second;
-  }
+  T &operator[](const Key &key) { return try_emplace(key).first->second; }
+
+  T &operator[](Key &&key) { return try_emplace(std::move(key)).first->second; }
 
    /**
   * behave like at() throw index_out_of_bound if such key does not exist.
@@ -243,42 +614,91 @@ template<
   const T &operator[](const Key &key) const {
       Node *n = findNode(key);
       if (n == nullptr) throw index_out_of_bound();
-      return n->value.second;
+      return valueOf(n).second;
   }
 
    /**
   * return a iterator to the beginning
     */
-  iterator begin() { return iterator(minNode(root), this); }
+  iterator begin() { return iterator(endNode()->left, this); }
 
-  const_iterator cbegin() const { return const_iterator(minNode(root), this); }
+  const_iterator cbegin() const { return const_iterator(endNode()->left, this); }
 
    /**
   * return a iterator to the end
   * in fact, it returns past-the-end.
     */
-  iterator end() { return iterator(nullptr, this); }
+  iterator end() { return iterator(endNode(), this); }
+
+  const_iterator cend() const { return const_iterator(endNode(), this); }
+
+   /**
+  * iterators over the elements from the last to the first
+    */
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+
+  const_reverse_iterator crbegin() const { return const_reverse_iterator(cend()); }
+
+  const_reverse_iterator crend() const { return const_reverse_iterator(cbegin()); }
+
+   /**
+  * calls fn(value_type &) on every element in key order.
+  * If fn returns something convertible to bool, a false result stops the
+  *   walk; for_each returns whether it got through all elements.
+  * The walk keeps its path in a stack of its own instead of climbing parent
+  *   links, and does no iterator checks, so it is a tight loop. fn must not
+  *   insert or erase elements.
+    */
+  template<class F>
+  bool for_each(F fn) { return visitRange<value_type>(nullptr, nullptr, fn); }
+
+  template<class F>
+  bool for_each(F fn) const { return visitRange<const value_type>(nullptr, nullptr, fn); }
+
+   /**
+  * the same for the elements whose keys lie in [lo, hi), which is empty
+  *   unless lo < hi
+    */
+  template<class F>
+  bool for_each_range(const Key &lo, const Key &hi, F fn) {
+      if (!keyLess(lo, hi)) return true;
+      return visitRange<value_type>(&lo, lowerBoundNode(hi), fn);
+  }
 
-  const_iterator cend() const { return const_iterator(nullptr, this); }
+  template<class F>
+  bool for_each_range(const Key &lo, const Key &hi, F fn) const {
+      if (!keyLess(lo, hi)) return true;
+      return visitRange<const value_type>(&lo, lowerBoundNode(hi), fn);
+  }
 
    /**
   * checks whether the container is empty
   * return true if empty, otherwise false.
     */
-  bool empty() const { return nodeCount == 0; }
+  bool empty() const { return root == nullptr; }
 
    /**
   * returns the number of elements.
     */
-  size_t size() const { return nodeCount; }
+  size_t size() const {
+      if (countStale) {
+          nodeCount = countNodes();
+          countStale = false;
+      }
+      return nodeCount;
+  }
 
    /**
   * clears the contents
     */
   void clear() {
-      destroySubtree(root);
+      dropAll();
       root = nullptr;
       nodeCount = 0;
+      countStale = false;
+      refreshHeader();
   }
 
    /**
@@ -287,49 +707,169 @@ template<
   *   the iterator to the new element (or the element that prevented the insertion),
   *   the second one is true if insert successfully, or false.
     */
-  pair<iterator, bool> insert(const value_type &value) {
-      // If exists, return iterator
-      Node *cur = root;
+  pair<iterator, bool> insert(const value_type &value) { return insertValue(value); }
+
+  pair<iterator, bool> insert(value_type &&value) { return insertValue(std::move(value)); }
+
+   /**
+  * construct an element in place from args, like insert(value_type(args...)).
+  * The node is built first so that its key can be compared; it is dropped
+  *   again if an equivalent key is already present.
+    */
+  template<class... Args>
+  pair<iterator, bool> emplace(Args &&...args) {
+      Node *node = createNode(nullptr, std::forward<Args>(args)...);
       Node *parent = nullptr;
       bool isLeft = false;
-      while (cur) {
-          if (keyEq(value.first, cur->value.first)) {
-              return pair<iterator, bool>(iterator(cur, this), false);
-          }
-          parent = cur;
-          if (cmp(value.first, cur->value.first)) {
-              cur = cur->left;
-              isLeft = true;
-          } else {
-              cur = cur->right;
-              isLeft = false;
-          }
+      Node *cur;
+      try {
+          cur = findSlot(keyOf(node), parent, isLeft);
+      } catch (...) {
+          destroyNode(node);
+          throw;
       }
-      Node *node = new Node(value, parent);
-      if (parent == nullptr) {
-          root = node;
-      } else if (isLeft) {
-          parent->left = node;
-      } else {
-          parent->right = node;
+      if (cur) {
+          destroyNode(node);
+          return pair<iterator, bool>(iterator(cur, this), false);
       }
-      ++nodeCount;
-      rebalanceUp(parent);
+      linkNode(node, parent, isLeft);
       return pair<iterator, bool>(iterator(node, this), true);
   }
 
+   /**
+  * if key is absent, insert value_type(key, T(args...)) built in place;
+  *   otherwise do nothing, and in particular leave args untouched.
+    */
+  template<class... Args>
+  pair<iterator, bool> try_emplace(const Key &key, Args &&...args) {
+      return tryEmplaceKey(key, std::forward<Args>(args)...);
+  }
+
+  template<class... Args>
+  pair<iterator, bool> try_emplace(Key &&key, Args &&...args) {
+      return tryEmplaceKey(std::move(key), std::forward<Args>(args)...);
+  }
+
+   /**
+  * insert with a position hint.
+  * If the element belongs right before (or right after) hint, it is linked
+  *   there with a constant number of comparisons; otherwise this falls back
+  *   to an ordinary insert. Returns the iterator to the new element, or to
+  *   the element that prevented the insertion.
+  * throw invalid_iterator if hint does not belong to this map.
+    */
+  iterator insert(const_iterator hint, const value_type &value) { return insertHinted(hint, value); }
+
+  iterator insert(const_iterator hint, value_type &&value) { return insertHinted(hint, std::move(value)); }
+
+  template<class... Args>
+  iterator emplace_hint(const_iterator hint, Args &&...args) {
+      if (hint.owner != endNode()) throw invalid_iterator();
+      Node *node = createNode(nullptr, std::forward<Args>(args)...);
+      Node *parent = nullptr;
+      bool isLeft = false;
+      Node *cur;
+      try {
+          cur = findHintSlot(hint.nodePtr, keyOf(node), parent, isLeft);
+      } catch (...) {
+          destroyNode(node);
+          throw;
+      }
+      if (cur) {
+          destroyNode(node);
+          return iterator(cur, this);
+      }
+      linkNode(node, parent, isLeft);
+      return iterator(node, this);
+  }
+
    /**
   * erase the element at pos.
   *
   * throw if pos pointed to a bad element (pos == this->end() || pos points an element out of this)
     */
   void erase(iterator pos) {
-      if (pos.owner != this) throw invalid_iterator();
+      if (pos.owner == nullptr || pos.owner != head) throw invalid_iterator();
       Node *target = pos.nodePtr;
-      if (target == nullptr) throw invalid_iterator();
+      if (target == nullptr || target == head) throw invalid_iterator();
+      checkStamp(pos, Generations());
       eraseNode(target);
   }
 
+   /**
+  * erases the element with key, if any; returns how many were erased (0 or 1)
+    */
+  size_t erase(const Key &key) { return eraseKey(key); }
+
+   /**
+  * the same for any key type a transparent Compare accepts (not iterators)
+    */
+  template<class K>
+  typename transparent_lookup<Compare, K, size_t>::type erase(const K &key) {
+      static_assert(!std::is_convertible<K, iterator>::value && !std::is_convertible<K, const_iterator>::value,
+                    "erase(key) with an iterator; use erase(iterator)");
+      return eraseEquivalent(key);
+  }
+
+   /**
+  * erases every element for which pred(element) is true and returns how many
+  *   that were. It takes one in-order pass, and the survivors are relinked
+  *   into a balanced tree once at the end instead of rebalancing after every
+  *   erase, so it costs O(n) however many elements go. Iterators to the
+  *   survivors stay valid.
+  * If pred throws, the elements it was not asked about yet are kept.
+    */
+  template<class Predicate>
+  size_t erase_if(Predicate pred) { return eraseIf(pred); }
+
+   /**
+  * an element taken out of the map by extract(), see node_type below
+    */
+  class node_type;
+  struct insert_return_type;
+
+   /**
+  * unlinks the element at pos and hands it over in a node handle, without
+  *   copying or destroying it; pos is invalidated.
+  * throw invalid_iterator if pos is end() or does not belong to this map.
+    */
+  node_type extract(const_iterator pos) {
+      if (pos.owner == nullptr || pos.owner != head) throw invalid_iterator();
+      Node *target = pos.nodePtr;
+      if (target == nullptr || target == head) throw invalid_iterator();
+      checkStamp(pos, Generations());
+      return extractNode(target);
+  }
+
+   /**
+  * the same for the element with key; the handle is empty if there is none
+    */
+  node_type extract(const Key &key) {
+      Node *n = findNode(key);
+      if (n == nullptr) return node_type();
+      return extractNode(n);
+  }
+
+   /**
+  * links the element of nh in, reusing its node, unless its key is present
+  *   already; then nh is handed back in the result instead.
+  * The node's storage stays with the pool of the map it came from, so from
+  *   then on the two maps share their arenas as after merge().
+    */
+  insert_return_type insert(node_type &&nh) {
+      if (nh.empty()) return insert_return_type{end(), false, node_type()};
+      Node *parent = nullptr;
+      bool isLeft = false;
+      Node *cur = findSlot(keyOf(nh.node), parent, isLeft);
+      if (cur) return insert_return_type{iterator(cur, this), false, std::move(nh)};
+      pool.share(nh.pool);
+      Node *n = nh.release();
+      n->left = n->right = nullptr;
+      update(n);
+      linkNode(n, parent, isLeft);
+      return insert_return_type{iterator(n, this), true, node_type()};
+  }
+
    /**
   * Returns the number of elements with key
   *   that compares equivalent to the specified argument,
@@ -339,191 +879,2251 @@ template<
     */
   size_t count(const Key &key) const { return findNode(key) ? 1 : 0; }
 
+  template<class K>
+  typename transparent_lookup<Compare, K, size_t>::type count(const K &key) const {
+      return countBetween(lowerBoundNode(key), upperBoundNode(key));
+  }
+
    /**
   * Finds an element with key equivalent to key.
   * key value of the element to search for.
   * Iterator to an element with key equivalent to key.
   *   If no such element is found, past-the-end (see end()) iterator is returned.
     */
-  iterator find(const Key &key) { return iterator(findNode(key), this); }
+  iterator find(const Key &key) { return iterator(orEnd(findNode(key)), this); }
 
-  const_iterator find(const Key &key) const { return const_iterator(findNode(key), this); }
-  private:
-   Node *root;
-   size_t nodeCount;
-   Compare cmp;
+  const_iterator find(const Key &key) const { return const_iterator(orEnd(findNode(key)), this); }
 
-   // helpers
-   bool keyEq(const Key &a, const Key &b) const;
-   Node *findNode(const Key &key) const;
-   Node *minNode(Node *x) const;
-   Node *maxNode(Node *x) const;
-   Node *nextNode(Node *n) const;
-   Node *prevNode(Node *n) const;
-   int heightOf(Node *n) const;
-   void update(Node *n);
-   int balance(Node *n) const;
-   void attachToParent(Node *parent, Node *child, bool asLeft);
-   Node *rotateLeft(Node *x);
-   Node *rotateRight(Node *y);
-   void rebalanceAt(Node *n);
-   void rebalanceUp(Node *start);
-   void destroySubtree(Node *n);
-   Node *cloneSubtree(Node *n, Node *parent);
-   void transplant(Node *u, Node *v);
-   void eraseNode(Node *z);
-};
+   /**
+  * find, count, lower_bound, upper_bound, equal_range and erase(key) also
+  *   take a key of any type K if Compare is transparent (see
+  *   transparent_lookup), e.g. a const char * for a map<std::string, T, std::less<>>
+  * Such a key may be equivalent to several elements, like std::map's:
+  *   count, equal_range and erase(key) then cover all of them, and find
+  *   returns one of them.
+    */
+  template<class K>
+  typename transparent_lookup<Compare, K, iterator>::type find(const K &key) {
+      return iterator(orEnd(findNode(key)), this);
+  }
 
-// =================== Implementation details (private) ===================
-template<class Key, class T, class Compare>
-class map<Key, T, Compare>::Node {
-  public:
-    value_type value;
-    Node *left;
-    Node *right;
-    Node *parent;
-    int height;
-    explicit Node(const value_type &v, Node *p) : value(v), left(nullptr), right(nullptr), parent(p), height(1) {}
-};
+  template<class K>
+  typename transparent_lookup<Compare, K, const_iterator>::type find(const K &key) const {
+      return const_iterator(orEnd(findNode(key)), this);
+  }
 
-template<class Key, class T, class Compare>
-typename map<Key, T, Compare>::Node *
-map<Key, T, Compare>::minNode(Node *x) const {
-    if (x == nullptr) return nullptr;
-    while (x->left) x = x->left;
-    return x;
-}
+   /**
+  * looks up every key of [first, last), a forward range of Key lvalues, and
+  *   writes find(key) for each of them to out, in input order; returns out
+  *   past the last iterator written.
+  * The keys are taken in groups whose descents advance together one level
+  *   at a time, with the next nodes prefetched, so the cache misses of the
+  *   group overlap instead of following each other. A group that comes
+  *   sorted walks the part of the path its keys share only once.
+    */
+  template<class ForwardIt, class OutputIt>
+  OutputIt find_many(ForwardIt first, ForwardIt last, OutputIt out) {
+      findBatch(first, last, [this, &out](Node *n) { *out++ = iterator(orEnd(n), this); });
+      return out;
+  }
 
-template<class Key, class T, class Compare>
-typename map<Key, T, Compare>::Node *
-map<Key, T, Compare>::maxNode(Node *x) const {
-    if (x == nullptr) return nullptr;
-    while (x->right) x = x->right;
-    return x;
-}
+  template<class ForwardIt, class OutputIt>
+  OutputIt find_many(ForwardIt first, ForwardIt last, OutputIt out) const {
+      findBatch(first, last, [this, &out](Node *n) { *out++ = const_iterator(orEnd(n), this); });
+      return out;
+  }
 
-template<class Key, class T, class Compare>
-bool map<Key, T, Compare>::keyEq(const Key &a, const Key &b) const {
-    return !cmp(a, b) && !cmp(b, a);
-}
+   /**
+  * the number of keys of [first, last) that are present, looked up like find_many
+    */
+  template<class ForwardIt>
+  size_t count_many(ForwardIt first, ForwardIt last) const {
+      size_t found = 0;
+      findBatch(first, last, [&found](Node *n) { found += n != nullptr; });
+      return found;
+  }
 
-template<class Key, class T, class Compare>
-typename map<Key, T, Compare>::Node *
-map<Key, T, Compare>::findNode(const Key &key) const {
-    Node *cur = root;
-    while (cur) {
-        if (keyEq(key, cur->value.first)) return cur;
-        if (cmp(key, cur->value.first)) cur = cur->left; else cur = cur->right;
-    }
-    return nullptr;
-}
+   /**
+  * returns an iterator to the first element whose key is not less than key,
+  *   or end() if there is none.
+    */
+  iterator lower_bound(const Key &key) { return iterator(orEnd(lowerBoundNode(key)), this); }
 
-template<class Key, class T, class Compare>
-int map<Key, T, Compare>::heightOf(Node *n) const { return n ? n->height : 0; }
+  const_iterator lower_bound(const Key &key) const { return const_iterator(orEnd(lowerBoundNode(key)), this); }
 
-template<class Key, class T, class Compare>
-void map<Key, T, Compare>::update(Node *n) {
-    if (!n) return;
-    int hl = heightOf(n->left);
-    int hr = heightOf(n->right);
-    n->height = (hl > hr ? hl : hr) + 1;
-}
+  template<class K>
+  typename transparent_lookup<Compare, K, iterator>::type lower_bound(const K &key) {
+      return iterator(orEnd(lowerBoundNode(key)), this);
+  }
 
-template<class Key, class T, class Compare>
-int map<Key, T, Compare>::balance(Node *n) const {
-    return heightOf(n->right) - heightOf(n->left);
-}
+  template<class K>
+  typename transparent_lookup<Compare, K, const_iterator>::type lower_bound(const K &key) const {
+      return const_iterator(orEnd(lowerBoundNode(key)), this);
+  }
 
-template<class Key, class T, class Compare>
-void map<Key, T, Compare>::attachToParent(Node *parent, Node *child, bool asLeft) {
-    if (parent == nullptr) {
-        root = child;
-        if (child) child->parent = nullptr;
-    } else {
-        if (asLeft) parent->left = child; else parent->right = child;
-        if (child) child->parent = parent;
-    }
-}
+   /**
+  * returns an iterator to the first element whose key is greater than key,
+  *   or end() if there is none.
+    */
+  iterator upper_bound(const Key &key) { return iterator(orEnd(upperBoundNode(key)), this); }
 
-template<class Key, class T, class Compare>
-typename map<Key, T, Compare>::Node *
-map<Key, T, Compare>::rotateLeft(Node *x) {
-    Node *y = x->right;
-    Node *B = y->left;
-    y->left = x;
-    x->right = B;
-    if (B) B->parent = x;
-    Node *p = x->parent;
-    y->parent = p;
-    x->parent = y;
-    if (p == nullptr) root = y; else if (p->left == x) p->left = y; else p->right = y;
-    update(x);
-    update(y);
-    return y;
+  const_iterator upper_bound(const Key &key) const { return const_iterator(orEnd(upperBoundNode(key)), this); }
+
+  template<class K>
+  typename transparent_lookup<Compare, K, iterator>::type upper_bound(const K &key) {
+      return iterator(orEnd(upperBoundNode(key)), this);
+  }
+
+  template<class K>
+  typename transparent_lookup<Compare, K, const_iterator>::type upper_bound(const K &key) const {
+      return const_iterator(orEnd(upperBoundNode(key)), this);
+  }
+
+   /**
+  * returns the range of elements with key equivalent to key,
+  *   i.e. pair(lower_bound(key), upper_bound(key)); it holds at most one element.
+    */
+  pair<iterator, iterator> equal_range(const Key &key) { return equalRange<iterator>(key); }
+
+  pair<const_iterator, const_iterator> equal_range(const Key &key) const { return equalRange<const_iterator>(key); }
+
+  template<class K>
+  typename transparent_lookup<Compare, K, pair<iterator, iterator> >::type equal_range(const K &key) {
+      return pair<iterator, iterator>(lower_bound(key), upper_bound(key));
+  }
+
+  template<class K>
+  typename transparent_lookup<Compare, K, pair<const_iterator, const_iterator> >::type equal_range(const K &key) const {
+      return pair<const_iterator, const_iterator>(lower_bound(key), upper_bound(key));
+  }
+
+   /**
+  * erase every element in [first, last) and return last.
+  * The range is cut out of the tree with two splits and the remainder is
+  *   joined back together, so the cost is O(log n) plus the elements removed.
+  *
+  * throw invalid_iterator if either end belongs to another map
+  *   or first comes after last.
+    */
+  iterator erase(const_iterator first, const_iterator last) {
+      if (first.owner != endNode() || last.owner != head) throw invalid_iterator();
+      if (first.nodePtr == last.nodePtr) return iterator(last.nodePtr, this);
+      if (first.nodePtr == head) throw invalid_iterator();
+      Node *stop = last.nodePtr == head ? nullptr : last.nodePtr;
+      if (stop && keyLess(keyOf(stop), keyOf(first.nodePtr))) throw invalid_iterator();
+      eraseRange(first.nodePtr, stop);
+      return iterator(last.nodePtr, this);
+  }
+
+   /**
+  * split, join and merge relink nodes between maps instead of copying them.
+  * Elements keep their addresses, but iterators to elements that change maps
+  *   have to be obtained again. From then on the maps involved share one node
+  *   arena, so they must not be modified concurrently.
+  *
+  * split(key) moves every element whose key is not below key into the
+  *   returned map in O(log n). Unless Policy::order_statistics is set, the
+  *   sizes of both maps are unknown afterwards and the next size() counts.
+    */
+  map split(const Key &key) {
+      map upper;
+      upper.cmp = cmp;
+      Node *x = lowerBoundNode(key);
+      if (x == nullptr) return upper;
+      if (x == head->left) {
+          swap(upper);
+          return upper;
+      }
+      upper.pool.share(pool);
+      Node *lo, *hi;
+      splitAt(x, lo, hi);
+      root = lo;
+      upper.root = hi;
+      refreshHeader();
+      upper.refreshHeader();
+      recountAfterSplit(upper, OrderStatistics());
+      return upper;
+  }
+
+   /**
+  * moves all elements of other into this map in O(log n). The keys of other
+  *   must all lie above, or all below, the keys of this map; otherwise
+  *   runtime_error is thrown and neither map is changed.
+    */
+  void join(map &&other) {
+      if (&other == this || other.root == nullptr) return;
+      if (root == nullptr) {
+          swap(other);
+          return;
+      }
+      Node *lo, *hi;
+      if (keyLess(keyOf(head->right), keyOf(other.head->left))) {
+          lo = root;
+          hi = other.root;
+      } else if (keyLess(keyOf(other.head->right), keyOf(head->left))) {
+          lo = other.root;
+          hi = root;
+      } else {
+          throw runtime_error();
+      }
+      pool.share(other.pool);
+      root = joinTrees(lo, hi);
+      nodeCount += other.nodeCount;
+      countStale = countStale || other.countStale;
+      other.root = nullptr;
+      other.nodeCount = 0;
+      other.countStale = false;
+      refreshHeader();
+      other.refreshHeader();
+  }
+
+   /**
+  * moves every element of source whose key is not present here yet into this
+  *   map; the others stay in source. Key-disjoint maps are joined in O(log n),
+  *   interleaved ones take O(m log(n / m + 1)) for sizes m <= n.
+  * The comparator must not throw.
+    */
+  void merge(map &source) {
+      if (&source == this || source.root == nullptr) return;
+      if (root == nullptr || keyLess(keyOf(head->right), keyOf(source.head->left)) ||
+          keyLess(keyOf(source.head->right), keyOf(head->left))) {
+          join(std::move(source));
+          return;
+      }
+      pool.share(source.pool);
+      Link dups = nullptr;
+      Link *dupTail = &dups;
+      size_t dupCount = 0;
+      root = unionTrees(root, source.root, dupTail, dupCount);
+      int height = 0;
+      for (size_t m = dupCount; m; m >>= 1) ++height;
+      Node *dupList = dups;
+      source.root = buildBalanced(dupList, dupCount, 0, height - 1);
+      nodeCount += source.nodeCount - dupCount;
+      countStale = countStale || source.countStale;
+      source.nodeCount = dupCount;
+      source.countStale = false;
+      refreshHeader();
+      source.refreshHeader();
+  }
+
+  void merge(map &&source) { merge(source); }
+
+   /**
+  * order statistics, available when Policy::order_statistics is set.
+  * nth(k) returns an iterator to the k-th smallest element (from 0) and
+  *   throws index_out_of_bound if k >= size().
+  * rank(key) is the number of elements whose key is less than key.
+  * distance(first, last) is the number of increments from first to last.
+  * All of them run in O(log n).
+    */
+  iterator nth(size_t k) { return iterator(nthNode(k), this); }
+
+  const_iterator nth(size_t k) const { return const_iterator(nthNode(k), this); }
+
+  size_t rank(const Key &key) const {
+      static_assert(Policy::order_statistics, "rank() needs Policy::order_statistics");
+      Node *cur = root;
+      size_t before = 0;
+      while (cur) {
+          if (!keyLess(keyOf(cur), key)) {
+              cur = cur->left;
+          } else {
+              before += sizeOf(cur->left) + 1;
+              cur = cur->right;
+          }
+      }
+      return before;
+  }
+
+  long distance(const_iterator first, const_iterator last) const {
+      if (first.owner != endNode() || last.owner != head) throw invalid_iterator();
+      return (long) positionOf(last.nodePtr) - (long) positionOf(first.nodePtr);
+  }
+
+   /**
+  * what this map has done so far, see map_stats; needs Policy::statistics
+  * to count anything. The counters belong to the map object: they are not
+  * copied, moved or swapped along with the elements.
+    */
+  map_stats stats() const { return counters.snapshot(); }
+
+  void reset_stats() { counters.reset(); }
+  private:
+   /**
+  * slab allocator behind a map.
+  * Nodes are carved out of geometrically growing slabs; a freed node is put
+  * on an intrusive free list and handed out again before a slab is bumped.
+  * The slabs belong to an Arena. split, join and merge move nodes between
+  * maps, so a node may be freed by a map other than the one that allocated
+  * it; share() therefore unites the arenas of the two maps involved. The
+  * absorbed arena hands its storage over and forwards to the survivor
+  * (union-find with reference counts), and pools still pointing at it catch
+  * up on their next access. Maps sharing an arena must not be modified
+  * concurrently.
+  * release() drops every slab in one go, so it may only be called by the
+  * sole user of an arena once the values of all its nodes have been destroyed.
+  * With Policy::inline_nodes the map's header sits in an InlineBlock, and
+  * the pool of that map takes nodes from the block's slots before it creates
+  * an arena at all. Creating the arena (because the block is full or the
+  * pool is shared) lends the block to it along with its spare slots: the
+  * nodes in it may end up in other maps from then on, so the block lives
+  * until both the header and the arena are gone. A pool that gets its
+  * arena to itself again in release() goes back to the block alone.
+    */
+   struct InlineBlock {
+       size_t refs;           // the header in it, plus the arena it is lent to
+       size_t slots;          // length of a compact heap run
+       InlineBlock *nextLent; // the arena's other lent blocks
+       void *freeList;
+       char *bumpCur;
+       char *bumpEnd;
+   };
+
+   class NodePool : private detail::inline_block_ref<(Policy::inline_nodes > 0), InlineBlock> {
+      private:
+      struct Slab {
+          Slab *next;
+          size_t slots; // length of a compact heap run
+      };
+      struct FreeSlot { FreeSlot *next; };
+      static const size_t minSlabNodes = 16;
+      static const size_t maxSlabNodes = 4096;
+
+      struct Arena {
+          Arena *forward = nullptr; // set once absorbed into another arena
+          size_t refs = 1;          // pools and arenas forwarding here
+          Slab *slabs = nullptr;
+          Slab *lastSlab = nullptr;
+          FreeSlot *freeList = nullptr;
+          FreeSlot *lastFree = nullptr;
+          char *bumpCur = nullptr;
+          char *bumpEnd = nullptr;
+          size_t nextSlabNodes = minSlabNodes;
+          InlineBlock *lent = nullptr;
+      };
+
+      Arena *arena = nullptr;
+
+      static size_t roundUp(size_t n, size_t a) { return (n + a - 1) / a * a; }
+      static size_t slotSize() { return slotBytes(); }
+      // compact heap runs are counted in slots, so the header takes whole ones
+      template<class Header = Slab>
+      static size_t headerSize() { return roundUp(sizeof(Header), Policy::compact_nodes ? slotSize() : alignof(ValueNode)); }
+
+      // the arena this pool really uses, created on first use
+      Arena *current() {
+          if (arena == nullptr) {
+              arena = new Arena;
+              if (InlineBlock *b = this->inlineBlock()) lend(arena, b);
+          } else if (arena->forward) {
+              Arena *target = arena->forward;
+              while (target->forward) target = target->forward;
+              ++target->refs;
+              unref(arena);
+              arena = target;
+          }
+          return arena;
+      }
+
+      static void unref(Arena *a) {
+          while (a && --a->refs == 0) {
+              Arena *next = a->forward;
+              freeSlabs(a);
+              delete a;
+              a = next;
+          }
+      }
+
+      static void freeSlabs(Arena *a) {
+          while (a->slabs) {
+              Slab *next = a->slabs->next;
+              freeSlab(a->slabs, CompactNodes());
+              a->slabs = next;
+          }
+          while (a->lent) {
+              InlineBlock *next = a->lent->nextLent;
+              unrefBlock(a->lent);
+              a->lent = next;
+          }
+          a->lastSlab = nullptr;
+          a->freeList = a->lastFree = nullptr;
+          a->bumpCur = a->bumpEnd = nullptr;
+          a->nextSlabNodes = minSlabNodes;
+      }
+
+      static void push(Arena *a, void *p) {
+          FreeSlot *slot = static_cast<FreeSlot *>(p);
+          slot->next = a->freeList;
+          a->freeList = slot;
+          if (a->lastFree == nullptr) a->lastFree = slot;
+      }
+
+      // a slab with room for about nodes nodes (compact heap runs are rounded
+      // to a power of two and capped); nodes is set to the actual number
+      template<class Header = Slab>
+      static Header *newSlab(size_t &nodes, std::false_type) {
+          Header *s = static_cast<Header *>(::operator new(headerSize<Header>() + slotSize() * nodes));
+          s->slots = 0;
+          return s;
+      }
+      template<class Header = Slab>
+      static Header *newSlab(size_t &nodes, std::true_type) {
+          size_t header = headerSize<Header>() / slotSize();
+          size_t slots = nodes + header;
+          Header *s = static_cast<Header *>(NodeSlots::instance().allocate(slots));
+          s->slots = slots;
+          nodes = slots - header;
+          return s;
+      }
+      template<class Header>
+      static void freeSlab(Header *s, std::false_type) { ::operator delete(s); }
+      template<class Header>
+      static void freeSlab(Header *s, std::true_type) { NodeSlots::instance().deallocate(s, s->slots); }
+
+      static InlineBlock *blockOf(void *headSlot) {
+          return reinterpret_cast<InlineBlock *>(static_cast<char *>(headSlot) - headerSize<InlineBlock>());
+      }
+      static void unrefBlock(InlineBlock *b) {
+          if (--b->refs == 0) freeSlab(b, CompactNodes());
+      }
+      // a slot of the block nobody uses, or nullptr
+      static void *take(InlineBlock *b) {
+          if (b->freeList) {
+              FreeSlot *slot = static_cast<FreeSlot *>(b->freeList);
+              b->freeList = slot->next;
+              return slot;
+          }
+          if (b->bumpCur == b->bumpEnd) return nullptr;
+          void *p = b->bumpCur;
+          b->bumpCur += slotSize();
+          return p;
+      }
+      // hands the spare slots of b over to a fresh arena, which keeps b alive
+      static void lend(Arena *a, InlineBlock *b) {
+          ++b->refs;
+          b->nextLent = a->lent;
+          a->lent = b;
+          while (b->freeList) {
+              FreeSlot *slot = static_cast<FreeSlot *>(b->freeList);
+              b->freeList = slot->next;
+              push(a, slot);
+          }
+          a->bumpCur = b->bumpCur;
+          a->bumpEnd = b->bumpEnd;
+          b->bumpCur = b->bumpEnd;
+      }
+
+      static void grow(Arena *a, size_t nodes) {
+          Slab *s = newSlab(nodes, CompactNodes());
+          size_t bytes = headerSize() + slotSize() * nodes;
+          if (Generations::value) {
+              for (char *p = reinterpret_cast<char *>(s) + headerSize(); p != reinterpret_cast<char *>(s) + bytes; p += slotSize())
+                  stampAt(p) = 0;
+          }
+          s->next = a->slabs;
+          a->slabs = s;
+          if (a->lastSlab == nullptr) a->lastSlab = s;
+          a->bumpCur = reinterpret_cast<char *>(s) + headerSize();
+          a->bumpEnd = reinterpret_cast<char *>(s) + bytes;
+      }
+      public:
+      NodePool() = default;
+      // the pool of the map whose header is head, which came from headSlot()
+      explicit NodePool(Node *head) {
+          if (Policy::inline_nodes) this->setInlineBlock(blockOf(head));
+      }
+      NodePool(const NodePool &) = delete;
+      NodePool &operator=(const NodePool &) = delete;
+      NodePool(NodePool &&other) noexcept : arena(other.arena) {
+          other.arena = nullptr;
+          this->setInlineBlock(other.inlineBlock());
+          other.setInlineBlock(nullptr);
+      }
+      ~NodePool() { unref(arena); }
+
+      void swap(NodePool &other) noexcept {
+          std::swap(arena, other.arena);
+          InlineBlock *b = this->inlineBlock();
+          this->setInlineBlock(other.inlineBlock());
+          other.setInlineBlock(b);
+      }
+
+      // Storage for a header followed by Policy::inline_nodes node slots (a
+      // compact heap run may give a few more); freeHeadSlot() drops it again.
+      static void *headSlot() {
+          size_t nodes = Policy::inline_nodes + 1;
+          InlineBlock *b = newSlab<InlineBlock>(nodes, CompactNodes());
+          char *head = reinterpret_cast<char *>(b) + headerSize<InlineBlock>();
+          b->refs = 1;
+          b->nextLent = nullptr;
+          b->freeList = nullptr;
+          b->bumpCur = head + slotSize();
+          b->bumpEnd = head + slotSize() * nodes;
+          if (Generations::value) {
+              for (char *p = b->bumpCur; p != b->bumpEnd; p += slotSize()) stampAt(p) = 0;
+          }
+          return head;
+      }
+      static void freeHeadSlot(void *head) { unrefBlock(blockOf(head)); }
+
+      // raw storage for one Node; the caller constructs it in place
+      void *allocate() {
+          if (arena == nullptr) {
+              if (InlineBlock *b = this->inlineBlock()) {
+                  if (void *p = take(b)) return p;
+              }
+          }
+          Arena *a = current();
+          if (a->freeList) {
+              FreeSlot *slot = a->freeList;
+              a->freeList = slot->next;
+              if (a->freeList == nullptr) a->lastFree = nullptr;
+              return slot;
+          }
+          if (a->bumpCur == a->bumpEnd) {
+              grow(a, a->nextSlabNodes);
+              if (a->nextSlabNodes < maxSlabNodes) a->nextSlabNodes *= 2;
+          }
+          void *p = a->bumpCur;
+          a->bumpCur += slotSize();
+          return p;
+      }
+
+      // Makes sure the next n allocations can be bumped out of one contiguous
+      // slab, so a bulk copy lays its nodes out in the order it creates them
+      // (slots on the free list are still handed out first).
+      // Whatever is left of the current slab stays unused until release().
+      void reserve(size_t n) {
+          InlineBlock *b = this->inlineBlock();
+          if (arena == nullptr && b && static_cast<size_t>(b->bumpEnd - b->bumpCur) >= n * slotSize()) return;
+          Arena *a = current();
+          if (static_cast<size_t>(a->bumpEnd - a->bumpCur) >= n * slotSize()) return;
+          grow(a, n);
+      }
+
+      // storage of an already destroyed Node
+      void deallocate(void *p) {
+          InlineBlock *b = this->inlineBlock();
+          if (arena == nullptr && b) {
+              static_cast<FreeSlot *>(p)->next = static_cast<FreeSlot *>(b->freeList);
+              b->freeList = p;
+              return;
+          }
+          push(current(), p);
+      }
+
+      // whether some other map may own nodes in this pool's slabs
+      bool shared() { return arena != nullptr && current()->refs > 1; }
+
+      // Unites the arenas of the two pools in O(1) plus at most one slab's
+      // worth of spare slots, which are moved to the free list.
+      void share(NodePool &other) {
+          Arena *a = current();
+          Arena *b = other.current();
+          if (a == b) return;
+          if (b->slabs) {
+              b->lastSlab->next = a->slabs;
+              if (a->lastSlab == nullptr) a->lastSlab = b->lastSlab;
+              a->slabs = b->slabs;
+          }
+          if (b->freeList) {
+              b->lastFree->next = a->freeList;
+              if (a->lastFree == nullptr) a->lastFree = b->lastFree;
+              a->freeList = b->freeList;
+          }
+          if (b->bumpEnd - b->bumpCur > a->bumpEnd - a->bumpCur) {
+              std::swap(a->bumpCur, b->bumpCur);
+              std::swap(a->bumpEnd, b->bumpEnd);
+          }
+          for (char *p = b->bumpCur; p != b->bumpEnd; p += slotSize()) push(a, p);
+          if (b->nextSlabNodes > a->nextSlabNodes) a->nextSlabNodes = b->nextSlabNodes;
+          if (b->lent) {
+              InlineBlock *last = b->lent;
+              while (last->nextLent) last = last->nextLent;
+              last->nextLent = a->lent;
+              a->lent = b->lent;
+              b->lent = nullptr;
+          }
+          b->slabs = b->lastSlab = nullptr;
+          b->freeList = b->lastFree = nullptr;
+          b->bumpCur = b->bumpEnd = nullptr;
+          b->forward = a;
+          ++a->refs;
+          other.current();
+      }
+
+      // another reference to the arena of this pool, for a node taken out of
+      // the map; the returned pool frees nothing but that reference
+      NodePool borrow() {
+          NodePool p;
+          p.arena = current();
+          ++p.arena->refs;
+          return p;
+      }
+
+      void release() {
+          InlineBlock *b = this->inlineBlock();
+          if (arena) {
+              Arena *a = current();
+              freeSlabs(a);
+              if (b == nullptr) return;
+              delete a;
+              arena = nullptr;
+          }
+          if (b) {
+              b->freeList = nullptr;
+              b->bumpCur = reinterpret_cast<char *>(b) + headerSize<InlineBlock>() + slotSize();
+          }
+      }
+   };
+
+   Node *root;
+   // end() sentinel; left and right cache the first and last element
+   // (both point back at the header itself while the map is empty).
+   // It lives on the heap so that moves and swaps can hand it over together
+   // with the elements; only a moved-from map has none, and gets a fresh one
+   // from endNode() once it is used again.
+   mutable Node *head;
+   mutable size_t nodeCount;
+   // set when nodeCount may be off after a split; size() recounts then
+   mutable bool countStale = false;
+   Compare cmp;
+   // empty unless statistics are on; declared here to fill the padding after cmp
+   detail::map_counters<Policy::statistics> counters;
+   NodePool pool;
+
+   typedef typename is_three_way_compare<Compare>::type ThreeWay;
+   typedef std::integral_constant<bool, Policy::order_statistics> OrderStatistics;
+   typedef typename Policy::balance Balance;
+   typedef std::integral_constant<bool, Policy::compact_nodes> CompactNodes;
+   typedef typename Policy::iterator_checks IteratorChecks;
+   typedef std::integral_constant<bool, detail::generation_checks<Policy>::value> Generations;
+   // what Node stores for its links, its height and its subtree size
+   typedef typename std::conditional<Policy::compact_nodes, detail::compact_link<Node, NodeSlots>, Node *>::type Link;
+   typedef typename std::conditional<Policy::compact_nodes, signed char, int>::type Height;
+   typedef typename std::conditional<Policy::compact_nodes, std::uint32_t, size_t>::type SubtreeSize;
+
+   // helpers
+   // bytes per pool slot, which holds a ValueNode or, while free, a link;
+   // with generation checks the slot ends in its stamp
+   static constexpr size_t slotAlign() { return alignof(ValueNode) > alignof(void *) ? alignof(ValueNode) : alignof(void *); }
+   static constexpr size_t slotBytes() {
+       return ((sizeof(ValueNode) > sizeof(void *) ? sizeof(ValueNode) : sizeof(void *)) +
+               (Generations::value ? sizeof(size_t) : 0) + slotAlign() - 1) /
+              slotAlign() * slotAlign();
+   }
+   static size_t &stampAt(void *slot) {
+       return *reinterpret_cast<size_t *>(static_cast<char *>(slot) + slotBytes() - sizeof(size_t));
+   }
+   static void bumpStamp(void *, std::false_type) {}
+   static void bumpStamp(void *slot, std::true_type) { ++stampAt(slot); }
+   template<class... Args>
+   Node *createNode(Node *parent, Args &&...args) {
+       Node *n = createNodeIn(pool, parent, std::forward<Args>(args)...);
+       counters.allocated(1);
+       return n;
+   }
+   template<class... Args>
+   static Node *createNodeIn(NodePool &from, Node *parent, Args &&...args);
+   void destroyNode(Node *n);
+   static value_type &valueOf(Node *n) { return static_cast<ValueNode *>(n)->value; }
+   static const Key &keyOf(Node *n) { return valueOf(n).first; }
+   static Node *newHead() {
+       Node *h = Policy::inline_nodes ? ::new (NodePool::headSlot()) Node : newHead(CompactNodes());
+       h->left = h->right = h;
+       return h;
+   }
+   static Node *newHead(std::false_type) { return new Node; }
+   // the header is linked to like any node, so it needs a slot of its own
+   static Node *newHead(std::true_type) {
+       size_t slots = 1;
+       return ::new (NodeSlots::instance().allocate(slots)) Node;
+   }
+   static void deleteHead(Node *h) {
+       if (Policy::inline_nodes == 0) {
+           deleteHead(h, CompactNodes());
+       } else if (h) {
+           h->~Node();
+           NodePool::freeHeadSlot(h);
+       }
+   }
+   static void deleteHead(Node *h, std::false_type) { delete h; }
+   static void deleteHead(Node *h, std::true_type) {
+       if (h == nullptr) return;
+       h->~Node();
+       NodeSlots::instance().deallocate(h, 1);
+   }
+   Node *endNode() const {
+       if (head == nullptr) head = newHead();
+       return head;
+   }
+   Node *orEnd(Node *n) const { return n ? n : endNode(); }
+   void refreshHeader();
+   static Node *stepForward(Node *n, Node *h);
+   static Node *stepBackward(Node *n, Node *h);
+   // iterator checks, as chosen by Policy::iterator_checks
+   template<class It>
+   static void checkStep(const It &it) { checkStep(it, IteratorChecks()); }
+   template<class It>
+   static void checkStep(const It &, unchecked_iterators) {}
+   template<class It>
+   static void checkStep(const It &it, checked_iterators) {
+       if (it.owner == nullptr || it.nodePtr == nullptr) throw invalid_iterator();
+   }
+   template<class It>
+   static void checkStep(const It &it, generation_checked_iterators) {
+       checkStep(it, checked_iterators());
+       checkStamp(it, Generations());
+   }
+   template<class It>
+   static void checkTarget(const It &it) { checkTarget(it, IteratorChecks()); }
+   template<class It>
+   static void checkTarget(const It &, unchecked_iterators) {}
+   template<class It>
+   static void checkTarget(const It &it, checked_iterators) {
+       if (it.nodePtr == nullptr || it.nodePtr == it.owner) throw invalid_iterator();
+   }
+   template<class It>
+   static void checkTarget(const It &it, generation_checked_iterators) {
+       checkTarget(it, checked_iterators());
+       checkStamp(it, Generations());
+   }
+   static void checkLanding(Node *n) { checkLanding(n, IteratorChecks()); }
+   static void checkLanding(Node *, unchecked_iterators) {}
+   template<class Checks>
+   static void checkLanding(Node *n, Checks) {
+       if (n == nullptr) throw invalid_iterator();
+   }
+   // an element that was erased since the iterator reached it has a new stamp
+   template<class It>
+   static void checkStamp(const It &, std::false_type) {}
+   template<class It>
+   static void checkStamp(const It &it, std::true_type) {
+       if (it.nodePtr != it.owner && stampAt(it.nodePtr) != it.stamp) throw invalid_iterator();
+   }
+   template<class It>
+   static void restamp(It &it) { restamp(it, Generations()); }
+   template<class It>
+   static void restamp(It &, std::false_type) {}
+   template<class It>
+   static void restamp(It &it, std::true_type) {
+       it.stamp = it.nodePtr && it.nodePtr != it.owner ? stampAt(it.nodePtr) : 0;
+   }
+   // a and b are Keys unless Compare is transparent
+   template<class A, class B>
+   bool keyLess(const A &a, const B &b) const { return keyLess(a, b, ThreeWay()); }
+   template<class A, class B>
+   bool keyLess(const A &a, const B &b, std::false_type) const { return compareKeys(a, b); }
+   template<class A, class B>
+   bool keyLess(const A &a, const B &b, std::true_type) const { return compareKeys(a, b) < 0; }
+   // every call of cmp goes through here to be counted
+   template<class A, class B>
+   auto compareKeys(const A &a, const B &b) const -> decltype(cmp(a, b)) {
+       counters.compared();
+       return cmp(a, b);
+   }
+   template<class K>
+   Node *findNode(const K &key) const { return findNode(key, ThreeWay()); }
+   template<class K>
+   Node *findNode(const K &key, std::false_type) const;
+   template<class K>
+   Node *findNode(const K &key, std::true_type) const;
+   template<class K>
+   size_t eraseKey(const K &key) {
+       Node *n = findNode(key);
+       if (n == nullptr) return 0;
+       eraseNode(n);
+       return 1;
+   }
+   // the elements a key of another type is equivalent to, which lie
+   // between its bounds; mostly there is one, which erase() takes directly
+   template<class K>
+   size_t eraseEquivalent(const K &key) {
+       Node *lo = lowerBoundNode(key);
+       Node *hi = upperBoundNode(key);
+       size_t n = countBetween(lo, hi);
+       if (n == 1) eraseNode(lo);
+       else if (n > 1) eraseRange(lo, hi);
+       return n;
+   }
+   static size_t countBetween(Node *lo, Node *hi) {
+       size_t n = 0;
+       for (; lo != hi; lo = nextNode(lo)) ++n;
+       return n;
+   }
+   template<class It>
+   pair<It, It> equalRange(const Key &key) const {
+       Node *lo = lowerBoundNode(key);
+       Node *hi = (lo && !keyLess(key, keyOf(lo))) ? nextNode(lo) : lo;
+       return pair<It, It>(It(orEnd(lo), this), It(orEnd(hi), this));
+   }
+   // lookups interleaved per group, see find_many
+   static const size_t find_group = 16;
+   template<class ForwardIt, class Emit>
+   void findBatch(ForwardIt first, ForwardIt last, Emit emit) const;
+   void findGroup(const Key *const *keys, size_t n, bool sorted, Node **found) const {
+       findGroup(keys, n, sorted, found, ThreeWay());
+   }
+   void findGroup(const Key *const *keys, size_t n, bool sorted, Node **found, std::false_type) const;
+   void findGroup(const Key *const *keys, size_t n, bool sorted, Node **found, std::true_type) const;
+   static void prefetchNode(Node *n) {
+       detail::prefetch(n);
+       detail::prefetch(&keyOf(n));
+   }
+   Node *findSlot(const Key &key, Node *&parent, bool &isLeft) const {
+       return findSlot(key, parent, isLeft, ThreeWay());
+   }
+   Node *findSlot(const Key &key, Node *&parent, bool &isLeft, std::false_type) const;
+   Node *findSlot(const Key &key, Node *&parent, bool &isLeft, std::true_type) const;
+   template<class K>
+   Node *lowerBoundNode(const K &key) const { return lowerBoundNode(key, root); }
+   template<class K>
+   Node *lowerBoundNode(const K &key, Node *from) const;
+   template<class K>
+   Node *upperBoundNode(const K &key) const;
+   Node *findHintSlot(Node *hint, const Key &key, Node *&parent, bool &isLeft) const;
+   void linkNode(Node *node, Node *parent, bool isLeft);
+   template<class V>
+   iterator insertHinted(const_iterator hint, V &&value);
+   template<class V>
+   pair<iterator, bool> insertValue(V &&value);
+   template<class K, class... Args>
+   pair<iterator, bool> tryEmplaceKey(K &&key, Args &&...args);
+   static Node *minNode(Node *x);
+   static Node *maxNode(Node *x);
+   static Node *nextNode(Node *n);
+   static Node *prevNode(Node *n);
+   int heightOf(Node *n) const;
+   size_t sizeOf(Node *n) const { return sizeOf(n, OrderStatistics()); }
+   size_t sizeOf(Node *n, std::true_type) const { return n ? n->size : 0; }
+   size_t sizeOf(Node *, std::false_type) const { return 0; }
+   void updateSize(Node *n, std::true_type) { n->size = sizeOf(n->left) + sizeOf(n->right) + 1; }
+   void updateSize(Node *, std::false_type) {}
+   void refreshSizesUp(Node *n) { refreshSizesUp(n, OrderStatistics()); }
+   void refreshSizesUp(Node *n, std::true_type) { for (; n; n = n->parent) updateSize(n, std::true_type()); }
+   void refreshSizesUp(Node *, std::false_type) {}
+   static Node *topOf(Node *n) {
+       while (n->parent) n = n->parent;
+       return n;
+   }
+   Node *nthNode(size_t k) const;
+   size_t positionOf(Node *n) const;
+   void update(Node *n) { update(n, Balance()); }
+   void update(Node *n, avl_balance);
+   void update(Node *n, red_black_balance) { updateSize(n, OrderStatistics()); }
+   int balance(Node *n) const;
+   void attachToParent(Node *parent, Node *child, bool asLeft);
+   Node *rotateLeft(Node *x);
+   Node *rotateRight(Node *y);
+   void insertFixup(Node *n, avl_balance) { rebalanceUp(n->parent); }
+   void insertFixup(Node *n, red_black_balance);
+   void eraseFixup(Node *x, Node *xp, int removed, avl_balance) { (void) x, (void) removed; rebalanceUp(xp); }
+   void eraseFixup(Node *x, Node *xp, int removed, red_black_balance);
+   // AVL
+   Node *rebalanceAt(Node *n);
+   void retrace(Node *start);
+   void rebalanceUp(Node *start);
+   // red-black; the colour lives in Node::height (1 black, 0 red)
+   static bool isRed(Node *n) { return n && n->height == 0; }
+   static void paintRed(Node *n) { n->height = 0; }
+   static void paintBlack(Node *n) { n->height = 1; }
+   int blackHeight(Node *n) const;
+   void redBlackInsertFixup(Node *z);
+   void redBlackEraseFixup(Node *x, Node *xp);
+   Node *joinTrees(Node *l, Node *k, Node *r) { return joinTrees(l, k, r, Balance()); }
+   Node *joinTrees(Node *l, Node *k, Node *r, avl_balance);
+   Node *joinTrees(Node *l, Node *k, Node *r, red_black_balance);
+   Node *joinTrees(Node *l, Node *r) { return joinTrees(l, r, Balance()); }
+   Node *joinTrees(Node *l, Node *r, avl_balance);
+   Node *joinTrees(Node *l, Node *r, red_black_balance);
+   void splitAt(Node *x, Node *&lo, Node *&hi, bool keepX = true);
+   // a subtree cut loose may have a red root, which becomes a black one
+   void settleRoot(Node *, avl_balance) {}
+   void settleRoot(Node *n, red_black_balance) {
+       if (n) paintBlack(n);
+   }
+   Node *splitByKey(Node *t, const Key &key, Node *&lo, Node *&hi);
+   Node *unionTrees(Node *a, Node *b, Link *&dupTail, size_t &dupCount);
+   void recountAfterSplit(map &upper, std::true_type) {
+       nodeCount = sizeOf(root);
+       upper.nodeCount = sizeOf(upper.root);
+   }
+   void recountAfterSplit(map &upper, std::false_type) { countStale = upper.countStale = true; }
+   size_t countNodes() const;
+   void dropAll();
+   template<class Visit>
+   static void dismantle(Node *n, Visit visit);
+   // deeper than any balanced tree that fits in memory
+   static const size_t max_height = 128;
+   template<class V, class F>
+   bool visitRange(const Key *lo, Node *stop, F &fn) const;
+   size_t eraseSubtree(Node *n);
+   void eraseRange(Node *first, Node *last);
+   template<class Predicate>
+   size_t eraseIf(Predicate &pred);
+   void destroySubtree(Node *n);
+   static void copyAugment(Node *to, const Node *from) { to->height = from->height; copySize(to, from, OrderStatistics()); }
+   static void copySize(Node *to, const Node *from, std::true_type) { to->size = from->size; }
+   static void copySize(Node *, const Node *, std::false_type) {}
+   static Node *cloneTree(Node *n, size_t count, NodePool &into);
+   template<class InputIterator>
+   void buildFrom(InputIterator first, InputIterator last);
+   template<class InputIterator>
+   void reserveFor(InputIterator, InputIterator, std::input_iterator_tag) {}
+   template<class InputIterator>
+   void reserveFor(InputIterator first, InputIterator last, std::forward_iterator_tag) {
+       pool.reserve(static_cast<size_t>(std::distance(first, last)));
+   }
+   Node *buildBalanced(Node *&list, size_t n, int depth, int bottom);
+   void markBuilt(Node *, bool, avl_balance) {}
+   void markBuilt(Node *n, bool bottom, red_black_balance) {
+       if (bottom) paintRed(n);
+       else paintBlack(n);
+   }
+   void transplant(Node *u, Node *v);
+   Node *unlinkNode(Node *z, Node *&x, int &removed);
+   void detachNode(Node *z);
+   void eraseNode(Node *z);
+   node_type extractNode(Node *n) {
+       NodePool owner = pool.borrow();
+       detachNode(n);
+       bumpStamp(n, Generations());
+       return node_type(n, std::move(owner));
+   }
+};
+
+// =================== Implementation details (private) ===================
+template<class Key, class T, class Compare, class Policy>
+class map<Key, T, Compare, Policy>::Node : public detail::subtree_size<Policy::order_statistics, SubtreeSize> {
+  public:
+    Link left;
+    Link right;
+    Link parent;
+    Height height; // AVL: subtree height; red-black: colour
+    explicit Node(Node *p = nullptr) : left(nullptr), right(nullptr), parent(p), height(1) {}
+};
+
+// the links above plus the element; every tree node except the header is one
+template<class Key, class T, class Compare, class Policy>
+class map<Key, T, Compare, Policy>::ValueNode : public Node {
+  public:
+    union {
+        value_type value;
+    };
+    template<class... Args>
+    explicit ValueNode(Node *p, Args &&...args) : Node(p), value(std::forward<Args>(args)...) {}
+    // first from key and second from args, each in place in the storage of value
+    template<class K, class... Args>
+    ValueNode(Node *p, detail::key_and_args, K &&key, Args &&...args) : Node(p) {
+        ::new (const_cast<Key *>(std::addressof(value.first))) Key(std::forward<K>(key));
+        try {
+            ::new (std::addressof(value.second)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            value.first.~Key();
+            throw;
+        }
+    }
+    ValueNode(const ValueNode &) = delete;
+    ValueNode &operator=(const ValueNode &) = delete;
+    ~ValueNode() { value.~value_type(); }
+};
+
+// An element extracted from a map, still in its node, which insert() links
+// into a map of the same type again. The handle keeps a reference to the
+// arena the node's storage belongs to, so the node outlives the map it came
+// from; like those maps, it must not be used concurrently with them. An
+// empty handle holds nothing; destroying a full one destroys its element.
+template<class Key, class T, class Compare, class Policy>
+class map<Key, T, Compare, Policy>::node_type {
+    friend class map;
+    Node *node = nullptr;
+    NodePool pool;
+
+    node_type(Node *n, NodePool &&p) : node(n), pool(std::move(p)) {}
+
+    // gives up the node and the arena reference
+    Node *release() {
+        Node *n = node;
+        node = nullptr;
+        NodePool().swap(pool);
+        return n;
+    }
+    void reset() {
+        if (node == nullptr) return;
+        static_cast<ValueNode *>(node)->~ValueNode();
+        bumpStamp(node, Generations());
+        pool.deallocate(node);
+        node = nullptr;
+    }
+    value_type &value() const {
+        if (node == nullptr) throw container_is_empty();
+        return valueOf(node);
+    }
+  public:
+    typedef Key key_type;
+    typedef T mapped_type;
+
+    node_type() = default;
+    node_type(node_type &&other) noexcept : node(other.node), pool(std::move(other.pool)) { other.node = nullptr; }
+    node_type &operator=(node_type &&other) noexcept {
+        node_type taken(std::move(other));
+        swap(taken);
+        return *this;
+    }
+    ~node_type() { reset(); }
+
+    bool empty() const noexcept { return node == nullptr; }
+    explicit operator bool() const noexcept { return node != nullptr; }
+
+    // The key may be changed while the element is out of a map.
+    // throw container_is_empty if the handle is empty
+    Key &key() const { return const_cast<Key &>(value().first); }
+    T &mapped() const { return value().second; }
+
+    void swap(node_type &other) noexcept {
+        std::swap(node, other.node);
+        pool.swap(other.pool);
+    }
+};
+
+template<class Key, class T, class Compare, class Policy>
+struct map<Key, T, Compare, Policy>::insert_return_type {
+    iterator position;
+    bool inserted;
+    node_type node; // the handle passed in if it was not inserted, else empty
+};
+
+// where compact nodes live, shared with every map of the same slot size
+template<class Key, class T, class Compare, class Policy>
+struct map<Key, T, Compare, Policy>::NodeSlots : detail::compact_heap<map::slotBytes()> {};
+
+template<class Key, class T, class Compare, class Policy>
+template<class... Args>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::createNodeIn(NodePool &from, Node *parent, Args &&...args) {
+    void *mem = from.allocate();
+    try {
+        return ::new (mem) ValueNode(parent, std::forward<Args>(args)...);
+    } catch (...) {
+        from.deallocate(mem);
+        throw;
+    }
 }
 
-template<class Key, class T, class Compare>
-typename map<Key, T, Compare>::Node *
-map<Key, T, Compare>::rotateRight(Node *y) {
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::destroyNode(Node *n) {
+    static_cast<ValueNode *>(n)->~ValueNode();
+    bumpStamp(n, Generations());
+    pool.deallocate(n);
+    counters.freed(1);
+}
+
+// recomputes the cached first/last element after a bulk change of the tree
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::refreshHeader() {
+    Node *h = endNode();
+    if (root == nullptr) {
+        h->left = h->right = h;
+    } else {
+        h->left = minNode(root);
+        h->right = maxNode(root);
+    }
+}
+
+// iterator steps; past the last element comes the header, and nullptr means
+// the step is illegal (++end(), --begin(), or --end() on an empty map)
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::stepForward(Node *n, Node *h) {
+    if (n == h) return nullptr;
+    Node *next = nextNode(n);
+    return next ? next : h;
+}
+
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::stepBackward(Node *n, Node *h) {
+    if (n == h) return h->right == h ? nullptr : h->right;
+    if (n == h->left) return nullptr;
+    return prevNode(n);
+}
+
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::minNode(Node *x) {
+    if (x == nullptr) return nullptr;
+    while (x->left) x = x->left;
+    return x;
+}
+
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::maxNode(Node *x) {
+    if (x == nullptr) return nullptr;
+    while (x->right) x = x->right;
+    return x;
+}
+
+// Boolean comparator: walk down to the first node not less than key with one
+// cmp per level, then settle equality with a single extra call at the end.
+template<class Key, class T, class Compare, class Policy>
+template<class K>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::findNode(const K &key, std::false_type) const {
+    Node *cur = root;
+    Node *candidate = nullptr;
+    size_t depth = 0;
+    while (cur) {
+        ++depth;
+        if (!compareKeys(keyOf(cur), key)) {
+            candidate = cur;
+            cur = cur->left;
+        } else {
+            cur = cur->right;
+        }
+    }
+    counters.looked_up(depth);
+    if (candidate && !compareKeys(key, keyOf(candidate))) return candidate;
+    return nullptr;
+}
+
+template<class Key, class T, class Compare, class Policy>
+template<class K>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::findNode(const K &key, std::true_type) const {
+    Node *cur = root;
+    size_t depth = 0;
+    while (cur) {
+        ++depth;
+        int c = compareKeys(key, keyOf(cur));
+        if (c == 0) break;
+        cur = c < 0 ? cur->left : cur->right;
+    }
+    counters.looked_up(depth);
+    return cur;
+}
+
+template<class Key, class T, class Compare, class Policy>
+template<class ForwardIt, class Emit>
+void map<Key, T, Compare, Policy>::findBatch(ForwardIt first, ForwardIt last, Emit emit) const {
+    const Key *keys[find_group];
+    Node *found[find_group];
+    while (first != last) {
+        size_t n = 0;
+        bool sorted = true;
+        for (; n < find_group && first != last; ++n, ++first) {
+            keys[n] = std::addressof(static_cast<const Key &>(*first));
+            if (sorted && n > 0 && keyLess(*keys[n], *keys[n - 1])) sorted = false;
+        }
+        findGroup(keys, n, sorted, found);
+        for (size_t i = 0; i < n; ++i) emit(found[i]);
+    }
+}
+
+// Boolean comparator: every lane walks down like findNode. While a sorted
+// group still goes the same way, comparing the node with the largest and
+// the smallest key decides for all lanes at once.
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::findGroup(const Key *const *keys, size_t n, bool sorted, Node **found,
+                                             std::false_type) const {
+    Node *cur = root;
+    Node *shared = nullptr;
+    size_t depth = 0;
+    if (sorted && n > 1) {
+        while (cur) {
+            if (!keyLess(keyOf(cur), *keys[n - 1])) {
+                shared = cur;
+                cur = cur->left;
+            } else if (keyLess(keyOf(cur), *keys[0])) {
+                cur = cur->right;
+            } else {
+                break;
+            }
+            ++depth;
+        }
+    }
+    Node *at[find_group];
+    Node *candidate[find_group];
+    size_t depths[find_group];
+    for (size_t i = 0; i < n; ++i) {
+        at[i] = cur;
+        candidate[i] = shared;
+        depths[i] = depth;
+    }
+    for (size_t active = cur ? n : 0; active;) {
+        for (size_t i = 0; i < n; ++i) {
+            Node *x = at[i];
+            if (!x) continue;
+            ++depths[i];
+            if (!keyLess(keyOf(x), *keys[i])) {
+                candidate[i] = x;
+                x = x->left;
+            } else {
+                x = x->right;
+            }
+            at[i] = x;
+            if (x) prefetchNode(x);
+            else --active;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        counters.looked_up(depths[i]);
+        found[i] = candidate[i] && !keyLess(*keys[i], keyOf(candidate[i])) ? candidate[i] : nullptr;
+    }
+}
+
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::findGroup(const Key *const *keys, size_t n, bool sorted, Node **found,
+                                             std::true_type) const {
+    Node *cur = root;
+    size_t depth = 0;
+    if (sorted && n > 1) {
+        while (cur) {
+            if (compareKeys(*keys[n - 1], keyOf(cur)) < 0) cur = cur->left;
+            else if (compareKeys(*keys[0], keyOf(cur)) > 0) cur = cur->right;
+            else break;
+            ++depth;
+        }
+    }
+    Node *at[find_group];
+    size_t depths[find_group];
+    for (size_t i = 0; i < n; ++i) {
+        at[i] = cur;
+        found[i] = nullptr;
+        depths[i] = depth;
+    }
+    for (size_t active = cur ? n : 0; active;) {
+        for (size_t i = 0; i < n; ++i) {
+            Node *x = at[i];
+            if (!x) continue;
+            ++depths[i];
+            int c = compareKeys(*keys[i], keyOf(x));
+            if (c == 0) {
+                found[i] = x;
+                x = nullptr;
+            } else {
+                x = c < 0 ? x->left : x->right;
+            }
+            at[i] = x;
+            if (x) prefetchNode(x);
+            else --active;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) counters.looked_up(depths[i]);
+}
+
+// Returns the node holding key, or nullptr with parent/isLeft describing the
+// empty slot where key belongs. With a boolean comparator the last node we
+// turned right at is the only possible match, so it is checked once at the end.
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::findSlot(const Key &key, Node *&parent, bool &isLeft, std::false_type) const {
+    Node *cur = root;
+    Node *pred = nullptr;
+    parent = nullptr;
+    isLeft = false;
+    while (cur) {
+        parent = cur;
+        if (compareKeys(key, keyOf(cur))) {
+            isLeft = true;
+            cur = cur->left;
+        } else {
+            isLeft = false;
+            pred = cur;
+            cur = cur->right;
+        }
+    }
+    if (pred && !compareKeys(keyOf(pred), key)) return pred;
+    return nullptr;
+}
+
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::findSlot(const Key &key, Node *&parent, bool &isLeft, std::true_type) const {
+    Node *cur = root;
+    parent = nullptr;
+    isLeft = false;
+    while (cur) {
+        int c = compareKeys(key, keyOf(cur));
+        if (c == 0) return cur;
+        parent = cur;
+        isLeft = c < 0;
+        cur = isLeft ? cur->left : cur->right;
+    }
+    return nullptr;
+}
+
+template<class Key, class T, class Compare, class Policy>
+template<class K>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::lowerBoundNode(const K &key, Node *from) const {
+    Node *cur = from;
+    Node *candidate = nullptr;
+    while (cur) {
+        if (!keyLess(keyOf(cur), key)) {
+            candidate = cur;
+            cur = cur->left;
+        } else {
+            cur = cur->right;
+        }
+    }
+    return candidate;
+}
+
+template<class Key, class T, class Compare, class Policy>
+template<class K>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::upperBoundNode(const K &key) const {
+    Node *cur = root;
+    Node *candidate = nullptr;
+    while (cur) {
+        if (keyLess(key, keyOf(cur))) {
+            candidate = cur;
+            cur = cur->left;
+        } else {
+            cur = cur->right;
+        }
+    }
+    return candidate;
+}
+
+// Like findSlot, but first tries the gap right before and right after hint
+// (which may be the header, i.e. end()). Two comparisons settle that case; any
+// other position falls back to a full descent from the root.
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::findHintSlot(Node *hint, const Key &key, Node *&parent, bool &isLeft) const {
+    if (root == nullptr) {
+        parent = nullptr;
+        isLeft = false;
+        return nullptr;
+    }
+    if (hint == head) {
+        Node *last = head->right;
+        if (keyLess(keyOf(last), key)) {
+            parent = last;
+            isLeft = false;
+            return nullptr;
+        }
+        return findSlot(key, parent, isLeft);
+    }
+    if (keyLess(key, keyOf(hint))) {
+        Node *before = hint == head->left ? nullptr : prevNode(hint);
+        if (before == nullptr || keyLess(keyOf(before), key)) {
+            // key sits in the gap (before, hint): one of the two has a free slot facing it
+            if (hint->left == nullptr) {
+                parent = hint;
+                isLeft = true;
+            } else {
+                parent = before;
+                isLeft = false;
+            }
+            return nullptr;
+        }
+        return findSlot(key, parent, isLeft);
+    }
+    if (keyLess(keyOf(hint), key)) {
+        Node *after = nextNode(hint);
+        if (after == nullptr || keyLess(key, keyOf(after))) {
+            if (hint->right == nullptr) {
+                parent = hint;
+                isLeft = false;
+            } else {
+                parent = after;
+                isLeft = true;
+            }
+            return nullptr;
+        }
+        return findSlot(key, parent, isLeft);
+    }
+    return hint;
+}
+
+// hangs a fresh node into the slot found by findSlot and restores balance
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::linkNode(Node *node, Node *parent, bool isLeft) {
+    Node *h = endNode();
+    node->parent = parent;
+    if (parent == nullptr) {
+        root = node;
+        h->left = h->right = node;
+    } else if (isLeft) {
+        parent->left = node;
+        if (parent == h->left) h->left = node;
+    } else {
+        parent->right = node;
+        if (parent == h->right) h->right = node;
+    }
+    ++nodeCount;
+    insertFixup(node, Balance());
+}
+
+template<class Key, class T, class Compare, class Policy>
+template<class V>
+pair<typename map<Key, T, Compare, Policy>::iterator, bool>
+map<Key, T, Compare, Policy>::insertValue(V &&value) {
+    // If exists, return iterator
+    Node *parent = nullptr;
+    bool isLeft = false;
+    Node *cur = findSlot(value.first, parent, isLeft);
+    if (cur) return pair<iterator, bool>(iterator(cur, this), false);
+    Node *node = createNode(parent, std::forward<V>(value));
+    linkNode(node, parent, isLeft);
+    return pair<iterator, bool>(iterator(node, this), true);
+}
+
+template<class Key, class T, class Compare, class Policy>
+template<class V>
+typename map<Key, T, Compare, Policy>::iterator
+map<Key, T, Compare, Policy>::insertHinted(const_iterator hint, V &&value) {
+    if (hint.owner != endNode()) throw invalid_iterator();
+    Node *parent = nullptr;
+    bool isLeft = false;
+    Node *cur = findHintSlot(hint.nodePtr, value.first, parent, isLeft);
+    if (cur) return iterator(cur, this);
+    Node *node = createNode(parent, std::forward<V>(value));
+    linkNode(node, parent, isLeft);
+    return iterator(node, this);
+}
+
+template<class Key, class T, class Compare, class Policy>
+template<class K, class... Args>
+pair<typename map<Key, T, Compare, Policy>::iterator, bool>
+map<Key, T, Compare, Policy>::tryEmplaceKey(K &&key, Args &&...args) {
+    Node *parent = nullptr;
+    bool isLeft = false;
+    Node *cur = findSlot(key, parent, isLeft);
+    if (cur) return pair<iterator, bool>(iterator(cur, this), false);
+    Node *node = createNode(parent, detail::key_and_args(), std::forward<K>(key), std::forward<Args>(args)...);
+    linkNode(node, parent, isLeft);
+    return pair<iterator, bool>(iterator(node, this), true);
+}
+
+template<class Key, class T, class Compare, class Policy>
+int map<Key, T, Compare, Policy>::heightOf(Node *n) const { return n ? n->height : 0; }
+
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::update(Node *n, avl_balance) {
+    if (!n) return;
+    int hl = heightOf(n->left);
+    int hr = heightOf(n->right);
+    n->height = (hl > hr ? hl : hr) + 1;
+    updateSize(n, OrderStatistics());
+}
+
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::nthNode(size_t k) const {
+    static_assert(Policy::order_statistics, "nth() needs Policy::order_statistics");
+    if (k >= nodeCount) throw index_out_of_bound();
+    Node *cur = root;
+    while (true) {
+        size_t leftSize = sizeOf(cur->left);
+        if (k == leftSize) return cur;
+        if (k < leftSize) {
+            cur = cur->left;
+        } else {
+            k -= leftSize + 1;
+            cur = cur->right;
+        }
+    }
+}
+
+// in-order index of n, with the header (end()) placed at size()
+template<class Key, class T, class Compare, class Policy>
+size_t map<Key, T, Compare, Policy>::positionOf(Node *n) const {
+    static_assert(Policy::order_statistics, "distance() needs Policy::order_statistics");
+    if (n == head) return nodeCount;
+    size_t pos = sizeOf(n->left);
+    while (n->parent) {
+        if (n == n->parent->right) pos += sizeOf(n->parent->left) + 1;
+        n = n->parent;
+    }
+    return pos;
+}
+
+template<class Key, class T, class Compare, class Policy>
+int map<Key, T, Compare, Policy>::balance(Node *n) const {
+    return heightOf(n->right) - heightOf(n->left);
+}
+
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::attachToParent(Node *parent, Node *child, bool asLeft) {
+    if (parent == nullptr) {
+        root = child;
+        if (child) child->parent = nullptr;
+    } else {
+        if (asLeft) parent->left = child; else parent->right = child;
+        if (child) child->parent = parent;
+    }
+}
+
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::rotateLeft(Node *x) {
+    Node *y = x->right;
+    Node *B = y->left;
+    counters.rotated();
+    y->left = x;
+    x->right = B;
+    if (B) B->parent = x;
+    Node *p = x->parent;
+    y->parent = p;
+    x->parent = y;
+    if (p) { if (p->left == x) p->left = y; else p->right = y; }
+    update(x);
+    update(y);
+    return y;
+}
+
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::rotateRight(Node *y) {
     Node *x = y->left;
     Node *B = x->right;
+    counters.rotated();
     x->right = y;
     y->left = B;
     if (B) B->parent = y;
     Node *p = y->parent;
     x->parent = p;
     y->parent = x;
-    if (p == nullptr) root = x; else if (p->left == y) p->left = x; else p->right = x;
+    if (p) { if (p->left == y) p->left = x; else p->right = x; }
     update(y);
     update(x);
     return x;
 }
 
-template<class Key, class T, class Compare>
-void map<Key, T, Compare>::rebalanceAt(Node *n) {
-    if (!n) return;
+// restores the AVL condition at n and returns the node now rooting that subtree
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::rebalanceAt(Node *n) {
     update(n);
     int bf = balance(n);
     if (bf > 1) {
         if (balance(n->right) < 0) rotateRight(n->right);
-        rotateLeft(n);
-    } else if (bf < -1) {
+        return rotateLeft(n);
+    }
+    if (bf < -1) {
         if (balance(n->left) > 0) rotateLeft(n->left);
-        rotateRight(n);
+        return rotateRight(n);
     }
+    return n;
 }
 
-template<class Key, class T, class Compare>
-void map<Key, T, Compare>::rebalanceUp(Node *start) {
+// AVL retracing after the subtree under start grew or shrank by one level.
+// Nodes are rebalanced bottom-up until one comes out with the height it had
+// before; nothing above it can change then, so only subtree sizes (if kept)
+// are refreshed the rest of the way. Rotations never touch root, so this
+// also works on the detached subtrees that split and join juggle.
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::retrace(Node *start) {
     Node *cur = start;
     while (cur) {
-        rebalanceAt(cur);
-        cur = cur->parent;
+        counters.rebalanced();
+        int before = cur->height;
+        Node *sub = rebalanceAt(cur);
+        if (sub->height == before) {
+            refreshSizesUp(sub->parent);
+            return;
+        }
+        cur = sub->parent;
     }
 }
 
-template<class Key, class T, class Compare>
-void map<Key, T, Compare>::destroySubtree(Node *n) {
-    if (!n) return;
-    destroySubtree(n->left);
-    destroySubtree(n->right);
-    delete n;
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::rebalanceUp(Node *start) {
+    if (start == nullptr) return;
+    retrace(start);
+    root = topOf(root);
 }
 
-template<class Key, class T, class Compare>
-typename map<Key, T, Compare>::Node *
-map<Key, T, Compare>::cloneSubtree(Node *n, Node *parent) {
+template<class Key, class T, class Compare, class Policy>
+int map<Key, T, Compare, Policy>::blackHeight(Node *n) const {
+    int h = 0;
+    for (; n; n = n->left) h += !isRed(n);
+    return h;
+}
+
+// z has just been linked in red; the only thing that can be wrong is a red
+// parent. Recolouring may push the problem up, a rotation always ends it.
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::redBlackInsertFixup(Node *z) {
+    while (isRed(z->parent)) {
+        counters.rebalanced();
+        Node *p = z->parent;
+        Node *g = p->parent; // p is red, so it is not the top
+        if (p == g->left) {
+            Node *u = g->right;
+            if (isRed(u)) {
+                paintBlack(p);
+                paintBlack(u);
+                paintRed(g);
+                z = g;
+                continue;
+            }
+            if (z == p->right) {
+                rotateLeft(p);
+                p = z;
+            }
+            paintBlack(p);
+            paintRed(g);
+            rotateRight(g);
+        } else {
+            Node *u = g->left;
+            if (isRed(u)) {
+                paintBlack(p);
+                paintBlack(u);
+                paintRed(g);
+                z = g;
+                continue;
+            }
+            if (z == p->left) {
+                rotateRight(p);
+                p = z;
+            }
+            paintBlack(p);
+            paintRed(g);
+            rotateLeft(g);
+        }
+        break;
+    }
+}
+
+// x (possibly nullptr) under xp has one black node fewer on its paths than
+// its sibling. Same case analysis as CLRS, written without a nil sentinel.
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::redBlackEraseFixup(Node *x, Node *xp) {
+    while (xp && !isRed(x)) {
+        counters.rebalanced();
+        if (x == xp->left) {
+            Node *w = xp->right;
+            if (isRed(w)) {
+                paintBlack(w);
+                paintRed(xp);
+                rotateLeft(xp);
+                w = xp->right;
+            }
+            if (!isRed(w->left) && !isRed(w->right)) {
+                paintRed(w);
+                x = xp;
+                xp = x->parent;
+                continue;
+            }
+            if (!isRed(w->right)) {
+                paintBlack(w->left);
+                paintRed(w);
+                rotateRight(w);
+                w = xp->right;
+            }
+            w->height = xp->height;
+            paintBlack(xp);
+            paintBlack(w->right);
+            rotateLeft(xp);
+        } else {
+            Node *w = xp->left;
+            if (isRed(w)) {
+                paintBlack(w);
+                paintRed(xp);
+                rotateRight(xp);
+                w = xp->left;
+            }
+            if (!isRed(w->left) && !isRed(w->right)) {
+                paintRed(w);
+                x = xp;
+                xp = x->parent;
+                continue;
+            }
+            if (!isRed(w->left)) {
+                paintBlack(w->right);
+                paintRed(w);
+                rotateLeft(w);
+                w = xp->left;
+            }
+            w->height = xp->height;
+            paintBlack(xp);
+            paintBlack(w->left);
+            rotateRight(xp);
+        }
+        return;
+    }
+    if (x) paintBlack(x);
+}
+
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::insertFixup(Node *n, red_black_balance) {
+    paintRed(n);
+    refreshSizesUp(n->parent);
+    redBlackInsertFixup(n);
+    root = topOf(root);
+    paintBlack(root);
+}
+
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::eraseFixup(Node *x, Node *xp, int removed, red_black_balance) {
+    refreshSizesUp(xp);
+    if (removed != 0) redBlackEraseFixup(x, xp);
+    if (root) {
+        root = topOf(root);
+        paintBlack(root);
+    }
+}
+
+// AVL join: builds a balanced tree holding l, then k, then r (all keys of l
+// below k, all keys of r above). The lower tree is hung off the spine of the
+// taller one at matching height, which raises that spine by at most one, so
+// it is retraced exactly like an insertion. Costs O(|h(l) - h(r)| + 1).
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::joinTrees(Node *l, Node *k, Node *r, avl_balance) {
+    int hl = heightOf(l);
+    int hr = heightOf(r);
+    k->parent = nullptr;
+    if (hl > hr + 1) {
+        Node *p = l;
+        Node *c = l->right;
+        while (heightOf(c) > hr + 1) {
+            p = c;
+            c = c->right;
+        }
+        k->left = c;
+        if (c) c->parent = k;
+        k->right = r;
+        if (r) r->parent = k;
+        update(k);
+        p->right = k;
+        k->parent = p;
+        retrace(p);
+        return topOf(p);
+    }
+    if (hr > hl + 1) {
+        Node *p = r;
+        Node *c = r->left;
+        while (heightOf(c) > hl + 1) {
+            p = c;
+            c = c->left;
+        }
+        k->right = c;
+        if (c) c->parent = k;
+        k->left = l;
+        if (l) l->parent = k;
+        update(k);
+        p->left = k;
+        k->parent = p;
+        retrace(p);
+        return topOf(p);
+    }
+    k->left = l;
+    if (l) l->parent = k;
+    k->right = r;
+    if (r) r->parent = k;
+    update(k);
+    return k;
+}
+
+// Red-black join: both roots are blackened, then k goes in red at the
+// black node of the taller tree's spine whose black height matches the other
+// tree, and an ordinary insert fixup repairs a red-red pair above it.
+// Walking the spines for the black heights makes this O(log n).
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::joinTrees(Node *l, Node *k, Node *r, red_black_balance) {
+    if (l) paintBlack(l);
+    if (r) paintBlack(r);
+    int bl = blackHeight(l);
+    int br = blackHeight(r);
+    k->parent = nullptr;
+    if (bl > br) {
+        Node *p = nullptr;
+        Node *c = l;
+        for (int h = bl; isRed(c) || h > br; c = c->right) {
+            h -= !isRed(c);
+            p = c;
+        }
+        k->left = c;
+        if (c) c->parent = k;
+        k->right = r;
+        if (r) r->parent = k;
+        paintRed(k);
+        update(k);
+        p->right = k;
+        k->parent = p;
+        refreshSizesUp(p);
+        redBlackInsertFixup(k);
+        Node *top = topOf(p);
+        paintBlack(top);
+        return top;
+    }
+    if (br > bl) {
+        Node *p = nullptr;
+        Node *c = r;
+        for (int h = br; isRed(c) || h > bl; c = c->left) {
+            h -= !isRed(c);
+            p = c;
+        }
+        k->right = c;
+        if (c) c->parent = k;
+        k->left = l;
+        if (l) l->parent = k;
+        paintRed(k);
+        update(k);
+        p->left = k;
+        k->parent = p;
+        refreshSizesUp(p);
+        redBlackInsertFixup(k);
+        Node *top = topOf(p);
+        paintBlack(top);
+        return top;
+    }
+    k->left = l;
+    if (l) l->parent = k;
+    k->right = r;
+    if (r) r->parent = k;
+    paintBlack(k);
+    update(k);
+    return k;
+}
+
+// join without a middle node: the maximum of l is unlinked and used as one
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::joinTrees(Node *l, Node *r, avl_balance) {
+    if (l == nullptr) return r;
+    if (r == nullptr) return l;
+    Node *m = maxNode(l);
+    Node *p = m->parent;
+    Node *rest;
+    if (p == nullptr) {
+        rest = m->left;
+        if (rest) rest->parent = nullptr;
+    } else {
+        p->right = m->left;
+        if (m->left) m->left->parent = p;
+        retrace(p);
+        rest = topOf(p);
+    }
+    return joinTrees(rest, m, r, avl_balance());
+}
+
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::joinTrees(Node *l, Node *r, red_black_balance) {
+    if (l == nullptr || r == nullptr) {
+        Node *only = l ? l : r;
+        if (only) paintBlack(only);
+        return only;
+    }
+    Node *m = maxNode(l);
+    Node *p = m->parent;
+    Node *child = m->left;
+    Node *rest;
+    if (p == nullptr) {
+        rest = child;
+        if (rest) rest->parent = nullptr;
+    } else {
+        p->right = child;
+        if (child) child->parent = p;
+        refreshSizesUp(p);
+        if (isRed(child)) {
+            paintBlack(child);
+        } else if (!isRed(m)) {
+            redBlackEraseFixup(child, p);
+        }
+        rest = topOf(p);
+    }
+    m->left = nullptr;
+    return joinTrees(rest, m, r, red_black_balance());
+}
+
+// Splits the tree containing x (up to the ancestor whose parent is nullptr)
+// into lo, the nodes ordered before x, and hi, x with the nodes after it
+// (or without x, which is then left detached, if keepX is false).
+// Works by position, so no key is compared; the joins along the way to the
+// top telescope to O(log n) in total.
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::splitAt(Node *x, Node *&lo, Node *&hi, bool keepX) {
+    Node *p = x->parent;
+    bool fromLeft = p && p->left == x;
+    lo = x->left;
+    if (lo) lo->parent = nullptr;
+    Node *r = x->right;
+    if (r) r->parent = nullptr;
+    x->left = x->right = nullptr;
+    hi = keepX ? joinTrees(nullptr, x, r) : r;
+    while (p) {
+        Node *next = p->parent;
+        bool nextFromLeft = next && next->left == p;
+        if (fromLeft) {
+            Node *pr = p->right;
+            if (pr) pr->parent = nullptr;
+            p->left = p->right = nullptr;
+            hi = joinTrees(hi, p, pr);
+        } else {
+            Node *pl = p->left;
+            if (pl) pl->parent = nullptr;
+            p->left = p->right = nullptr;
+            lo = joinTrees(pl, p, lo);
+        }
+        p = next;
+        fromLeft = nextFromLeft;
+    }
+    settleRoot(lo, Balance());
+    settleRoot(hi, Balance());
+}
+
+// Post-order walk over the detached subtree n that takes it apart as it goes:
+// each node is unhooked from its parent before visit() sees it, so visit may
+// destroy it. Parent links stand in for a stack, so depth costs nothing.
+template<class Key, class T, class Compare, class Policy>
+template<class Visit>
+void map<Key, T, Compare, Policy>::dismantle(Node *n, Visit visit) {
+    Node *cur = n;
+    while (cur) {
+        if (cur->left) {
+            cur = cur->left;
+        } else if (cur->right) {
+            cur = cur->right;
+        } else {
+            Node *p = cur == n ? nullptr : cur->parent;
+            if (p) {
+                if (p->left == cur) p->left = nullptr;
+                else p->right = nullptr;
+            }
+            visit(cur);
+            cur = p;
+        }
+    }
+}
+
+// In-order walk from the first key not less than *lo (or the first element)
+// up to stop. The stack holds the nodes still to be visited whose left side
+// is done, i.e. the path of the walk without the nodes it turned right at.
+template<class Key, class T, class Compare, class Policy>
+template<class V, class F>
+bool map<Key, T, Compare, Policy>::visitRange(const Key *lo, Node *stop, F &fn) const {
+    Node *stack[max_height];
+    size_t top = 0;
+    for (Node *x = root; x;) {
+        if (lo == nullptr || !keyLess(keyOf(x), *lo)) {
+            stack[top++] = x;
+            x = x->left;
+        } else {
+            x = x->right;
+        }
+    }
+    while (top) {
+        Node *x = stack[--top];
+        if (x == stop) return true;
+        if (!detail::keep_going(fn, static_cast<V &>(valueOf(x)))) return false;
+        for (Node *y = x->right; y; y = y->left) stack[top++] = y;
+    }
+    return true;
+}
+
+// destroys and frees a detached subtree, returning how many nodes it held
+template<class Key, class T, class Compare, class Policy>
+size_t map<Key, T, Compare, Policy>::eraseSubtree(Node *n) {
+    size_t freed = 0;
+    dismantle(n, [this, &freed](Node *x) {
+        destroyNode(x);
+        ++freed;
+    });
+    return freed;
+}
+
+// Splits the detached tree t into the keys below key and those above it.
+// A node with exactly that key goes to neither side and is returned.
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::splitByKey(Node *t, const Key &key, Node *&lo, Node *&hi) {
+    Node *x = lowerBoundNode(key, t);
+    if (x == nullptr) {
+        lo = t;
+        hi = nullptr;
+        return nullptr;
+    }
+    bool equal = !keyLess(key, keyOf(x));
+    splitAt(x, lo, hi, !equal);
+    if (!equal) return nullptr;
+    x->parent = nullptr;
+    return x;
+}
+
+// Join-based union of the detached trees a and b: b is taken apart at its
+// root, a is split by that key and the halves are united recursively. On a
+// tie the node of a stays and the one of b is appended, in key order, to the
+// chain ending at dupTail (linked through right).
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::unionTrees(Node *a, Node *b, Link *&dupTail, size_t &dupCount) {
+    if (b == nullptr) return a;
+    if (a == nullptr) return b;
+    Node *bl = b->left;
+    Node *br = b->right;
+    if (bl) bl->parent = nullptr;
+    if (br) br->parent = nullptr;
+    b->left = b->right = nullptr;
+    Node *al, *ar;
+    Node *same = splitByKey(a, keyOf(b), al, ar);
+    Node *l = unionTrees(al, bl, dupTail, dupCount);
+    Node *k = b;
+    if (same) {
+        *dupTail = b;
+        dupTail = &b->right;
+        ++dupCount;
+        k = same;
+    }
+    Node *r = unionTrees(ar, br, dupTail, dupCount);
+    return joinTrees(l, k, r);
+}
+
+template<class Key, class T, class Compare, class Policy>
+size_t map<Key, T, Compare, Policy>::countNodes() const {
+    size_t n = 0;
+    for (Node *x = minNode(root); x; x = nextNode(x)) ++n;
+    return n;
+}
+
+// Destroys every element. A pool nobody else uses drops its slabs in one go;
+// a shared one gets each slot back on its free list for the other maps. So
+// does a map with generation checks, whose stamps must outlive the elements.
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::dropAll() {
+    if (Generations::value || pool.shared()) {
+        eraseSubtree(root);
+    } else {
+        counters.freed(size());
+        destroySubtree(root);
+        pool.release();
+    }
+}
+
+// erases [first, last); last == nullptr stands for end()
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::eraseRange(Node *first, Node *last) {
+    if (first == head->left && last == nullptr) {
+        clear();
+        return;
+    }
+    Node *lo, *mid, *hi = nullptr;
+    splitAt(first, lo, mid);
+    if (last) splitAt(last, mid, hi);
+    nodeCount -= eraseSubtree(mid);
+    root = joinTrees(lo, hi);
+    refreshHeader();
+}
+
+// The walk of visitRange, building the new tree from the survivors as they
+// come up, in key order, like a binary counter: what has been kept so far is
+// a row of perfect trees of falling heights, each followed by one node, and a
+// kept node closes the trees of heights 0, 1, ... at the end of the row into
+// one and takes its place after it. Every node is linked in soon after the
+// walk passed it, while it is likely still cached, and the row is joined
+// into one tree at the end. The walk is done with a node (and its right
+// link) once it comes up, so relinking it does not get in its way; the nodes
+// not kept are destroyed on the spot.
+template<class Key, class T, class Compare, class Policy>
+template<class Predicate>
+size_t map<Key, T, Compare, Policy>::eraseIf(Predicate &pred) {
+    Node *stack[max_height];
+    size_t top = 0;
+    for (Node *y = root; y; y = y->left) stack[top++] = y;
+    Node *trees[max_height];
+    Node *after[max_height];
+    int heights[max_height];
+    size_t row = 0;
+    size_t kept = 0;
+    size_t erased = 0;
+    auto next = [&]() {
+        Node *x = stack[--top];
+        for (Node *y = x->right; y; y = y->left) stack[top++] = y;
+        return x;
+    };
+    auto keep = [&](Node *x) {
+        Node *t = nullptr;
+        int h = 0;
+        while (row && heights[row - 1] == h) {
+            Node *k = after[--row];
+            k->parent = nullptr;
+            k->left = trees[row];
+            if (k->left) k->left->parent = k;
+            k->right = t;
+            if (t) t->parent = k;
+            update(k);
+            markBuilt(k, false, Balance());
+            t = k;
+            ++h;
+        }
+        trees[row] = t;
+        heights[row] = h;
+        after[row++] = x;
+        ++kept;
+    };
+    auto finish = [&]() {
+        Node *t = nullptr;
+        while (row) {
+            --row;
+            t = joinTrees(trees[row], after[row], t);
+        }
+        root = t;
+        nodeCount = kept;
+        countStale = false;
+        refreshHeader();
+    };
+    while (top) {
+        Node *x = next();
+        bool drop;
+        try {
+            drop = pred(valueOf(x));
+        } catch (...) {
+            keep(x);
+            while (top) keep(next());
+            finish();
+            throw;
+        }
+        if (drop) {
+            destroyNode(x);
+            ++erased;
+        } else {
+            keep(x);
+        }
+    }
+    finish();
+    return erased;
+}
+
+// runs the destructors only; the storage goes back with the slabs in clear()
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::destroySubtree(Node *n) {
+    if (std::is_trivially_destructible<value_type>::value) return;
+    dismantle(n, [](Node *x) { static_cast<ValueNode *>(x)->~ValueNode(); });
+}
+
+// Copies the subtree n of count nodes in pre-order into one slab freshly
+// reserved from the pool into, taking heights (and sizes) over as they are
+// instead of recomputing them.
+// The source is walked through parent links in step with the copy, so no
+// recursion is involved. If a value copy throws, the part built so far is
+// torn down again before the exception leaves.
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::cloneTree(Node *n, size_t count, NodePool &into) {
     if (!n) return nullptr;
-    Node *m = new Node(n->value, parent);
-    m->left = cloneSubtree(n->left, m);
-    m->right = cloneSubtree(n->right, m);
+    into.reserve(count);
+    Node *top = createNodeIn(into, nullptr, valueOf(n));
+    copyAugment(top, n);
+    try {
+        Node *src = n;
+        Node *dst = top;
+        while (dst) {
+            if (src->left && !dst->left) {
+                src = src->left;
+                dst->left = createNodeIn(into, dst, valueOf(src));
+                dst = dst->left;
+            } else if (src->right && !dst->right) {
+                src = src->right;
+                dst->right = createNodeIn(into, dst, valueOf(src));
+                dst = dst->right;
+            } else {
+                src = src->parent;
+                dst = dst->parent;
+                continue;
+            }
+            copyAugment(dst, src);
+        }
+    } catch (...) {
+        dismantle(top, [&into](Node *x) {
+            static_cast<ValueNode *>(x)->~ValueNode();
+            into.deallocate(x);
+        });
+        throw;
+    }
+    return top;
+}
+
+// Fills the (empty) map from [first, last). Nodes are created in input order
+// and chained through their right links for as long as the keys ascend, then
+// the chain is laid out as a balanced tree. An element that breaks the order
+// ends the chain: the tree is built from what came before it, and it and all
+// later elements go through ordinary insertion.
+template<class Key, class T, class Compare, class Policy>
+template<class InputIterator>
+void map<Key, T, Compare, Policy>::buildFrom(InputIterator first, InputIterator last) {
+    reserveFor(first, last, typename std::iterator_traits<InputIterator>::iterator_category());
+    Node *list = nullptr;
+    Node *tail = nullptr;
+    Node *stray = nullptr;
+    size_t n = 0;
+    try {
+        for (; first != last; ++first) {
+            Node *node = createNode(nullptr, *first);
+            if (tail && !keyLess(keyOf(tail), keyOf(node))) {
+                if (keyLess(keyOf(node), keyOf(tail))) {
+                    stray = node;
+                    ++first;
+                    break;
+                }
+                destroyNode(node); // equal to its predecessor
+                continue;
+            }
+            if (tail) tail->right = node;
+            else list = node;
+            tail = node;
+            ++n;
+        }
+    } catch (...) {
+        while (list) {
+            Node *next = list->right;
+            destroyNode(list);
+            list = next;
+        }
+        throw;
+    }
+    int height = 0;
+    for (size_t m = n; m; m >>= 1) ++height;
+    root = buildBalanced(list, n, 0, height - 1);
+    nodeCount = n;
+    refreshHeader();
+    if (stray == nullptr) return;
+    Node *parent = nullptr;
+    bool isLeft = false;
+    Node *cur;
+    try {
+        cur = findSlot(keyOf(stray), parent, isLeft);
+    } catch (...) {
+        destroyNode(stray);
+        throw;
+    }
+    if (cur) destroyNode(stray);
+    else linkNode(stray, parent, isLeft);
+    for (; first != last; ++first) emplace(*first);
+}
+
+// Takes the first n nodes off the sorted list and makes them a subtree whose
+// two halves differ in size by at most one, so every empty slot sits on one
+// of the last two levels. Heights (or, for red-black, colours: red exactly
+// on the bottom level below the root) and sizes are set on the way back up.
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::buildBalanced(Node *&list, size_t n, int depth, int bottom) {
+    if (n == 0) return nullptr;
+    Node *l = buildBalanced(list, (n - 1) / 2, depth + 1, bottom);
+    Node *m = list;
+    list = list->right;
+    m->parent = nullptr;
+    m->left = l;
+    if (l) l->parent = m;
+    m->right = buildBalanced(list, n - 1 - (n - 1) / 2, depth + 1, bottom);
+    if (m->right) m->right->parent = m;
     update(m);
+    markBuilt(m, depth == bottom && depth > 0, Balance());
     return m;
 }
 
-template<class Key, class T, class Compare>
-typename map<Key, T, Compare>::Node *
-map<Key, T, Compare>::nextNode(Node *n) const {
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::nextNode(Node *n) {
     if (!n) return nullptr;
     if (n->right) return minNode(n->right);
     Node *p = n->parent;
@@ -531,9 +3131,9 @@ map<Key, T, Compare>::nextNode(Node *n) const {
     return p;
 }
 
-template<class Key, class T, class Compare>
-typename map<Key, T, Compare>::Node *
-map<Key, T, Compare>::prevNode(Node *n) const {
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::prevNode(Node *n) {
     if (!n) return nullptr;
     if (n->left) return maxNode(n->left);
     Node *p = n->parent;
@@ -541,8 +3141,8 @@ map<Key, T, Compare>::prevNode(Node *n) const {
     return p;
 }
 
-template<class Key, class T, class Compare>
-void map<Key, T, Compare>::transplant(Node *u, Node *v) {
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::transplant(Node *u, Node *v) {
     Node *p = u->parent;
     if (p == nullptr) {
         root = v;
@@ -554,40 +3154,62 @@ void map<Key, T, Compare>::transplant(Node *u, Node *v) {
     if (v) v->parent = p;
 }
 
-template<class Key, class T, class Compare>
-void map<Key, T, Compare>::eraseNode(Node *z) {
-    if (!z) return;
+// Takes z out of the tree, moving its in-order successor into its place when
+// it has two children (the successor then inherits z's balance field).
+// Returns the parent of the position that actually lost a node, sets x to the
+// subtree now hanging there and removed to the balance field of that position.
+template<class Key, class T, class Compare, class Policy>
+typename map<Key, T, Compare, Policy>::Node *
+map<Key, T, Compare, Policy>::unlinkNode(Node *z, Node *&x, int &removed) {
     if (z->left == nullptr || z->right == nullptr) {
-        Node *child = z->left ? z->left : z->right;
-        Node *parent = z->parent;
-        transplant(z, child);
-        delete z;
-        --nodeCount;
-        rebalanceUp(parent);
+        x = z->left ? z->left : z->right;
+        Node *xp = z->parent;
+        removed = z->height;
+        transplant(z, x);
+        return xp;
+    }
+    Node *s = minNode(z->right);
+    Node *xp;
+    x = s->right;
+    removed = s->height;
+    if (s->parent == z) {
+        xp = s;
     } else {
-        Node *s = minNode(z->right);
-        Node *rebalanceStart = nullptr;
-        if (s->parent != z) {
-            rebalanceStart = s->parent;
-            transplant(s, s->right);
-            s->right = z->right;
-            if (s->right) s->right->parent = s;
-        } else {
-            rebalanceStart = s; // s is direct child of z
-        }
-        Node *parent = z->parent;
-        transplant(z, s);
-        s->left = z->left;
-        if (s->left) s->left->parent = s;
-        // Update heights bottom-up from where size decreased
-        delete z;
-        --nodeCount;
-        // Heights may be inconsistent; fix starting from rebalanceStart and up
-        rebalanceUp(rebalanceStart);
-        rebalanceUp(parent);
+        xp = s->parent;
+        transplant(s, x);
+        s->right = z->right;
+        s->right->parent = s;
     }
+    transplant(z, s);
+    s->left = z->left;
+    s->left->parent = s;
+    s->height = z->height;
+    return xp;
 }
 
+// unlinks z and rebalances, leaving z itself as it is
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::detachNode(Node *z) {
+    if (z == head->left) head->left = orEnd(nextNode(z));
+    if (z == head->right) head->right = orEnd(prevNode(z));
+    Node *x;
+    int removed;
+    Node *xp = unlinkNode(z, x, removed);
+    --nodeCount;
+    eraseFixup(x, xp, removed, Balance());
+}
+
+template<class Key, class T, class Compare, class Policy>
+void map<Key, T, Compare, Policy>::eraseNode(Node *z) {
+    if (!z) return;
+    detachNode(z);
+    destroyNode(z);
+}
+
+template<class Key, class T, class Compare, class Policy>
+void swap(map<Key, T, Compare, Policy> &a, map<Key, T, Compare, Policy> &b) noexcept(noexcept(a.swap(b))) {
+    a.swap(b);
+}
 
 }
 
@@ -0,0 +1,537 @@
+/**
+* fork-join parallel bulk operations on sjtu::map
+*/
+#ifndef SJTU_PARALLEL_HPP
+#define SJTU_PARALLEL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "map.hpp"
+
+namespace sjtu {
+
+/**
+ * a small work-stealing thread pool for fork-join parallelism.
+ * Every worker owns a deque: forked tasks are pushed and popped at its back,
+ * idle workers steal from the front of the others. A thread waiting for a
+ * forked task keeps running queued tasks meanwhile, so nested fork_join calls
+ * cannot deadlock. Threads outside the pool share one extra deque.
+ * threads counts the calling thread as well, so threads - 1 workers are
+ * started; with one thread everything simply runs inline.
+ */
+class thread_pool {
+  public:
+   explicit thread_pool(unsigned threads = std::thread::hardware_concurrency())
+       : queueCount(threads > 1 ? threads : 1), queues(new Queue[queueCount]), pending(0), stopping(false) {
+       for (size_t i = 0; i + 1 < queueCount; ++i) workers.emplace_back([this, i] { work(i); });
+   }
+
+   thread_pool(const thread_pool &) = delete;
+   thread_pool &operator=(const thread_pool &) = delete;
+
+   ~thread_pool() {
+       {
+           std::lock_guard<std::mutex> guard(sleepLock);
+           stopping = true;
+       }
+       wake.notify_all();
+       for (std::thread &w : workers) w.join();
+   }
+
+   size_t threads() const { return queueCount; }
+
+   /**
+  * runs a() and b(), b possibly on another thread, and returns once both
+  *   have finished. An exception thrown by either is rethrown here, after
+  *   both are done.
+    */
+   template<class A, class B>
+   void fork_join(A &&a, B &&b) {
+       if (workers.empty()) {
+           a();
+           b();
+           return;
+       }
+       typedef typename std::remove_reference<B>::type Body;
+       Task task;
+       task.invoke = [](void *body) { (*static_cast<Body *>(body))(); };
+       task.body = const_cast<void *>(static_cast<const void *>(std::addressof(b)));
+       push(&task);
+       std::exception_ptr error;
+       try {
+           a();
+       } catch (...) {
+           error = std::current_exception();
+       }
+       if (reclaim(&task)) run(&task);
+       while (!task.done.load(std::memory_order_acquire)) {
+           if (!runOne()) std::this_thread::yield();
+       }
+       if (error) std::rethrow_exception(error);
+       if (task.error) std::rethrow_exception(task.error);
+   }
+
+  private:
+   struct Task {
+       void (*invoke)(void *) = nullptr;
+       void *body = nullptr;
+       std::exception_ptr error;
+       std::atomic<bool> done{false};
+   };
+   struct Queue {
+       std::mutex lock;
+       std::deque<Task *> tasks;
+   };
+   // which pool and deque the current thread works for
+   struct Self {
+       const thread_pool *pool;
+       size_t index;
+   };
+
+   size_t queueCount;
+   std::unique_ptr<Queue[]> queues; // one per worker, the last for outside threads
+   std::vector<std::thread> workers;
+   std::atomic<size_t> pending;     // tasks sitting in some deque
+   bool stopping;
+   std::mutex sleepLock;
+   std::condition_variable wake;
+
+   static Self &self() {
+       static thread_local Self s = {nullptr, 0};
+       return s;
+   }
+
+   size_t ownQueue() const { return self().pool == this ? self().index : queueCount - 1; }
+
+   void push(Task *task) {
+       Queue &q = queues[ownQueue()];
+       {
+           std::lock_guard<std::mutex> guard(q.lock);
+           q.tasks.push_back(task);
+       }
+       pending.fetch_add(1);
+       {
+           std::lock_guard<std::mutex> guard(sleepLock);
+       }
+       wake.notify_one();
+   }
+
+   // takes task back if nobody has stolen it yet
+   bool reclaim(Task *task) {
+       Queue &q = queues[ownQueue()];
+       std::lock_guard<std::mutex> guard(q.lock);
+       if (q.tasks.empty() || q.tasks.back() != task) return false;
+       q.tasks.pop_back();
+       pending.fetch_sub(1);
+       return true;
+   }
+
+   static void run(Task *task) {
+       try {
+           task->invoke(task->body);
+       } catch (...) {
+           task->error = std::current_exception();
+       }
+       task->done.store(true, std::memory_order_release);
+   }
+
+   // runs one queued task: the newest of our own, else the oldest of another deque
+   bool runOne() {
+       size_t own = ownQueue();
+       Task *task = nullptr;
+       {
+           Queue &q = queues[own];
+           std::lock_guard<std::mutex> guard(q.lock);
+           if (!q.tasks.empty()) {
+               task = q.tasks.back();
+               q.tasks.pop_back();
+           }
+       }
+       for (size_t k = 1; task == nullptr && k < queueCount; ++k) {
+           Queue &q = queues[(own + k) % queueCount];
+           std::lock_guard<std::mutex> guard(q.lock);
+           if (!q.tasks.empty()) {
+               task = q.tasks.front();
+               q.tasks.pop_front();
+           }
+       }
+       if (task == nullptr) return false;
+       pending.fetch_sub(1);
+       run(task);
+       return true;
+   }
+
+   void work(size_t index) {
+       self().pool = this;
+       self().index = index;
+       for (;;) {
+           if (runOne()) continue;
+           std::unique_lock<std::mutex> lock(sleepLock);
+           wake.wait(lock, [this] { return stopping || pending.load() > 0; });
+           if (stopping) return;
+       }
+   }
+};
+
+// the pool used when none is passed, sized to the machine
+inline thread_pool &default_thread_pool() {
+    static thread_pool pool;
+    return pool;
+}
+
+// subtrees estimated to hold fewer elements than this are handled sequentially
+const size_t parallel_grain = 4096;
+
+namespace detail {
+
+/**
+ * the divide-and-conquer algorithms behind the parallel_* functions.
+ * They fork at subtree roots; both halves of a fork touch disjoint subtrees,
+ * and the joins and splits of map only ever write to the nodes they are
+ * handed, so no locking is needed. A subtree's size is estimated as the
+ * total halved once per level, which is close enough for balanced trees.
+ */
+template<class Map>
+struct parallel_ops {
+    typedef typename Map::Node Node;
+    typedef typename Map::ValueNode ValueNode;
+    typedef typename Map::NodePool NodePool;
+
+    struct Context {
+        Map &m;
+        thread_pool &pool;
+        size_t total;
+        size_t grain;
+
+        bool split(int depth) const { return depth < 64 && (total >> depth) > grain; }
+    };
+
+    // detached subtrees waiting to be freed, chained through their roots' parent
+    struct Garbage {
+        Node *first = nullptr;
+        Node *last = nullptr;
+
+        void add(Node *n) {
+            if (n == nullptr) return;
+            n->parent = nullptr;
+            if (last) last->parent = n;
+            else first = n;
+            last = n;
+        }
+        void splice(Garbage &other) {
+            if (other.first == nullptr) return;
+            if (last) last->parent = other.first;
+            else first = other.first;
+            last = other.last;
+            other.first = other.last = nullptr;
+        }
+    };
+
+    // frees the garbage once all forks are done; the pool is not thread-safe
+    static void release(Map &m, Garbage &junk) {
+        Node *n = junk.first;
+        while (n) {
+            Node *next = n->parent;
+            m.eraseSubtree(n);
+            n = next;
+        }
+        junk.first = junk.last = nullptr;
+    }
+
+    // takes b apart at its root, returning its two subtrees detached
+    static void detachChildren(Node *b, Node *&bl, Node *&br) {
+        bl = b->left;
+        br = b->right;
+        if (bl) bl->parent = nullptr;
+        if (br) br->parent = nullptr;
+        b->left = b->right = nullptr;
+    }
+
+    // union of a and b; on equal keys the node of a stays, that of b is dropped
+    static Node *unite(const Context &c, Node *a, Node *b, int depth, Garbage &junk, size_t &dropped) {
+        if (b == nullptr) return a;
+        if (a == nullptr) return b;
+        Node *bl, *br, *al, *ar;
+        detachChildren(b, bl, br);
+        Node *same = c.m.splitByKey(a, Map::keyOf(b), al, ar);
+        Node *l = nullptr, *r = nullptr;
+        if (c.split(depth)) {
+            Garbage rightJunk;
+            size_t rightDropped = 0;
+            c.pool.fork_join([&] { l = unite(c, al, bl, depth + 1, junk, dropped); },
+                             [&] { r = unite(c, ar, br, depth + 1, rightJunk, rightDropped); });
+            junk.splice(rightJunk);
+            dropped += rightDropped;
+        } else {
+            l = unite(c, al, bl, depth + 1, junk, dropped);
+            r = unite(c, ar, br, depth + 1, junk, dropped);
+        }
+        if (same) {
+            junk.add(b);
+            ++dropped;
+            b = same;
+        }
+        return c.m.joinTrees(l, b, r);
+    }
+
+    // keys present in both; the nodes of a are kept
+    static Node *intersect(const Context &c, Node *a, Node *b, int depth, Garbage &junk, size_t &kept) {
+        if (a == nullptr || b == nullptr) {
+            junk.add(a);
+            junk.add(b);
+            return nullptr;
+        }
+        Node *bl, *br, *al, *ar;
+        detachChildren(b, bl, br);
+        Node *same = c.m.splitByKey(a, Map::keyOf(b), al, ar);
+        Node *l = nullptr, *r = nullptr;
+        if (c.split(depth)) {
+            Garbage rightJunk;
+            size_t rightKept = 0;
+            c.pool.fork_join([&] { l = intersect(c, al, bl, depth + 1, junk, kept); },
+                             [&] { r = intersect(c, ar, br, depth + 1, rightJunk, rightKept); });
+            junk.splice(rightJunk);
+            kept += rightKept;
+        } else {
+            l = intersect(c, al, bl, depth + 1, junk, kept);
+            r = intersect(c, ar, br, depth + 1, junk, kept);
+        }
+        junk.add(b);
+        if (same == nullptr) return c.m.joinTrees(l, r);
+        ++kept;
+        return c.m.joinTrees(l, same, r);
+    }
+
+    // keys of a that are not in b
+    static Node *subtract(const Context &c, Node *a, Node *b, int depth, Garbage &junk, size_t &removed) {
+        if (a == nullptr) {
+            junk.add(b);
+            return nullptr;
+        }
+        if (b == nullptr) return a;
+        Node *bl, *br, *al, *ar;
+        detachChildren(b, bl, br);
+        Node *same = c.m.splitByKey(a, Map::keyOf(b), al, ar);
+        Node *l = nullptr, *r = nullptr;
+        if (c.split(depth)) {
+            Garbage rightJunk;
+            size_t rightRemoved = 0;
+            c.pool.fork_join([&] { l = subtract(c, al, bl, depth + 1, junk, removed); },
+                             [&] { r = subtract(c, ar, br, depth + 1, rightJunk, rightRemoved); });
+            junk.splice(rightJunk);
+            removed += rightRemoved;
+        } else {
+            l = subtract(c, al, bl, depth + 1, junk, removed);
+            r = subtract(c, ar, br, depth + 1, junk, removed);
+        }
+        junk.add(b);
+        if (same) {
+            junk.add(same);
+            ++removed;
+        }
+        return c.m.joinTrees(l, r);
+    }
+
+    // Copies the subtree n. Every forked right half allocates from a pool of
+    // its own (pools are not thread-safe); they are all united afterwards.
+    static Node *copy(const Context &c, Node *n, int depth, NodePool &into, std::deque<NodePool> &pools,
+                      std::mutex &poolsLock) {
+        if (n == nullptr) return nullptr;
+        if (!c.split(depth)) return Map::cloneTree(n, 0, into);
+        Node *m = Map::createNodeIn(into, nullptr, Map::valueOf(n));
+        Map::copyAugment(m, n);
+        NodePool *rightPool;
+        {
+            std::lock_guard<std::mutex> guard(poolsLock);
+            pools.emplace_back();
+            rightPool = &pools.back();
+        }
+        Node *l = nullptr;
+        Node *r = nullptr;
+        try {
+            c.pool.fork_join([&] { l = copy(c, n->left, depth + 1, into, pools, poolsLock); },
+                             [&] { r = copy(c, n->right, depth + 1, *rightPool, pools, poolsLock); });
+        } catch (...) {
+            // the storage goes away with the pools
+            c.m.destroySubtree(l);
+            c.m.destroySubtree(r);
+            static_cast<ValueNode *>(m)->~ValueNode();
+            throw;
+        }
+        m->left = l;
+        if (l) l->parent = m;
+        m->right = r;
+        if (r) r->parent = m;
+        return m;
+    }
+
+    template<class Value, class F>
+    static void visit(const Context &c, Node *n, int depth, F &f) {
+        if (n == nullptr) return;
+        if (!c.split(depth)) {
+            for (Node *x = Map::minNode(n), *stop = Map::nextNode(Map::maxNode(n)); x != stop; x = Map::nextNode(x)) {
+                f(static_cast<Value &>(Map::valueOf(x)));
+            }
+            return;
+        }
+        c.pool.fork_join(
+            [&] {
+                visit<Value>(c, n->left, depth + 1, f);
+                f(static_cast<Value &>(Map::valueOf(n)));
+            },
+            [&] { visit<Value>(c, n->right, depth + 1, f); });
+    }
+
+    // empties b after its nodes went into a
+    static void drain(Map &b) {
+        b.root = nullptr;
+        b.nodeCount = 0;
+        b.countStale = false;
+        b.refreshHeader();
+    }
+
+    static Map unite(Map &&a, Map &&b, thread_pool &pool, size_t grain) {
+        Map result(std::move(a));
+        if (b.root == nullptr) return result;
+        size_t total = result.size() + b.size();
+        Context c = {result, pool, total, grain};
+        result.pool.share(b.pool);
+        Garbage junk;
+        size_t dropped = 0;
+        result.root = unite(c, result.root, b.root, 0, junk, dropped);
+        drain(b);
+        result.nodeCount = total - dropped;
+        result.countStale = false;
+        result.refreshHeader();
+        release(result, junk);
+        return result;
+    }
+
+    static Map intersect(Map &&a, Map &&b, thread_pool &pool, size_t grain) {
+        Map result(std::move(a));
+        Context c = {result, pool, result.size() + b.size(), grain};
+        result.pool.share(b.pool);
+        Garbage junk;
+        size_t kept = 0;
+        result.root = intersect(c, result.root, b.root, 0, junk, kept);
+        drain(b);
+        result.nodeCount = kept;
+        result.countStale = false;
+        result.refreshHeader();
+        release(result, junk);
+        return result;
+    }
+
+    static Map subtract(Map &&a, Map &&b, thread_pool &pool, size_t grain) {
+        Map result(std::move(a));
+        if (result.root == nullptr || b.root == nullptr) return result;
+        size_t before = result.size();
+        Context c = {result, pool, before + b.size(), grain};
+        result.pool.share(b.pool);
+        Garbage junk;
+        size_t removed = 0;
+        result.root = subtract(c, result.root, b.root, 0, junk, removed);
+        drain(b);
+        result.nodeCount = before - removed;
+        result.countStale = false;
+        result.refreshHeader();
+        release(result, junk);
+        return result;
+    }
+
+    static Map copy(const Map &source, thread_pool &pool, size_t grain) {
+        Map result;
+        result.cmp = source.cmp;
+        if (source.root == nullptr) return result;
+        Context c = {result, pool, source.size(), grain};
+        std::deque<NodePool> pools;
+        std::mutex poolsLock;
+        result.root = copy(c, source.root, 0, result.pool, pools, poolsLock);
+        for (NodePool &p : pools) result.pool.share(p);
+        result.nodeCount = source.size();
+        result.counters.allocated(result.nodeCount);
+        result.refreshHeader();
+        return result;
+    }
+
+    template<class Value, class M, class F>
+    static void forEach(M &m, F &f, thread_pool &pool, size_t grain) {
+        Context c = {const_cast<Map &>(m), pool, m.size(), grain};
+        visit<Value>(c, m.root, 0, f);
+    }
+};
+}
+
+/**
+ * Parallel set operations. Both maps are consumed: their nodes are relinked
+ *   into the result (no element is copied) and the ones that drop out are
+ *   freed. On equal keys the element of a is kept.
+ * The comparator is called from several threads at once and must not throw.
+ * Work is forked at subtree roots while the estimated subtree size is above
+ *   grain, so the span is O(log^2 n).
+ */
+template<class Key, class T, class Compare, class Policy>
+map<Key, T, Compare, Policy> parallel_union(map<Key, T, Compare, Policy> &&a, map<Key, T, Compare, Policy> &&b,
+                                            thread_pool &pool = default_thread_pool(),
+                                            size_t grain = parallel_grain) {
+    return detail::parallel_ops<map<Key, T, Compare, Policy> >::unite(std::move(a), std::move(b), pool, grain);
+}
+
+template<class Key, class T, class Compare, class Policy>
+map<Key, T, Compare, Policy> parallel_intersection(map<Key, T, Compare, Policy> &&a,
+                                                   map<Key, T, Compare, Policy> &&b,
+                                                   thread_pool &pool = default_thread_pool(),
+                                                   size_t grain = parallel_grain) {
+    return detail::parallel_ops<map<Key, T, Compare, Policy> >::intersect(std::move(a), std::move(b), pool, grain);
+}
+
+// the elements of a whose keys are not in b
+template<class Key, class T, class Compare, class Policy>
+map<Key, T, Compare, Policy> parallel_difference(map<Key, T, Compare, Policy> &&a, map<Key, T, Compare, Policy> &&b,
+                                                 thread_pool &pool = default_thread_pool(),
+                                                 size_t grain = parallel_grain) {
+    return detail::parallel_ops<map<Key, T, Compare, Policy> >::subtract(std::move(a), std::move(b), pool, grain);
+}
+
+/**
+ * deep copy of m, built by several threads. The copy's nodes come from
+ *   several pools that are united at the end, so its layout is less
+ *   sequential than that of the copy constructor.
+ */
+template<class Key, class T, class Compare, class Policy>
+map<Key, T, Compare, Policy> parallel_copy(const map<Key, T, Compare, Policy> &m,
+                                           thread_pool &pool = default_thread_pool(),
+                                           size_t grain = parallel_grain) {
+    return detail::parallel_ops<map<Key, T, Compare, Policy> >::copy(m, pool, grain);
+}
+
+/**
+ * calls f on every element of m, in no particular order and from several
+ *   threads at once; f must be safe to call concurrently.
+ */
+template<class Key, class T, class Compare, class Policy, class F>
+void parallel_for_each(map<Key, T, Compare, Policy> &m, F f, thread_pool &pool = default_thread_pool(),
+                       size_t grain = parallel_grain) {
+    typedef map<Key, T, Compare, Policy> Map;
+    detail::parallel_ops<Map>::template forEach<typename Map::value_type>(m, f, pool, grain);
+}
+
+template<class Key, class T, class Compare, class Policy, class F>
+void parallel_for_each(const map<Key, T, Compare, Policy> &m, F f, thread_pool &pool = default_thread_pool(),
+                       size_t grain = parallel_grain) {
+    typedef map<Key, T, Compare, Policy> Map;
+    detail::parallel_ops<Map>::template forEach<const typename Map::value_type>(m, f, pool, grain);
+}
+
+}
+
+#endif
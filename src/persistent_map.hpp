@@ -0,0 +1,589 @@
+/**
+* an AVL tree with O(1) snapshots through shared, copy-on-write nodes
+*/
+#ifndef SJTU_PERSISTENT_MAP_HPP
+#define SJTU_PERSISTENT_MAP_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include "utility.hpp"
+#include "exceptions.hpp"
+
+namespace sjtu {
+
+/**
+ * a map whose copies and snapshots share their nodes.
+ * Every node counts the trees and parents referring to it. Copying a
+ * persistent_map or taking a snapshot() only bumps the count of the root,
+ * in O(1); an insert or erase then copies just the nodes it changes that
+ * are still shared: the path from the root, and for an erase the siblings a
+ * rotation may move, O(log n) nodes in all. A map that shares nothing (no
+ * snapshot or copy alive) changes its nodes in place, like sjtu::map.
+ * Nodes have no parent links, which sharing rules out, so iterators keep the
+ * path from the root instead; they are read-only, throw invalid_iterator
+ * like those of map, and are invalidated by any change to the map they
+ * came from (not by changes to other maps sharing nodes with it).
+ * The node counts are atomic, so a snapshot may be read and destroyed on
+ * another thread while the live map goes on changing.
+ */
+template<
+   class Key,
+   class T,
+   class Compare = std::less<Key>
+   > class persistent_map {
+  private:
+   struct Node;
+  public:
+   typedef pair<const Key, T> value_type;
+
+   class const_iterator {
+      private:
+      // deep enough for AVL trees of well over 2^40 elements
+      static const int max_depth = 64;
+      // path[0] is the root and path[depth - 1] the element; end() has depth 0
+      const Node *path[max_depth];
+      int depth = 0;
+      const persistent_map *owner = nullptr;
+      public:
+      friend class persistent_map;
+      const_iterator() = default;
+
+      const_iterator(const const_iterator &other) : depth(other.depth), owner(other.owner) {
+          for (int i = 0; i < depth; ++i) path[i] = other.path[i];
+      }
+
+      const_iterator &operator=(const const_iterator &other) {
+          depth = other.depth;
+          owner = other.owner;
+          for (int i = 0; i < depth; ++i) path[i] = other.path[i];
+          return *this;
+      }
+
+      // internal constructor
+      explicit const_iterator(const persistent_map *o) : owner(o) {}
+
+      const value_type &operator*() const {
+          if (depth == 0) throw invalid_iterator();
+          return path[depth - 1]->value;
+      }
+
+      const value_type *operator->() const { return &operator*(); }
+
+      const_iterator operator++(int) {
+          const_iterator tmp = *this;
+          ++(*this);
+          return tmp;
+      }
+
+      const_iterator &operator++() {
+          if (depth == 0) throw invalid_iterator();
+          const Node *cur = path[depth - 1];
+          if (cur->right) {
+              push(cur->right);
+              while (path[depth - 1]->left) push(path[depth - 1]->left);
+          } else {
+              const Node *child = path[--depth];
+              while (depth > 0 && path[depth - 1]->right == child) child = path[--depth];
+          }
+          return *this;
+      }
+
+      const_iterator operator--(int) {
+          const_iterator tmp = *this;
+          --(*this);
+          return tmp;
+      }
+
+      const_iterator &operator--() {
+          if (owner == nullptr) throw invalid_iterator();
+          if (depth == 0) {
+              if (owner->root == nullptr) throw invalid_iterator();
+              push(owner->root);
+              while (path[depth - 1]->right) push(path[depth - 1]->right);
+              return *this;
+          }
+          const Node *cur = path[depth - 1];
+          if (cur->left) {
+              push(cur->left);
+              while (path[depth - 1]->right) push(path[depth - 1]->right);
+              return *this;
+          }
+          int at = depth;
+          const Node *child = path[--at];
+          while (at > 0 && path[at - 1]->left == child) child = path[--at];
+          if (at == 0) throw invalid_iterator(); // was begin()
+          depth = at;
+          return *this;
+      }
+
+      bool operator==(const const_iterator &rhs) const {
+          if (owner != rhs.owner || depth == 0 || rhs.depth == 0) return owner == rhs.owner && depth == rhs.depth;
+          return path[depth - 1] == rhs.path[rhs.depth - 1];
+      }
+
+      bool operator!=(const const_iterator &rhs) const { return !(*this == rhs); }
+      private:
+      void push(const Node *n) {
+          if (depth == max_depth) throw invalid_iterator();
+          path[depth++] = n;
+      }
+   };
+
+   /**
+  * a frozen version of a persistent_map: it shares the nodes the map had
+  * when the snapshot was taken and offers only the const interface
+    */
+   class snapshot_type {
+      private:
+      persistent_map tree;
+      public:
+      friend class persistent_map;
+      snapshot_type() = default;
+
+      const T &at(const Key &key) const { return tree.at(key); }
+
+      const T &operator[](const Key &key) const { return tree.at(key); }
+
+      const_iterator begin() const { return tree.cbegin(); }
+
+      const_iterator cbegin() const { return tree.cbegin(); }
+
+      const_iterator end() const { return tree.cend(); }
+
+      const_iterator cend() const { return tree.cend(); }
+
+      bool empty() const { return tree.empty(); }
+
+      size_t size() const { return tree.size(); }
+
+      size_t count(const Key &key) const { return tree.count(key); }
+
+      const_iterator find(const Key &key) const { return tree.find(key); }
+
+      const_iterator lower_bound(const Key &key) const { return tree.lower_bound(key); }
+
+      const_iterator upper_bound(const Key &key) const { return tree.upper_bound(key); }
+   };
+
+   persistent_map() : root(nullptr), nodeCount(0), cmp(Compare()) {}
+
+   /**
+  * shares the nodes of other in O(1)
+    */
+   persistent_map(const persistent_map &other) : root(share(other.root)), nodeCount(other.nodeCount), cmp(other.cmp) {}
+
+   persistent_map(persistent_map &&other) noexcept : root(other.root), nodeCount(other.nodeCount), cmp(other.cmp) {
+       other.root = nullptr;
+       other.nodeCount = 0;
+   }
+
+   persistent_map &operator=(const persistent_map &other) {
+       if (this == &other) return *this;
+       Node *old = root;
+       root = share(other.root);
+       nodeCount = other.nodeCount;
+       cmp = other.cmp;
+       release(old);
+       return *this;
+   }
+
+   persistent_map &operator=(persistent_map &&other) noexcept {
+       if (this == &other) return *this;
+       swap(other);
+       other.clear();
+       return *this;
+   }
+
+   void swap(persistent_map &other) noexcept {
+       using std::swap;
+       swap(root, other.root);
+       swap(nodeCount, other.nodeCount);
+       swap(cmp, other.cmp);
+   }
+
+   ~persistent_map() { release(root); }
+
+   /**
+  * the current contents, frozen, in O(1)
+    */
+   snapshot_type snapshot() const {
+       snapshot_type s;
+       s.tree = *this;
+       return s;
+   }
+
+   /**
+  * access specified element with bounds checking
+  * throw index_out_of_bound if no element has key
+  * A shared path to the element is copied first, so the reference does not
+  *   reach into a snapshot; it stays valid until the next change or snapshot.
+    */
+   T &at(const Key &key) {
+       const_iterator it = find(key);
+       if (it.depth == 0) throw index_out_of_bound();
+       return ownPath(it)->value.second;
+   }
+
+   const T &at(const Key &key) const {
+       const Node *n = findNode(key);
+       if (n == nullptr) throw index_out_of_bound();
+       return n->value.second;
+   }
+
+   /**
+  * access specified element, inserting a value-initialised one if key is absent
+    */
+   T &operator[](const Key &key) {
+       const_iterator it(this);
+       if (!insertAt(key, nullptr, it)) return ownPath(it)->value.second;
+       ++nodeCount;
+       return const_cast<Node *>(it.path[it.depth - 1])->value.second;
+   }
+
+   /**
+  * behave like at() throw index_out_of_bound if such key does not exist.
+    */
+   const T &operator[](const Key &key) const { return at(key); }
+
+   const_iterator begin() const { return cbegin(); }
+
+   const_iterator cbegin() const {
+       const_iterator it(this);
+       for (const Node *n = root; n; n = n->left) it.push(n);
+       return it;
+   }
+
+   const_iterator end() const { return cend(); }
+
+   const_iterator cend() const { return const_iterator(this); }
+
+   bool empty() const { return nodeCount == 0; }
+
+   size_t size() const { return nodeCount; }
+
+   void clear() {
+       release(root);
+       root = nullptr;
+       nodeCount = 0;
+   }
+
+   /**
+  * insert an element.
+  * return a pair, the first of the pair is
+  *   the iterator to the new element (or the element that prevented the insertion),
+  *   the second one is true if insert successfully, or false.
+    */
+   pair<const_iterator, bool> insert(const value_type &value) {
+       const_iterator it(this);
+       bool inserted = insertAt(value.first, &value, it);
+       if (inserted) ++nodeCount;
+       return pair<const_iterator, bool>(it, inserted);
+   }
+
+   /**
+  * erase the element at pos.
+  *
+  * throw if pos pointed to a bad element (pos == this->end() || pos points an element out of this)
+    */
+   void erase(const_iterator pos) {
+       if (pos.owner != this || pos.depth == 0) throw invalid_iterator();
+       eraseAt(root, pos.path[pos.depth - 1]->value.first);
+       --nodeCount;
+   }
+
+   size_t count(const Key &key) const { return findNode(key) ? 1 : 0; }
+
+   const_iterator find(const Key &key) const {
+       const_iterator it = bound(key, false);
+       if (it.depth == 0 || cmp(key, it.path[it.depth - 1]->value.first)) return cend();
+       return it;
+   }
+
+   /**
+  * returns an iterator to the first element whose key is not less than key,
+  *   or end() if there is none.
+    */
+   const_iterator lower_bound(const Key &key) const { return bound(key, false); }
+
+   /**
+  * returns an iterator to the first element whose key is greater than key,
+  *   or end() if there is none.
+    */
+   const_iterator upper_bound(const Key &key) const { return bound(key, true); }
+  private:
+   Node *root;
+   size_t nodeCount;
+   Compare cmp;
+
+   // helpers
+   static Node *share(Node *n) {
+       if (n) n->refs.fetch_add(1, std::memory_order_relaxed);
+       return n;
+   }
+   static void release(Node *n);
+   static Node *own(Node *n);
+   static int heightOf(const Node *n) { return n ? n->height : 0; }
+   static void update(Node *n) {
+       int hl = heightOf(n->left), hr = heightOf(n->right);
+       n->height = (hl > hr ? hl : hr) + 1;
+   }
+   static Node *rotateLeft(Node *x);
+   static Node *rotateRight(Node *y);
+   static Node *rebalance(Node *n);
+   static void prepareRotation(Node *n, bool fromLeft);
+   const Node *findNode(const Key &key) const;
+   const_iterator bound(const Key &key, bool strict) const;
+   Node *ownPath(const_iterator &it);
+   bool insertAt(const Key &key, const value_type *value, const_iterator &it);
+   void eraseAt(Node *&slot, const Key &key);
+   static Node *detachMin(Node *&slot);
+};
+
+// =================== Implementation details (private) ===================
+// refs counts the maps and parent nodes holding the node; only a node held
+// once may be changed in place
+template<class Key, class T, class Compare>
+struct persistent_map<Key, T, Compare>::Node {
+    std::atomic<size_t> refs;
+    Node *left;
+    Node *right;
+    int height;
+    value_type value;
+    template<class... Args>
+    explicit Node(Args &&...args) : refs(1), left(nullptr), right(nullptr), height(1), value(std::forward<Args>(args)...) {}
+};
+
+// drops one reference; the last one frees the node and releases its children
+template<class Key, class T, class Compare>
+void persistent_map<Key, T, Compare>::release(Node *n) {
+    while (n && n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        release(n->left);
+        Node *right = n->right;
+        delete n;
+        n = right;
+    }
+}
+
+// a version of n that only the caller holds: n itself, or a copy that
+// shares n's children, with the caller's reference to n handed over to it
+template<class Key, class T, class Compare>
+typename persistent_map<Key, T, Compare>::Node *persistent_map<Key, T, Compare>::own(Node *n) {
+    if (n == nullptr || n->refs.load(std::memory_order_acquire) == 1) return n;
+    Node *copy = new Node(n->value);
+    copy->left = share(n->left);
+    copy->right = share(n->right);
+    copy->height = n->height;
+    release(n);
+    return copy;
+}
+
+// rotations relink n and the child that moves up, both already owned
+template<class Key, class T, class Compare>
+typename persistent_map<Key, T, Compare>::Node *persistent_map<Key, T, Compare>::rotateLeft(Node *x) {
+    Node *y = x->right;
+    x->right = y->left;
+    y->left = x;
+    update(x);
+    update(y);
+    return y;
+}
+
+template<class Key, class T, class Compare>
+typename persistent_map<Key, T, Compare>::Node *persistent_map<Key, T, Compare>::rotateRight(Node *y) {
+    Node *x = y->left;
+    y->left = x->right;
+    x->right = y;
+    update(y);
+    update(x);
+    return x;
+}
+
+template<class Key, class T, class Compare>
+typename persistent_map<Key, T, Compare>::Node *persistent_map<Key, T, Compare>::rebalance(Node *n) {
+    update(n);
+    int diff = heightOf(n->left) - heightOf(n->right);
+    if (diff > 1) {
+        if (heightOf(n->left->left) < heightOf(n->left->right)) n->left = rotateLeft(n->left);
+        return rotateRight(n);
+    }
+    if (diff < -1) {
+        if (heightOf(n->right->right) < heightOf(n->right->left)) n->right = rotateRight(n->right);
+        return rotateLeft(n);
+    }
+    return n;
+}
+
+// An erase below the fromLeft side of n may leave the other side two
+// levels taller, and the rotation fixing that moves the sibling and maybe
+// its inner child, which are not on the erase path. They are made owned
+// before anything changes, so all copying (and all that may throw) is done
+// while the tree still holds its old contents.
+template<class Key, class T, class Compare>
+void persistent_map<Key, T, Compare>::prepareRotation(Node *n, bool fromLeft) {
+    Node *&sibling = fromLeft ? n->right : n->left;
+    if (heightOf(sibling) <= heightOf(fromLeft ? n->left : n->right)) return;
+    sibling = own(sibling);
+    Node *&inner = fromLeft ? sibling->left : sibling->right;
+    if (heightOf(inner) > heightOf(fromLeft ? sibling->right : sibling->left)) inner = own(inner);
+}
+
+// one comparison per level: the descent finds the first node not less than
+// key, and a last comparison decides whether that one is equal
+template<class Key, class T, class Compare>
+const typename persistent_map<Key, T, Compare>::Node *persistent_map<Key, T, Compare>::findNode(const Key &key) const {
+    const Node *candidate = nullptr;
+    for (const Node *n = root; n;) {
+        if (cmp(n->value.first, key)) {
+            n = n->right;
+        } else {
+            candidate = n;
+            n = n->left;
+        }
+    }
+    if (candidate && !cmp(key, candidate->value.first)) return candidate;
+    return nullptr;
+}
+
+// the path is recorded down to the last node that qualified, which is the
+// bound; deeper entries are dropped again
+template<class Key, class T, class Compare>
+typename persistent_map<Key, T, Compare>::const_iterator
+persistent_map<Key, T, Compare>::bound(const Key &key, bool strict) const {
+    const_iterator it(this);
+    int found = 0;
+    for (const Node *n = root; n;) {
+        it.push(n);
+        if (strict ? cmp(key, n->value.first) : !cmp(n->value.first, key)) {
+            found = it.depth;
+            n = n->left;
+        } else {
+            n = n->right;
+        }
+    }
+    it.depth = found;
+    return it;
+}
+
+// makes every node on the path of it owned, linking each copy in at once,
+// and points the path at the owned nodes; returns the last of them. The
+// copies keep the children of the originals, so the way down is found by
+// comparing links, not keys.
+template<class Key, class T, class Compare>
+typename persistent_map<Key, T, Compare>::Node *persistent_map<Key, T, Compare>::ownPath(const_iterator &it) {
+    Node **link = &root;
+    Node *n = nullptr;
+    for (int i = 0; i < it.depth; ++i) {
+        n = *link = own(*link);
+        it.path[i] = n;
+        if (i + 1 < it.depth) link = n->left == it.path[i + 1] ? &n->left : &n->right;
+    }
+    return n;
+}
+
+// One descent with one comparison per level records the path to key in it.
+// If key is present, it is left at that element and nothing changes.
+// Otherwise the path is owned, the new node (a copy of *value, or key and
+// T() if value is nullptr) built at the bottom before anything else is
+// relinked. The rotations on the way up only involve nodes of the path, and
+// it follows the new element through them.
+template<class Key, class T, class Compare>
+bool persistent_map<Key, T, Compare>::insertAt(const Key &key, const value_type *value, const_iterator &it) {
+    int found = 0;
+    bool left = false;
+    for (const Node *n = root; n; n = left ? n->left : n->right) {
+        it.push(n);
+        left = cmp(key, n->value.first);
+        if (!left) found = it.depth;
+    }
+    if (found && !cmp(it.path[found - 1]->value.first, key)) {
+        it.depth = found;
+        return false;
+    }
+    Node *parent = ownPath(it);
+    Node *&slot = parent == nullptr ? root : left ? parent->left : parent->right;
+    slot = value ? new Node(*value) : new Node(key, T());
+    it.push(slot);
+    for (int i = it.depth - 2; i >= 0; --i) {
+        Node *n = const_cast<Node *>(it.path[i]);
+        Node *top = rebalance(n);
+        if (top == n) continue;
+        if (i == 0) {
+            root = top;
+        } else {
+            Node *up = const_cast<Node *>(it.path[i - 1]);
+            (up->left == n ? up->left : up->right) = top;
+        }
+        // a single rotation lifted path[i + 1] over n, and a double one
+        // path[i + 2]; below that the path goes on through whichever of n and
+        // path[i + 1] now holds path[i + 3]
+        int drop = i;
+        if (top != it.path[i + 1]) {
+            const Node *child = it.path[i + 1];
+            it.path[i] = top;
+            if (it.depth == i + 3) {
+                it.depth = i + 1;
+                continue;
+            }
+            const Node *next = it.path[i + 3];
+            it.path[i + 1] = n->left == next || n->right == next ? n : child;
+            drop = i + 2;
+        }
+        for (int j = drop; j + 1 < it.depth; ++j) it.path[j] = it.path[j + 1];
+        --it.depth;
+    }
+    return true;
+}
+
+// key must be present
+template<class Key, class T, class Compare>
+void persistent_map<Key, T, Compare>::eraseAt(Node *&slot, const Key &key) {
+    Node *n = slot = own(slot);
+    if (cmp(key, n->value.first)) {
+        prepareRotation(n, true);
+        eraseAt(n->left, key);
+    } else if (cmp(n->value.first, key)) {
+        prepareRotation(n, false);
+        eraseAt(n->right, key);
+    } else {
+        if (n->left == nullptr || n->right == nullptr) {
+            slot = n->left ? n->left : n->right;
+        } else {
+            prepareRotation(n, false);
+            Node *min = detachMin(n->right);
+            min->left = n->left;
+            min->right = n->right;
+            slot = rebalance(min);
+        }
+        // the children now belong to the replacement
+        n->left = n->right = nullptr;
+        release(n);
+        return;
+    }
+    slot = rebalance(n);
+}
+
+// unlinks the leftmost node below slot and returns it, owned
+template<class Key, class T, class Compare>
+typename persistent_map<Key, T, Compare>::Node *persistent_map<Key, T, Compare>::detachMin(Node *&slot) {
+    Node *n = slot = own(slot);
+    if (n->left == nullptr) {
+        slot = n->right;
+        n->right = nullptr;
+        return n;
+    }
+    prepareRotation(n, true);
+    Node *min = detachMin(n->left);
+    slot = rebalance(n);
+    return min;
+}
+
+template<class Key, class T, class Compare>
+void swap(persistent_map<Key, T, Compare> &a, persistent_map<Key, T, Compare> &b) noexcept {
+    a.swap(b);
+}
+
+}
+
+#endif
@@ -0,0 +1,531 @@
+/**
+* saving sjtu maps to files, and loading or mapping them back
+*/
+#ifndef SJTU_SERIALIZE_HPP
+#define SJTU_SERIALIZE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "utility.hpp"
+#include "exceptions.hpp"
+#include "map.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SJTU_HAVE_MMAP 1
+#endif
+
+namespace sjtu {
+
+// raw file access for serializers; both throw runtime_error on failure
+inline void write_bytes(std::FILE *file, const void *data, size_t bytes) {
+    if (bytes && std::fwrite(data, 1, bytes, file) != bytes) throw runtime_error();
+}
+
+inline void read_bytes(std::FILE *file, void *data, size_t bytes) {
+    if (bytes && std::fread(data, 1, bytes, file) != bytes) throw runtime_error();
+}
+
+/**
+ * how save() and load() store a key or value of type T.
+ * Trivially copyable types are stored as their bytes (raw = true). Any
+ * other type needs a specialisation with raw = false and
+ *     static void write(std::FILE *, const T &);
+ *     static T read(std::FILE *);
+ * e.g. a length followed by the characters for std::string. Files holding
+ * such types can be loaded into a map but not mapped by mapped_map.
+ */
+template<class T, class = void>
+struct serializer {
+    static const bool raw = false;
+};
+
+template<class T>
+struct serializer<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+    static const bool raw = true;
+    static void write(std::FILE *file, const T &value) { write_bytes(file, &value, sizeof(T)); }
+    static T read(std::FILE *file) {
+        T value;
+        read_bytes(file, &value, sizeof(T));
+        return value;
+    }
+};
+
+namespace detail {
+
+/**
+ * the 64 bytes in front of the elements of a saved map.
+ * With raw_records the elements follow as an array of pair<const Key, T>
+ * exactly as they lie in memory, in key order, so the file can be mapped
+ * and searched in place; custom_records are key, value, key, value, ...
+ * as the serializers wrote them. Sizes and the byte order are those of the
+ * machine that saved the file and are checked when it is read back.
+ */
+struct map_file_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t format;
+    std::uint64_t count;
+    std::uint32_t key_size;
+    std::uint32_t value_size;
+    std::uint32_t record_size;
+    std::uint32_t byte_order;
+    char reserved[24];
+};
+
+static_assert(sizeof(map_file_header) == 64, "map_file_header must stay 64 bytes");
+
+const char map_file_magic[8] = {'S', 'J', 'T', 'U', 'M', 'A', 'P', '\0'};
+const std::uint32_t map_file_version = 1;
+const std::uint32_t raw_records = 1;
+const std::uint32_t custom_records = 2;
+const std::uint32_t map_file_byte_order = 0x01020304;
+
+// Key and T of a map's pair<const Key, T>
+template<class Value>
+struct record_types;
+
+template<class Key, class T>
+struct record_types<pair<const Key, T> > {
+    typedef Key key_type;
+    typedef T mapped_type;
+};
+
+template<class Key, class T>
+struct records : std::integral_constant<bool, serializer<Key>::raw && serializer<T>::raw> {
+    typedef pair<const Key, T> value_type;
+    static map_file_header header(size_t count) {
+        map_file_header h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, map_file_magic, sizeof(h.magic));
+        h.version = map_file_version;
+        h.format = records::value ? raw_records : custom_records;
+        h.count = count;
+        h.key_size = sizeof(Key);
+        h.value_size = sizeof(T);
+        h.record_size = sizeof(value_type);
+        h.byte_order = map_file_byte_order;
+        return h;
+    }
+
+    // whether a file with header h was saved from this Key and T
+    static bool matches(const map_file_header &h) {
+        map_file_header expected = header(0);
+        return std::memcmp(h.magic, expected.magic, sizeof(h.magic)) == 0 && h.version == expected.version &&
+               h.format == expected.format && h.key_size == expected.key_size &&
+               h.value_size == expected.value_size && h.record_size == expected.record_size &&
+               h.byte_order == expected.byte_order;
+    }
+};
+
+// closes the file on every way out
+class file_handle {
+  public:
+   file_handle(const char *path, const char *mode) : file(std::fopen(path, mode)) {
+       if (file == nullptr) throw runtime_error();
+   }
+   file_handle(const file_handle &) = delete;
+   file_handle &operator=(const file_handle &) = delete;
+   ~file_handle() {
+       if (file) std::fclose(file);
+   }
+
+   std::FILE *get() const { return file; }
+
+   // closes the file, reporting a failed final write
+   void close() {
+       std::FILE *f = file;
+       file = nullptr;
+       if (std::fclose(f) != 0) throw runtime_error();
+   }
+  private:
+   std::FILE *file;
+};
+
+/**
+ * reads the elements of a saved map one at a time, as the input range
+ * a map is built from
+ */
+template<class Key, class T>
+class record_reader {
+  public:
+   typedef std::input_iterator_tag iterator_category;
+   typedef pair<const Key, T> value_type;
+   typedef std::ptrdiff_t difference_type;
+   typedef const value_type *pointer;
+   typedef const value_type &reference;
+
+   record_reader() = default;
+   record_reader(std::FILE *f, size_t count) : file(f), left(count) {
+       if (left) next();
+   }
+   // copies share the file, so only one of them may be advanced
+   record_reader(const record_reader &other) : file(other.file), left(other.left) {
+       if (other.loaded) ::new (storage) value_type(*other.current());
+       loaded = other.loaded;
+   }
+   record_reader &operator=(const record_reader &other) {
+       if (this == &other) return *this;
+       drop();
+       file = other.file;
+       left = other.left;
+       if (other.loaded) ::new (storage) value_type(*other.current());
+       loaded = other.loaded;
+       return *this;
+   }
+   ~record_reader() { drop(); }
+
+   reference operator*() const { return *current(); }
+   pointer operator->() const { return current(); }
+
+   record_reader &operator++() {
+       if (--left) next();
+       else drop();
+       return *this;
+   }
+
+   // only comparisons with the end, where nothing is left, are meaningful
+   bool operator==(const record_reader &rhs) const { return left == rhs.left; }
+   bool operator!=(const record_reader &rhs) const { return left != rhs.left; }
+  private:
+   std::FILE *file = nullptr;
+   size_t left = 0;
+   bool loaded = false;
+   alignas(value_type) unsigned char storage[sizeof(value_type)];
+
+   value_type *current() const { return reinterpret_cast<value_type *>(const_cast<unsigned char *>(storage)); }
+
+   void drop() {
+       if (loaded) current()->~value_type();
+       loaded = false;
+   }
+
+   void next() {
+       drop();
+       next(records<Key, T>());
+       loaded = true;
+   }
+   void next(std::true_type) { read_bytes(file, storage, sizeof(value_type)); }
+   void next(std::false_type) {
+       Key key = serializer<Key>::read(file);
+       T value = serializer<T>::read(file);
+       ::new (storage) value_type(std::move(key), std::move(value));
+   }
+};
+
+template<class Key, class T>
+void writeRecord(std::FILE *file, const pair<const Key, T> &value, std::true_type) {
+    write_bytes(file, &value, sizeof(value));
+}
+
+template<class Key, class T>
+void writeRecord(std::FILE *file, const pair<const Key, T> &value, std::false_type) {
+    serializer<Key>::write(file, value.first);
+    serializer<T>::write(file, value.second);
+}
+
+}
+
+/**
+ * writes the elements of m in key order to the file at path, replacing it.
+ * Works for sjtu::map, btree_map, flat_map and persistent_map alike; see map_file_header
+ * for the format and serializer for keys and values that are not
+ * trivially copyable.
+ * throw runtime_error if the file cannot be written
+ */
+template<class Map>
+void save(const Map &m, const char *path) {
+    typedef typename detail::record_types<typename Map::value_type>::key_type Key;
+    typedef typename detail::record_types<typename Map::value_type>::mapped_type T;
+    typedef detail::records<Key, T> Records;
+    detail::file_handle file(path, "wb");
+    detail::map_file_header header = Records::header(m.size());
+    write_bytes(file.get(), &header, sizeof(header));
+    for (typename Map::const_iterator it = m.cbegin(); it != m.cend(); ++it) {
+        const typename Records::value_type &value = *it;
+        detail::writeRecord(file.get(), value, Records());
+    }
+    file.close();
+}
+
+/**
+ * replaces the contents of m with the elements saved at path. They come in
+ * key order, so the tree is built in O(n) without a rotation (see the
+ * range constructor of map); if reading fails, m is left unchanged.
+ * throw runtime_error if the file cannot be read or holds other types
+ */
+template<class Key, class T, class Compare, class Policy>
+void load(map<Key, T, Compare, Policy> &m, const char *path) {
+    typedef detail::records<Key, T> Records;
+    detail::file_handle file(path, "rb");
+    detail::map_file_header header;
+    read_bytes(file.get(), &header, sizeof(header));
+    if (!Records::matches(header)) throw runtime_error();
+    m.assign(detail::record_reader<Key, T>(file.get(), static_cast<size_t>(header.count)),
+             detail::record_reader<Key, T>());
+}
+
+/**
+ * a read-only map served straight from a file written by save(), for keys
+ * and values stored raw. The file is mapped into memory (read into it
+ * where there is no mmap) and searched in place, so opening it costs no
+ * more than one pass over the keys, which checks that they ascend under
+ * Compare: a file saved from a map with another ordering is refused rather
+ * than searched wrongly.
+ * It offers the const interface of sjtu::map, and its const_iterator
+ * behaves like map's, throwing invalid_iterator when misused.
+ * The file must not change while it is mapped.
+ */
+template<class Key, class T, class Compare = std::less<Key> >
+class mapped_map {
+  public:
+   typedef Key key_type;
+   typedef T mapped_type;
+   typedef pair<const Key, T> value_type;
+   static_assert(detail::records<Key, T>::value, "mapped_map needs keys and values stored raw");
+
+   class const_iterator {
+      public:
+      typedef std::bidirectional_iterator_tag iterator_category;
+      typedef pair<const Key, T> value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef const value_type *pointer;
+      typedef const value_type &reference;
+      private:
+      const value_type *ptr = nullptr;
+      const mapped_map *owner = nullptr;
+      public:
+      friend class mapped_map;
+
+      const_iterator() = default;
+      const_iterator(const value_type *p, const mapped_map *o) : ptr(p), owner(o) {}
+
+      const value_type &operator*() const {
+          if (owner == nullptr || ptr == owner->last) throw invalid_iterator();
+          return *ptr;
+      }
+
+      const value_type *operator->() const { return &(operator*()); }
+
+      const_iterator &operator++() {
+          if (owner == nullptr || ptr == owner->last) throw invalid_iterator();
+          ++ptr;
+          return *this;
+      }
+
+      const_iterator operator++(int) {
+          const_iterator tmp = *this;
+          ++(*this);
+          return tmp;
+      }
+
+      const_iterator &operator--() {
+          if (owner == nullptr || ptr == owner->first) throw invalid_iterator();
+          --ptr;
+          return *this;
+      }
+
+      const_iterator operator--(int) {
+          const_iterator tmp = *this;
+          --(*this);
+          return tmp;
+      }
+
+      bool operator==(const const_iterator &rhs) const { return owner == rhs.owner && ptr == rhs.ptr; }
+
+      bool operator!=(const const_iterator &rhs) const { return !(*this == rhs); }
+   };
+   typedef const_iterator iterator;
+
+   /**
+  * throw runtime_error if the file cannot be read, holds other types or
+  *   is not in the order of compare
+    */
+   explicit mapped_map(const char *path, const Compare &compare = Compare()) : cmp(compare) {
+       open(path);
+   }
+
+   mapped_map(const mapped_map &) = delete;
+   mapped_map &operator=(const mapped_map &) = delete;
+
+   ~mapped_map() { close(); }
+
+   const_iterator begin() const { return cbegin(); }
+   const_iterator cbegin() const { return const_iterator(first, this); }
+   const_iterator end() const { return cend(); }
+   const_iterator cend() const { return const_iterator(last, this); }
+
+   bool empty() const { return first == last; }
+   size_t size() const { return static_cast<size_t>(last - first); }
+
+   /**
+  * throw index_out_of_bound if no element has key
+    */
+   const T &at(const Key &key) const {
+       const value_type *p = findRecord(key);
+       if (p == nullptr) throw index_out_of_bound();
+       return p->second;
+   }
+
+   const T &operator[](const Key &key) const { return at(key); }
+
+   const T *find_ptr(const Key &key) const {
+       const value_type *p = findRecord(key);
+       return p ? &p->second : nullptr;
+   }
+
+   size_t count(const Key &key) const { return findRecord(key) ? 1 : 0; }
+
+   const_iterator find(const Key &key) const {
+       const value_type *p = findRecord(key);
+       return const_iterator(p ? p : last, this);
+   }
+
+   const_iterator lower_bound(const Key &key) const { return const_iterator(lowerRecord(key), this); }
+
+   const_iterator upper_bound(const Key &key) const { return const_iterator(upperRecord(key), this); }
+  private:
+   const value_type *first = nullptr;
+   const value_type *last = nullptr;
+   void *mapping = nullptr;
+   size_t mappedBytes = 0;
+   Compare cmp;
+
+   void open(const char *path);
+   void close();
+   void checkOrder();
+   const value_type *lowerRecord(const Key &key) const;
+   const value_type *upperRecord(const Key &key) const;
+   const value_type *findRecord(const Key &key) const {
+       const value_type *p = lowerRecord(key);
+       return p != last && !cmp(key, p->first) ? p : nullptr;
+   }
+};
+
+// =================== Implementation details (private) ===================
+
+#ifdef SJTU_HAVE_MMAP
+
+template<class Key, class T, class Compare>
+void mapped_map<Key, T, Compare>::open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) throw runtime_error();
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(detail::map_file_header)) {
+        ::close(fd);
+        throw runtime_error();
+    }
+    size_t bytes = static_cast<size_t>(info.st_size);
+    void *p = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) throw runtime_error();
+    mapping = p;
+    mappedBytes = bytes;
+    const detail::map_file_header *header = static_cast<const detail::map_file_header *>(p);
+    if (!detail::records<Key, T>::matches(*header) ||
+        (bytes - sizeof(*header)) / sizeof(value_type) < header->count) {
+        close();
+        throw runtime_error();
+    }
+    first = reinterpret_cast<const value_type *>(header + 1);
+    last = first + header->count;
+    checkOrder();
+}
+
+template<class Key, class T, class Compare>
+void mapped_map<Key, T, Compare>::close() {
+    if (mapping) ::munmap(mapping, mappedBytes);
+    mapping = nullptr;
+}
+
+#else
+
+// no mmap: the whole file is read into memory instead
+template<class Key, class T, class Compare>
+void mapped_map<Key, T, Compare>::open(const char *path) {
+    detail::file_handle file(path, "rb");
+    detail::map_file_header header;
+    read_bytes(file.get(), &header, sizeof(header));
+    if (!detail::records<Key, T>::matches(header)) throw runtime_error();
+    size_t bytes = static_cast<size_t>(header.count) * sizeof(value_type);
+    void *p = ::operator new(bytes ? bytes : 1);
+    try {
+        read_bytes(file.get(), p, bytes);
+    } catch (...) {
+        ::operator delete(p);
+        throw;
+    }
+    mapping = p;
+    mappedBytes = bytes;
+    first = static_cast<const value_type *>(p);
+    last = first + header.count;
+    checkOrder();
+}
+
+template<class Key, class T, class Compare>
+void mapped_map<Key, T, Compare>::close() {
+    ::operator delete(mapping);
+    mapping = nullptr;
+}
+
+#endif
+
+// drops the file and throws runtime_error unless its keys strictly ascend
+// under cmp, which the binary searches below rely on
+template<class Key, class T, class Compare>
+void mapped_map<Key, T, Compare>::checkOrder() {
+    for (const value_type *p = first; p != last && p + 1 != last; ++p) {
+        if (!cmp(p->first, p[1].first)) {
+            close();
+            throw runtime_error();
+        }
+    }
+}
+
+template<class Key, class T, class Compare>
+const typename mapped_map<Key, T, Compare>::value_type *
+mapped_map<Key, T, Compare>::lowerRecord(const Key &key) const {
+    const value_type *lo = first;
+    size_t n = size();
+    while (n > 0) {
+        size_t half = n / 2;
+        if (cmp(lo[half].first, key)) {
+            lo += half + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+    return lo;
+}
+
+template<class Key, class T, class Compare>
+const typename mapped_map<Key, T, Compare>::value_type *
+mapped_map<Key, T, Compare>::upperRecord(const Key &key) const {
+    const value_type *lo = first;
+    size_t n = size();
+    while (n > 0) {
+        size_t half = n / 2;
+        if (!cmp(key, lo[half].first)) {
+            lo += half + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+    return lo;
+}
+
+}
+
+#endif
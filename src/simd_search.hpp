@@ -0,0 +1,343 @@
+/**
+* vectorised search inside the sorted key arrays of sjtu::btree_map
+*/
+#ifndef SJTU_SIMD_SEARCH_HPP
+#define SJTU_SIMD_SEARCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+// the instruction set is chosen when compiling (-mavx2, -msse4.2, ...);
+// define SJTU_NO_SIMD to always take the scalar path
+#ifndef SJTU_NO_SIMD
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SJTU_SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SJTU_SIMD_SSE2 1
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define SJTU_SIMD_SSE42 1
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SJTU_SIMD_NEON 1
+#endif
+#endif
+
+namespace sjtu {
+
+namespace detail {
+
+// how the keys of a node are ordered, as far as a vector compare can tell
+struct scalar_keys {};     // any other Key or Compare: compare one key at a time
+struct ascending_keys {};  // Compare is std::less over arithmetic keys
+struct descending_keys {}; // Compare is std::greater over arithmetic keys
+
+// the lane layouts a key can be compared in
+enum simd_layout { simd_none, simd_i32, simd_u32, simd_i64, simd_u64, simd_f32, simd_f64 };
+
+template<class Key>
+struct simd_layout_of
+    : std::integral_constant<
+          int, std::is_floating_point<Key>::value
+                   ? (sizeof(Key) == 4 ? simd_f32 : sizeof(Key) == 8 && std::is_same<Key, double>::value ? simd_f64 : simd_none)
+               : std::is_integral<Key>::value && !std::is_same<Key, bool>::value
+                   ? (sizeof(Key) == 4 ? (std::is_signed<Key>::value ? simd_i32 : simd_u32)
+                      : sizeof(Key) == 8 ? (std::is_signed<Key>::value ? simd_i64 : simd_u64)
+                                         : simd_none)
+                   : simd_none> {};
+
+inline int simd_popcount(unsigned mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcount(mask);
+#else
+    int bits = 0;
+    for (; mask; mask &= mask - 1) ++bits;
+    return bits;
+#endif
+}
+
+/**
+ * one layout on the instruction set at hand: Width keys per vector,
+ * load() reads them unaligned, splat() repeats one key, and less(a, b)
+ * counts the lanes where a < b. Layouts the instruction set lacks keep
+ * available false and are searched with scalar code.
+ */
+template<int Layout>
+struct simd_lanes {
+    static const bool available = false;
+};
+
+#if defined(SJTU_SIMD_AVX2)
+template<>
+struct simd_lanes<simd_i32> {
+    static const bool available = true;
+    static const int Width = 8;
+    typedef __m256i vec;
+    static vec load(const void *p) { return _mm256_loadu_si256(static_cast<const __m256i *>(p)); }
+    static vec splat(std::int32_t x) { return _mm256_set1_epi32(x); }
+    static int less(vec a, vec b) { return simd_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(b, a)))); }
+};
+// unsigned lanes compare as signed ones once the sign bit is flipped
+template<>
+struct simd_lanes<simd_u32> {
+    static const bool available = true;
+    static const int Width = 8;
+    typedef __m256i vec;
+    static vec flip(vec v) { return _mm256_xor_si256(v, _mm256_set1_epi32(INT32_MIN)); }
+    static vec load(const void *p) { return flip(_mm256_loadu_si256(static_cast<const __m256i *>(p))); }
+    static vec splat(std::uint32_t x) { return flip(_mm256_set1_epi32((std::int32_t) x)); }
+    static int less(vec a, vec b) { return simd_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(b, a)))); }
+};
+template<>
+struct simd_lanes<simd_i64> {
+    static const bool available = true;
+    static const int Width = 4;
+    typedef __m256i vec;
+    static vec load(const void *p) { return _mm256_loadu_si256(static_cast<const __m256i *>(p)); }
+    static vec splat(std::int64_t x) { return _mm256_set1_epi64x(x); }
+    static int less(vec a, vec b) { return simd_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(b, a)))); }
+};
+template<>
+struct simd_lanes<simd_u64> {
+    static const bool available = true;
+    static const int Width = 4;
+    typedef __m256i vec;
+    static vec flip(vec v) { return _mm256_xor_si256(v, _mm256_set1_epi64x(INT64_MIN)); }
+    static vec load(const void *p) { return flip(_mm256_loadu_si256(static_cast<const __m256i *>(p))); }
+    static vec splat(std::uint64_t x) { return flip(_mm256_set1_epi64x((std::int64_t) x)); }
+    static int less(vec a, vec b) { return simd_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(b, a)))); }
+};
+template<>
+struct simd_lanes<simd_f32> {
+    static const bool available = true;
+    static const int Width = 8;
+    typedef __m256 vec;
+    static vec load(const void *p) { return _mm256_loadu_ps(static_cast<const float *>(p)); }
+    static vec splat(float x) { return _mm256_set1_ps(x); }
+    static int less(vec a, vec b) { return simd_popcount(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ))); }
+};
+template<>
+struct simd_lanes<simd_f64> {
+    static const bool available = true;
+    static const int Width = 4;
+    typedef __m256d vec;
+    static vec load(const void *p) { return _mm256_loadu_pd(static_cast<const double *>(p)); }
+    static vec splat(double x) { return _mm256_set1_pd(x); }
+    static int less(vec a, vec b) { return simd_popcount(_mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ))); }
+};
+#elif defined(SJTU_SIMD_SSE2)
+template<>
+struct simd_lanes<simd_i32> {
+    static const bool available = true;
+    static const int Width = 4;
+    typedef __m128i vec;
+    static vec load(const void *p) { return _mm_loadu_si128(static_cast<const __m128i *>(p)); }
+    static vec splat(std::int32_t x) { return _mm_set1_epi32(x); }
+    static int less(vec a, vec b) { return simd_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(a, b)))); }
+};
+template<>
+struct simd_lanes<simd_u32> {
+    static const bool available = true;
+    static const int Width = 4;
+    typedef __m128i vec;
+    static vec flip(vec v) { return _mm_xor_si128(v, _mm_set1_epi32(INT32_MIN)); }
+    static vec load(const void *p) { return flip(_mm_loadu_si128(static_cast<const __m128i *>(p))); }
+    static vec splat(std::uint32_t x) { return flip(_mm_set1_epi32((std::int32_t) x)); }
+    static int less(vec a, vec b) { return simd_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(a, b)))); }
+};
+#if defined(SJTU_SIMD_SSE42)
+// SSE2 has no 64-bit integer compare; SSE4.2 adds a signed one
+template<>
+struct simd_lanes<simd_i64> {
+    static const bool available = true;
+    static const int Width = 2;
+    typedef __m128i vec;
+    static vec load(const void *p) { return _mm_loadu_si128(static_cast<const __m128i *>(p)); }
+    static vec splat(std::int64_t x) { return _mm_set1_epi64x(x); }
+    static int less(vec a, vec b) { return simd_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(b, a)))); }
+};
+template<>
+struct simd_lanes<simd_u64> {
+    static const bool available = true;
+    static const int Width = 2;
+    typedef __m128i vec;
+    static vec flip(vec v) { return _mm_xor_si128(v, _mm_set1_epi64x(INT64_MIN)); }
+    static vec load(const void *p) { return flip(_mm_loadu_si128(static_cast<const __m128i *>(p))); }
+    static vec splat(std::uint64_t x) { return flip(_mm_set1_epi64x((std::int64_t) x)); }
+    static int less(vec a, vec b) { return simd_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(b, a)))); }
+};
+#endif
+template<>
+struct simd_lanes<simd_f32> {
+    static const bool available = true;
+    static const int Width = 4;
+    typedef __m128 vec;
+    static vec load(const void *p) { return _mm_loadu_ps(static_cast<const float *>(p)); }
+    static vec splat(float x) { return _mm_set1_ps(x); }
+    static int less(vec a, vec b) { return simd_popcount(_mm_movemask_ps(_mm_cmplt_ps(a, b))); }
+};
+template<>
+struct simd_lanes<simd_f64> {
+    static const bool available = true;
+    static const int Width = 2;
+    typedef __m128d vec;
+    static vec load(const void *p) { return _mm_loadu_pd(static_cast<const double *>(p)); }
+    static vec splat(double x) { return _mm_set1_pd(x); }
+    static int less(vec a, vec b) { return simd_popcount(_mm_movemask_pd(_mm_cmplt_pd(a, b))); }
+};
+#elif defined(SJTU_SIMD_NEON)
+// NEON has no movemask; a true lane is all ones, so its top bit summed
+// across the vector is the count
+template<>
+struct simd_lanes<simd_i32> {
+    static const bool available = true;
+    static const int Width = 4;
+    typedef int32x4_t vec;
+    static vec load(const void *p) { return vld1q_s32(static_cast<const std::int32_t *>(p)); }
+    static vec splat(std::int32_t x) { return vdupq_n_s32(x); }
+    static int less(vec a, vec b) { return (int) vaddvq_u32(vshrq_n_u32(vcltq_s32(a, b), 31)); }
+};
+template<>
+struct simd_lanes<simd_u32> {
+    static const bool available = true;
+    static const int Width = 4;
+    typedef uint32x4_t vec;
+    static vec load(const void *p) { return vld1q_u32(static_cast<const std::uint32_t *>(p)); }
+    static vec splat(std::uint32_t x) { return vdupq_n_u32(x); }
+    static int less(vec a, vec b) { return (int) vaddvq_u32(vshrq_n_u32(vcltq_u32(a, b), 31)); }
+};
+template<>
+struct simd_lanes<simd_i64> {
+    static const bool available = true;
+    static const int Width = 2;
+    typedef int64x2_t vec;
+    static vec load(const void *p) { return vld1q_s64(static_cast<const std::int64_t *>(p)); }
+    static vec splat(std::int64_t x) { return vdupq_n_s64(x); }
+    static int less(vec a, vec b) { return (int) vaddvq_u64(vshrq_n_u64(vcltq_s64(a, b), 63)); }
+};
+template<>
+struct simd_lanes<simd_u64> {
+    static const bool available = true;
+    static const int Width = 2;
+    typedef uint64x2_t vec;
+    static vec load(const void *p) { return vld1q_u64(static_cast<const std::uint64_t *>(p)); }
+    static vec splat(std::uint64_t x) { return vdupq_n_u64(x); }
+    static int less(vec a, vec b) { return (int) vaddvq_u64(vshrq_n_u64(vcltq_u64(a, b), 63)); }
+};
+template<>
+struct simd_lanes<simd_f32> {
+    static const bool available = true;
+    static const int Width = 4;
+    typedef float32x4_t vec;
+    static vec load(const void *p) { return vld1q_f32(static_cast<const float *>(p)); }
+    static vec splat(float x) { return vdupq_n_f32(x); }
+    static int less(vec a, vec b) { return (int) vaddvq_u32(vshrq_n_u32(vcltq_f32(a, b), 31)); }
+};
+template<>
+struct simd_lanes<simd_f64> {
+    static const bool available = true;
+    static const int Width = 2;
+    typedef float64x2_t vec;
+    static vec load(const void *p) { return vld1q_f64(static_cast<const double *>(p)); }
+    static vec splat(double x) { return vdupq_n_f64(x); }
+    static int less(vec a, vec b) { return (int) vaddvq_u64(vshrq_n_u64(vcltq_f64(a, b), 63)); }
+};
+#endif
+
+template<class Compare, class Key>
+struct is_less_of : std::integral_constant<bool, std::is_same<Compare, std::less<Key>>::value ||
+                                                     std::is_same<Compare, std::less<>>::value> {};
+
+template<class Compare, class Key>
+struct is_greater_of : std::integral_constant<bool, std::is_same<Compare, std::greater<Key>>::value ||
+                                                        std::is_same<Compare, std::greater<>>::value> {};
+
+/**
+ * picks the search of a btree_map node: vectorised when Key is an arithmetic
+ * type the instruction set can compare and Compare is std::less or
+ * std::greater, scalar otherwise.
+ */
+template<class Key, class Compare>
+struct simd_key_order {
+    static const bool vectorised = simd_lanes<simd_layout_of<Key>::value>::available;
+    typedef typename std::conditional<
+        vectorised && is_less_of<Compare, Key>::value, ascending_keys,
+        typename std::conditional<vectorised && is_greater_of<Compare, Key>::value, descending_keys,
+                                  scalar_keys>::type>::type type;
+};
+
+// the number of keys[0, n) below probe, or above it with ProbeFirst
+template<bool ProbeFirst, class Key>
+int simd_count_less(const Key *keys, int n, Key probe) {
+    typedef simd_lanes<simd_layout_of<Key>::value> L;
+    typename L::vec p = L::splat(probe);
+    int i = 0, count = 0;
+    for (; i + L::Width <= n; i += L::Width) count += ProbeFirst ? L::less(p, L::load(keys + i)) : L::less(L::load(keys + i), p);
+    for (; i < n; ++i) count += ProbeFirst ? probe < keys[i] : keys[i] < probe;
+    return count;
+}
+
+// a search first halves larger nodes down to this many keys, then counts
+// the rest with full vectors, which is cheaper than the remaining
+// unpredictable branches
+const int simd_window = 32;
+
+/**
+ * lower and upper bound of probe in the sorted keys[0, n). The count of
+ * keys that come before probe within the window is the offset of the bound,
+ * so no lane ever needs to be located.
+ */
+template<class Key>
+int simd_lower_bound(const Key *keys, int n, Key probe, ascending_keys) {
+    int lo = 0, hi = n;
+    while (hi - lo > simd_window) {
+        int mid = (lo + hi) >> 1;
+        if (keys[mid] < probe) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo + simd_count_less<false>(keys + lo, hi - lo, probe);
+}
+
+template<class Key>
+int simd_upper_bound(const Key *keys, int n, Key probe, ascending_keys) {
+    int lo = 0, hi = n;
+    while (hi - lo > simd_window) {
+        int mid = (lo + hi) >> 1;
+        if (probe < keys[mid]) hi = mid;
+        else lo = mid + 1;
+    }
+    return hi - simd_count_less<true>(keys + lo, hi - lo, probe);
+}
+
+template<class Key>
+int simd_lower_bound(const Key *keys, int n, Key probe, descending_keys) {
+    int lo = 0, hi = n;
+    while (hi - lo > simd_window) {
+        int mid = (lo + hi) >> 1;
+        if (probe < keys[mid]) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo + simd_count_less<true>(keys + lo, hi - lo, probe);
+}
+
+template<class Key>
+int simd_upper_bound(const Key *keys, int n, Key probe, descending_keys) {
+    int lo = 0, hi = n;
+    while (hi - lo > simd_window) {
+        int mid = (lo + hi) >> 1;
+        if (keys[mid] < probe) hi = mid;
+        else lo = mid + 1;
+    }
+    return hi - simd_count_less<false>(keys + lo, hi - lo, probe);
+}
+
+}
+
+}
+
+#endif
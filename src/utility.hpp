@@ -1,6 +1,8 @@
 #ifndef SJTU_UTILITY_HPP
 #define SJTU_UTILITY_HPP
 
+#include <cstddef>
+#include <tuple>
 #include <utility>
 
 namespace sjtu {
@@ -13,15 +15,26 @@ class pair {
     constexpr pair() : first(), second() {}
     pair(const pair &other) = default;
     pair(pair &&other) = default;
+    pair &operator=(const pair &other) = default;
+    pair &operator=(pair &&other) = default;
     pair(const T1 &x, const T2 &y) : first(x), second(y) {}
     template<class U1, class U2>
-    pair(U1 &&x, U2 &&y) : first(x), second(y) {}
+    pair(U1 &&x, U2 &&y) : first(std::forward<U1>(x)), second(std::forward<U2>(y)) {}
     template<class U1, class U2>
     pair(const pair<U1, U2> &other) : first(other.first), second(other.second) {}
     template<class U1, class U2>
-    pair(pair<U1, U2> &&other) : first(other.first), second(other.second) {}
+    pair(pair<U1, U2> &&other) : first(std::move(other.first)), second(std::move(other.second)) {}
+    // builds each member in place from its own argument tuple, like std::pair
+    template<class... Args1, class... Args2>
+    pair(std::piecewise_construct_t, std::tuple<Args1...> firstArgs, std::tuple<Args2...> secondArgs)
+        : pair(firstArgs, secondArgs, std::index_sequence_for<Args1...>(), std::index_sequence_for<Args2...>()) {}
+   private:
+    template<class Tuple1, class Tuple2, std::size_t... I1, std::size_t... I2>
+    pair(Tuple1 &firstArgs, Tuple2 &secondArgs, std::index_sequence<I1...>, std::index_sequence<I2...>)
+        : first(std::forward<typename std::tuple_element<I1, Tuple1>::type>(std::get<I1>(firstArgs))...),
+          second(std::forward<typename std::tuple_element<I2, Tuple2>::type>(std::get<I2>(secondArgs))...) {}
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif